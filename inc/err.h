@@ -26,5 +26,7 @@ const char *err_to_string(int err);
 #define ERR_SEMANTICS (-12)
 #define ERR_BAD_PARSE (-13)
 #define ERR_UNBOUND_VAR (-14)
+#define ERR_UNSUPPORTED (-15)
+#define ERR_BUDGET (-16)
 
 #endif /* _ERR_H_ */
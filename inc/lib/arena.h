@@ -0,0 +1,57 @@
+/**
+ * @file arena.h
+ *
+ * @brief Region (bump) allocator declarations
+ *
+ * Memory is carved out of large chunks with a bump pointer. Small elements
+ * can be handed back individually and are recycled through per-size free
+ * lists, and the whole region can be dropped at once with `arena_reset`.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+/* Default chunk size when 0 is passed to `arena_new` */
+#define ARENA_DEFAULT_CHUNK (0x10000)
+
+struct _arena;
+typedef struct _arena arena_t;
+
+/**
+ * @brief Allocation counters, used to size arenas for a workload
+ */
+typedef struct _arena_stats {
+    /* Allocations served, including recycled ones */
+    unsigned long allocs;
+
+    /* Allocations served from a free list rather than the bump pointer */
+    unsigned long recycled;
+
+    /* Elements handed back through `arena_release` */
+    unsigned long releases;
+
+    /* Bytes currently handed out */
+    size_t live_bytes;
+
+    /* Largest value `live_bytes` has reached */
+    size_t high_water;
+
+    /* Bytes held in chunks (live, free listed & unused) */
+    size_t reserved_bytes;
+
+    /* Number of chunks currently held */
+    int chunks;
+} arena_stats_t;
+
+arena_t *arena_new(size_t chunk_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void arena_release(arena_t *arena, void *elem, size_t size);
+void arena_reset(arena_t *arena);
+void arena_stats(arena_t *arena, arena_stats_t *stats);
+void arena_free(arena_t *arena);
+
+#endif /* _ARENA_H_ */
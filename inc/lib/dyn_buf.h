@@ -24,6 +24,7 @@ typedef struct _dyn_buf dyn_buf_t;
 dyn_buf_t *dyn_buf_new();
 
 int dyn_buf_push(dyn_buf_t *buf, void *elem);
+int dyn_buf_pop(dyn_buf_t *buf, void **elem);
 int dyn_buf_at(dyn_buf_t *buf, int ind, void **elem);
 int dyn_buf_len(dyn_buf_t *buf);
 void dyn_buf_free(dyn_buf_t *dyn, void (*free_elem)(void *));
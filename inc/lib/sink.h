@@ -0,0 +1,64 @@
+/**
+ * @file sink.h
+ *
+ * @brief Byte sink declarations
+ *
+ * Output is collected in a growable buffer. A sink backed by a file hands
+ * the buffer to the file in large writes, one once SINK_FILE_CHUNK bytes
+ * have piled up & one on `sink_flush`. A sink without a file just keeps
+ * growing, & its contents can be read back as a string.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _SINK_H_
+#define _SINK_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Initial buffer size */
+#define SINK_INIT_SIZE (0x100)
+
+/* A file backed sink writes out once this many bytes are buffered */
+#define SINK_FILE_CHUNK (0x100000)
+
+/**
+ * @brief Public so that sinks can live on the stack & single bytes can be
+ *        appended inline
+ */
+typedef struct _sink {
+    char *buf;
+    size_t len;
+    size_t cap;
+
+    /* NULL to only collect into `buf` */
+    FILE *fp;
+
+    /* First ERR_* hit, every write after it is dropped */
+    int err;
+} sink_t;
+
+void sink_init(sink_t *sink, FILE *fp);
+int sink_reserve(sink_t *sink, size_t len);
+int sink_write(sink_t *sink, const char *data, size_t len);
+int sink_puts(sink_t *sink, const char *str);
+int sink_putu(sink_t *sink, unsigned long val);
+int sink_flush(sink_t *sink);
+const char *sink_str(sink_t *sink);
+void sink_free(sink_t *sink);
+
+/**
+ * @brief Append a single byte
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static inline int sink_putc(sink_t *sink, char c) {
+    if (sink->len == sink->cap && sink_reserve(sink, 1) < 0)
+        return sink->err;
+
+    sink->buf[sink->len++] = c;
+    return 0;
+}
+
+#endif /* _SINK_H_ */
@@ -6,282 +6,552 @@
  * @author Lars Wander
  */
 
+#include <limits.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
-#include <util.h>
+#include <lib/arena.h>
+#include <lib/sink.h>
 
 #include "ast.h"
-#include "lexer.h"
+#include "work.h"
 
-static unsigned int _var_id = 1;
+/* Every node kind must fit the compact layout */
+_Static_assert(sizeof(expr_t) <= 24, "expr_t outgrew its 24 byte budget");
+
+/* Every AST node is carved out of this region */
+static arena_t *_ast_arena = NULL;
 
 /**
- * @brief Get a fresh var id for alpha equivalence
- *
- * @return a new variable id
+ * @brief Allocate AST memory, creating the backing arena on first use
  */
-unsigned int new_var_id() {
-    return _var_id++;
+static void *_ast_alloc(size_t size) {
+    if (_ast_arena == NULL && (_ast_arena = arena_new(AST_ARENA_CHUNK)) == NULL)
+        return NULL;
+
+    return arena_alloc(_ast_arena, size);
 }
 
 /**
- * @brief Return a new variable struct
- *
- * @param id ID of the incoming variable
- * @param name Name of the incoming variable (will be copied)
- *
- * @return New variable struct
+ * @brief Hand a single AST allocation back for recycling
  */
-var_t *new_var(unsigned int id, const char *name) {
-    var_t *res;
-    if ((res = malloc(sizeof(var_t))) == NULL)
-        goto cleanup_default;
-
-    res->id = id;
-
-    size_t nlen;
-    MIN(nlen, strlen(name), MAX_VAR_LEN);
-    if ((res->name = malloc(nlen + 1)) == NULL)
-        goto cleanup_var;
-
-    strncpy(res->name, name, nlen);
-    res->name[nlen] = '\0';
-
-    return res;
-
-cleanup_var:
-    free(res);
-
-cleanup_default:
-    return NULL;
+static void _ast_release(void *elem, size_t size) {
+    arena_release(_ast_arena, elem, size);
 }
 
 /**
- * @brief Delete a var struct
+ * @brief Drop every AST node in O(#chunks), regardless of how many terms
+ *        are still referencing them. Any outstanding expr_t is invalidated
  */
-void free_var(var_t *var) {
-    if (var == NULL)
-        return;
-
-    if (var->name != NULL)
-        free(var->name);
+void ast_release_all() {
+    arena_reset(_ast_arena);
+}
 
-    free(var);
+/**
+ * @brief Report allocation counters of the AST arena
+ */
+void ast_stats(arena_stats_t *stats) {
+    arena_stats(_ast_arena, stats);
 }
 
 /**
- * @brief Return a new lamdba struct
+ * @brief Return a new variable node
  *
- * @param var Variable being bound inside this lambda
- * @param body Expression inside lambda body
+ * @param index de Bruijn index of the incoming variable
+ * @param sym Interned name of the incoming variable
  *
- * @return New lambda struct
+ * @return New variable node
  */
-lam_t *new_lam(var_t *var, expr_t *body) {
-    lam_t *res;
-    if ((res = malloc(sizeof(lam_t))) == NULL)
+expr_t *new_var(unsigned int index, sym_t sym) {
+    expr_t *res;
+    if ((res = _ast_alloc(sizeof(expr_t))) == NULL)
         return NULL;
 
-    res->var = var;
-    res->body = body;
+    res->type = VAR;
+    res->var.index = index;
+    res->var.sym = sym;
     return res;
 }
 
 /**
- * @brief Delete lam struct
+ * @brief Return a new lamdba node
+ *
+ * @param sym Interned name of the bound variable
+ * @param body Expression inside lambda body
+ *
+ * @return New lambda node
  */
-void free_lam(lam_t *lam) {
-    if (lam == NULL)
-        return;
-
-    if (lam->body != NULL)
-        free_expr(lam->body);
-
-    if (lam->var != NULL)
-        free_var(lam->var);
+expr_t *new_lam(sym_t sym, expr_t *body) {
+    expr_t *res;
+    if ((res = _ast_alloc(sizeof(expr_t))) == NULL)
+        return NULL;
 
-    free(lam);
+    res->type = LAMBDA;
+    res->lam.sym = sym;
+    res->lam.body = body;
+    return res;
 }
 
 /**
- * @brief Return a new function application struc
+ * @brief Return a new function application node
  *
  * @param f Function being acted on
  * @param x Function being applied
  *
- * @return New appl struc
+ * @return New appl node
  */
-appl_t *new_appl(expr_t *f, expr_t *x) {
-    appl_t *res;
-    if ((res = malloc(sizeof(appl_t))) == NULL)
+expr_t *new_appl(expr_t *f, expr_t *x) {
+    expr_t *res;
+    if ((res = _ast_alloc(sizeof(expr_t))) == NULL)
         return NULL;
 
-    res->f = f;
-    res->x = x;
+    res->type = APPL;
+    res->appl.f = f;
+    res->appl.x = x;
     return res;
 }
 
 /**
- * @brief Delete appl struc
+ * @brief Delete expr node & all of its children
  */
-void free_appl(appl_t *appl) {
-    if (appl == NULL)
-        return;
-
-    if (appl->f != NULL)
-        free_expr(appl->f);
-
-    if (appl->x != NULL)
-        free_expr(appl->x);
+void free_expr(expr_t *expr) {
+    work_t w;
+    work_init(&w);
+
+    expr_t *next;
+    while (expr != NULL) {
+        next = NULL;
+        switch (expr->type) {
+            case (VAR):
+                break;
+            case (LAMBDA):
+                next = expr->lam.body;
+                break;
+            case (APPL):
+                next = expr->appl.f;
+
+                /* Should the push fail the argument stays in the arena until
+                 * `ast_release_all` */
+                if (expr->appl.x != NULL)
+                    work_push(&w, expr->appl.x, NULL, 0, 0);
+                break;
+            default:
+                fprintf(stderr, "Corrupted expression node");
+                exit(1);
+        }
+
+        _ast_release(expr, sizeof(expr_t));
+        if (next == NULL && !work_empty(&w))
+            next = work_pop(&w).expr;
+
+        expr = next;
+    }
 
-    free(appl);
+    work_free(&w);
 }
 
+/* No further occurrence of a binder's variable */
+#define FMT_NONE (UINT_MAX)
+
 /**
- * @brief Return a new expression struct
+ * @brief What the pre-pass of `format_expr` learns about the node at one
+ *        position of the printing order
  *
- * @param type type of expression
- * @param data pointer to expression of type `type`
- *
- * @return New expr struc
+ *   LAMBDA  use = first occurrence of its variable, end = first position
+ *           past its body
+ *   VAR     use = next occurrence of the same binder's variable
  */
-expr_t *new_expr(expr_e type, void *data) {
-    expr_t *res;
-    if ((res = malloc(sizeof(expr_t))) == NULL)
-        return NULL;
+typedef struct _fmt_pos {
+    unsigned int use;
+    unsigned int end;
+} fmt_pos_t;
 
-    res->data = data;
-    res->type = type;
-    return res;
-}
+/**
+ * @brief Name a binder is printed with: its symbol, plus `_suffix` when that
+ *        is needed to keep an outer binder of the same name visible
+ */
+typedef struct _fmt_binder {
+    sym_t sym;
+    unsigned int suffix;
+
+    /* Level of the next binder out with the same symbol, 0 if none */
+    unsigned int shadowed;
+
+    /* Position of the lambda, & of the next occurrence of its variable
+     * that is still to be printed */
+    unsigned int at;
+    unsigned int use;
+} fmt_binder_t;
 
 /**
- * @brief Delete expr struct
+ * @brief Binders enclosing the term being formatted, outermost first, & the
+ *        positions the pre-pass numbered. Every table is kept from one term
+ *        to the next & only grows, so printing a trace allocates nothing
+ *        once the largest term has been seen
  */
-void free_expr(expr_t *expr) {
-    if (expr == NULL)
-        return;
+typedef struct _fmt_scope {
+    fmt_binder_t *binders;
+    unsigned int depth;
+    unsigned int cap;
 
-    switch (expr->type) {
-        case (VAR):
-            free_var((var_t *)expr->data);
-            break;
-        case (LAMBDA):
-            free_lam((lam_t *)expr->data);
-            break;
-        case (APPL):
-            free_appl((appl_t *)expr->data);
-            break;
-        default:
-            fprintf(stderr, "Corrupted expression node");
-            exit(1);
-    }
+    /* Level (1 + enclosing lambdas) of the innermost binder of each
+     * symbol, 0 if none. All 0 between terms */
+    unsigned int *levels;
+    unsigned int nsyms;
 
-    free(expr);
-}
+    fmt_pos_t *pos;
+    unsigned int pos_cap;
+
+    /* Empty between terms */
+    work_t work;
+} fmt_scope_t;
+
+static fmt_scope_t _fmt;
+static int _fmt_ready = 0;
+
+/* Buffer `format_ast` writes through */
+static sink_t _fmt_out;
 
-void _format_expr(expr_t *expr);
-    
 /**
- * @brief Format input variable 
+ * @brief Make room for one more binder
+ *
+ * @return 0 on success, ERR_MEM_ALLOC otherwise
  */
-void _format_var(var_t *var) {
-    printf("%s", var->name);
+static int _format_grow(fmt_scope_t *scope) {
+    if (scope->depth < scope->cap)
+        return 0;
+
+    unsigned int cap = scope->cap == 0 ? 0x40 : scope->cap * 2;
+    fmt_binder_t *binders;
+    if ((binders = realloc(scope->binders, cap * sizeof(fmt_binder_t)))
+            == NULL)
+        return ERR_MEM_ALLOC;
+
+    scope->binders = binders;
+    scope->cap = cap;
+    return 0;
 }
 
 /**
- * @brief Format input lambda 
+ * @brief Number the nodes of `expr` in printing order, chaining every
+ *        occurrence of a variable to the next one of the same binder.
+ *        While a lambda's body is scanned its `end` holds the last
+ *        occurrence found so far
+ *
+ * @return 0 on success, ERR_MEM_ALLOC otherwise
  */
-void _format_lam(lam_t *lam) {
-    printf("(\xCE\xBB");
-    _format_var(lam->var);
-    printf(". ");
-    _format_expr(lam->body);
-    printf(")");
+static int _format_scan(expr_t *expr, fmt_scope_t *scope) {
+    unsigned int n = 0, nsyms = 0, at, cap;
+    fmt_pos_t *pos = scope->pos, *grown;
+    work_t *w = &scope->work;
+
+    int res = work_push(w, expr, NULL, 0, 0);
+    while (res == 0 && !work_empty(w)) {
+        work_frame_t f = work_pop(w);
+        if (f.state == 1) {
+            pos[scope->binders[--scope->depth].at].end = n;
+            continue;
+        }
+
+        if (n == scope->pos_cap) {
+            cap = n == 0 ? 0x100 : n * 2;
+            if ((grown = realloc(pos, cap * sizeof(fmt_pos_t))) == NULL) {
+                res = ERR_MEM_ALLOC;
+                break;
+            }
+
+            scope->pos = pos = grown;
+            scope->pos_cap = cap;
+        }
+
+        pos[n].use = FMT_NONE;
+        pos[n].end = n + 1;
+        switch (f.expr->type) {
+            case (VAR):
+                if (f.expr->var.index >= scope->depth)
+                    break;
+
+                at = scope->binders[scope->depth - 1 -
+                    f.expr->var.index].at;
+                if (pos[at].end == FMT_NONE)
+                    pos[at].use = n;
+                else
+                    pos[pos[at].end].use = n;
+                pos[at].end = n;
+                break;
+            case (LAMBDA):
+                if ((res = _format_grow(scope)) < 0)
+                    break;
+
+                if (f.expr->lam.sym >= nsyms)
+                    nsyms = f.expr->lam.sym + 1;
+
+                pos[n].end = FMT_NONE;
+                scope->binders[scope->depth++].at = n;
+                if ((res = work_push(w, f.expr, NULL, 0, 1)) == 0)
+                    res = work_push(w, f.expr->lam.body, NULL, 0, 0);
+                break;
+            case (APPL):
+                if ((res = work_push(w, f.expr->appl.x, NULL, 0, 0)) == 0)
+                    res = work_push(w, f.expr->appl.f, NULL, 0, 0);
+                break;
+            default:
+                break;
+        }
+
+        n++;
+    }
+
+    w->len = 0;
+    scope->depth = 0;
+    if (res == 0 && nsyms > scope->nsyms) {
+        unsigned int *levels;
+        if ((levels = realloc(scope->levels, nsyms * sizeof(unsigned int)))
+                == NULL)
+            return ERR_MEM_ALLOC;
+
+        memset(levels + scope->nsyms, 0,
+                (nsyms - scope->nsyms) * sizeof(unsigned int));
+        scope->levels = levels;
+        scope->nsyms = nsyms;
+    }
+
+    return res;
 }
 
 /**
- * @brief Format input application
+ * @brief Bring a binder for the lambda at position `at` into scope, named
+ *        so that it doesn't capture any variable in its body. Names are
+ *        regenerated only when a binder shadows an outer binder of the same
+ *        name which the body still refers to, which is the case when that
+ *        binder's next occurrence to print lies before the body's end.
+ *        Only the innermost binder of a name can be referred to, so each
+ *        name tried costs a single check
+ *
+ * @return The new binder
  */
-void _format_appl(appl_t *appl) {
-    printf("(");
-    _format_expr(appl->f);
-    printf(" ");
-    _format_expr(appl->x);
-    printf(")");
-}
+static fmt_binder_t *_format_name(lam_t *lam, fmt_scope_t *scope,
+        unsigned int at) {
+    fmt_binder_t *out = &scope->binders[scope->depth], *b;
+    out->sym = lam->sym;
+    out->suffix = 0;
+    out->at = at;
+    out->use = scope->pos[at].use;
+
+    unsigned int level = scope->levels[lam->sym];
+    while (level > 0) {
+        b = &scope->binders[level - 1];
+        if (b->suffix != out->suffix) {
+            level = b->shadowed;
+        } else if (b->use < scope->pos[at].end) {
+            /* Start over, the new name may clash with a closer binder */
+            out->suffix++;
+            level = scope->levels[lam->sym];
+        } else {
+            break;
+        }
+    }
 
+    out->shadowed = scope->levels[lam->sym];
+    scope->levels[lam->sym] = ++scope->depth;
+    return out;
+}
 
 /**
- * @brief Format input expression 
+ * @brief Format the binder name chosen for a variable 
  */
-void _format_expr(expr_t *expr) {
-    switch (expr->type) {
-        case (VAR):
-            _format_var((var_t *)expr->data);
-            break;
-        case (LAMBDA):
-            _format_lam((lam_t *)expr->data);
-            break;
-        case (APPL):
-            _format_appl((appl_t *)expr->data);
-            break;
-        default:
-            printf("??? %d", expr->type);
+void _format_binder(sink_t *sink, fmt_binder_t *binder) {
+    if (binder == NULL) {
+        sink_puts(sink, "???");
+        return;
+    }
+
+    sink_puts(sink, sym_name(binder->sym));
+    if (binder->suffix > 0) {
+        sink_putc(sink, '_');
+        sink_putu(sink, binder->suffix);
     }
 }
 
 /**
- * @brief Format input AST
+ * @brief Format input variable at position `at`, moving its binder on to
+ *        the next occurrence
  */
-void format_ast(expr_t *expr) {
-    if (expr == NULL)
+void _format_var(sink_t *sink, var_t *var, fmt_scope_t *scope,
+        unsigned int at) {
+    if (var->index >= scope->depth) {
+        _format_binder(sink, NULL);
         return;
+    }
 
-    _format_expr(expr);
-    printf("\n");
+    fmt_binder_t *b = &scope->binders[scope->depth - 1 - var->index];
+    b->use = scope->pos[at].use;
+    _format_binder(sink, b);
 }
 
 /**
- * @brief Make a deep var copy
+ * @brief Format `expr` into `sink`. Each lambda & application is visited
+ *        again after every child, `state` counting how many are done. A
+ *        pre-pass first finds where each variable is used, for naming.
+ *        The formatter's tables are reused across calls, see `fmt_scope_t`
+ *
+ * @return 0 on success, ERR_* otherwise. The sink holds " ..." in place of
+ *         the rest of the term if the formatter itself ran out of memory
  */
-var_t *_deep_copy_var(var_t *var) {
-    return new_var(var->id, var->name);
+int format_expr(sink_t *sink, expr_t *expr) {
+    fmt_scope_t *scope = &_fmt;
+    fmt_binder_t *binder;
+    unsigned int at = 0;
+    if (!_fmt_ready) {
+        work_init(&scope->work);
+        _fmt_ready = 1;
+    }
+
+    work_t *w = &scope->work;
+    int res;
+    if ((res = _format_scan(expr, scope)) == 0)
+        res = work_push(w, expr, NULL, 0, 0);
+
+    while (res == 0 && !work_empty(w)) {
+        work_frame_t f = work_pop(w);
+        switch (f.expr->type) {
+            case (VAR):
+                _format_var(sink, &f.expr->var, scope, at++);
+                break;
+            case (LAMBDA):
+                if (f.state == 1) {
+                    binder = &scope->binders[--scope->depth];
+                    scope->levels[binder->sym] = binder->shadowed;
+                    sink_putc(sink, ')');
+                    break;
+                }
+
+                binder = _format_name(&f.expr->lam, scope, at++);
+                sink_puts(sink, "(\xCE\xBB");
+                _format_binder(sink, binder);
+                sink_puts(sink, ". ");
+                if ((res = work_push(w, f.expr, NULL, 0, 1)) == 0)
+                    res = work_push(w, f.expr->lam.body, NULL, 0, 0);
+                break;
+            case (APPL):
+                if (f.state == 2) {
+                    sink_putc(sink, ')');
+                    break;
+                }
+
+                if (f.state == 0)
+                    at++;
+
+                sink_putc(sink, f.state == 0 ? '(' : ' ');
+                if ((res = work_push(w, f.expr, NULL, 0, f.state + 1)) == 0)
+                    res = work_push(w, f.state == 0 ? f.expr->appl.f :
+                            f.expr->appl.x, NULL, 0, 0);
+                break;
+            default:
+                at++;
+                sink_puts(sink, "??? ");
+                sink_putu(sink, f.expr->type);
+        }
+    }
+
+    if (res < 0)
+        sink_puts(sink, " ...");
+
+    /* Leave the tables ready for the next term */
+    w->len = 0;
+    while (scope->depth > 0) {
+        binder = &scope->binders[--scope->depth];
+        scope->levels[binder->sym] = binder->shadowed;
+    }
+
+    return sink->err < 0 ? sink->err : res;
 }
 
 /**
- * @brief Make a deep lambda copy
+ * @brief Format input AST to stdout, in one write for all but huge terms.
+ *        The buffer is kept for the next term
  */
-lam_t *_deep_copy_lam(lam_t *lam) {
-    return new_lam(_deep_copy_var(lam->var), deep_copy_expr(lam->body));
+void format_ast(expr_t *expr) {
+    if (expr == NULL)
+        return;
+
+    if (_fmt_out.fp == NULL)
+        sink_init(&_fmt_out, stdout);
+
+    format_expr(&_fmt_out, expr);
+    sink_putc(&_fmt_out, '\n');
+
+    /* Errors stick, so start the next term over with a fresh sink */
+    if (sink_flush(&_fmt_out) < 0)
+        sink_free(&_fmt_out);
 }
 
 /**
- * @brief Make a deep appl copy 
+ * @brief Release the formatter's tables & buffer
  */
-appl_t *_deep_copy_appl(appl_t *appl) {
-    return new_appl(deep_copy_expr(appl->f), deep_copy_expr(appl->x));
+void format_free_all() {
+    if (_fmt_ready)
+        work_free(&_fmt.work);
+
+    free(_fmt.binders);
+    free(_fmt.levels);
+    free(_fmt.pos);
+    memset(&_fmt, 0, sizeof(fmt_scope_t));
+    _fmt_ready = 0;
+
+    sink_free(&_fmt_out);
 }
 
 /**
- * @brief Make a deep expression copy
+ * @brief Make a deep expression copy. Nodes are created top down, each
+ *        with its children left NULL until their copies fill them in
+ *
+ * @return The copy on success, NULL otherwise
  */
 expr_t *deep_copy_expr(expr_t *expr) {
-    void *data = NULL;
-    switch (expr->type) {
-        case (VAR):
-            data = _deep_copy_var((var_t *)expr->data);
-            break;
-        case (LAMBDA):
-            data = _deep_copy_lam((lam_t *)expr->data);
-            break;
-        case (APPL):
-            data = _deep_copy_appl((appl_t *)expr->data);
+    expr_t *res = NULL, *copy;
+    work_t w;
+    work_init(&w);
+    if (work_push(&w, expr, &res, 0, 0) < 0)
+        return NULL;
+
+    int err = 0;
+    while (!err && !work_empty(&w)) {
+        work_frame_t f = work_pop(&w);
+        switch (f.expr->type) {
+            case (VAR):
+                copy = new_var(f.expr->var.index, f.expr->var.sym);
+                break;
+            case (LAMBDA):
+                copy = new_lam(f.expr->lam.sym, NULL);
+                break;
+            case (APPL):
+                copy = new_appl(NULL, NULL);
+                break;
+            default:
+                copy = NULL;
+        }
+
+        if (copy == NULL) {
+            err = 1;
             break;
-        default:
-            return NULL;
+        }
+
+        *f.slot = copy;
+        if (copy->type == LAMBDA) {
+            err = work_push(&w, f.expr->lam.body, &copy->lam.body, 0, 0) < 0;
+        } else if (copy->type == APPL) {
+            err = work_push(&w, f.expr->appl.x, &copy->appl.x, 0, 0) < 0 ||
+                work_push(&w, f.expr->appl.f, &copy->appl.f, 0, 0) < 0;
+        }
+    }
+
+    work_free(&w);
+    if (err) {
+        free_expr(res);
+        return NULL;
     }
-    return new_expr(expr->type, data);
+
+    return res;
 }
@@ -9,16 +9,25 @@
 #ifndef _AST_H_
 #define _AST_H_
 
+#include <lib/arena.h>
+#include <lib/sink.h>
+
+#include "symbol.h"
+
+/* AST nodes are small, so grab them from the arena in large batches */
+#define AST_ARENA_CHUNK (0x40000)
+
 /**
- * @brief Var data format - comparison is done by `id` field rather than
- *        `name` for variable name shadowing
+ * @brief Var data format - variables refer to their binder by de Bruijn
+ *        index, so names play no part in evaluation & shadowing or
+ *        duplicating binders can't capture anything
  */
 typedef struct _var {
-    /* Identifier for variable with this `name` & context */
-    unsigned int id; 
+    /* Number of lambdas between this variable & the one binding it */
+    unsigned int index; 
 
-    /* For printing purposes */
-    char *name;
+    /* Interned name as written, for printing purposes */
+    sym_t sym;
 } var_t;
 
 typedef enum _expr_e {
@@ -27,48 +36,53 @@ typedef enum _expr_e {
     APPL
 } expr_e;
 
-/**
- * @brief Expression AST node, can be VAR, LAMBDA, or APPL - designated by
- *        `type` field.
- */
-typedef struct _expr {
-    /* See `_expr_e` enum */
-    expr_e type; 
-    
-    /* To be cast based on `type` field */
-    void *data; 
-} expr_t;
+struct _expr;
 
 /**
  * @brief Data representation of a lambda AST node 
  */
 typedef struct _lam {
-    /* Free variable bound by this lambda */
-    var_t *var;
+    /* Name of the variable bound by this lambda, for printing purposes */
+    sym_t sym;
 
     /* Function body */
-    expr_t *body;      
+    struct _expr *body;      
 } lam_t;
 
 /**
  * @brief Data represntation for function application, or f x
  */
 typedef struct _appl {
-    expr_t *f;
-    expr_t *x;
+    struct _expr *f;
+    struct _expr *x;
 } appl_t;
 
-unsigned int new_var_id();
+/**
+ * @brief Expression AST node, can be VAR, LAMBDA, or APPL - designated by
+ *        `type` field. The payload is stored inline so every node is a
+ *        single fixed-size allocation
+ */
+typedef struct _expr {
+    /* See `_expr_e` enum */
+    expr_e type; 
+    
+    /* To be read based on `type` field */
+    union {
+        var_t var;
+        lam_t lam;
+        appl_t appl;
+    };
+} expr_t;
 
-var_t *new_var(unsigned int id, const char *name);
-expr_t *new_expr(expr_e type, void *data);
-lam_t *new_lam(var_t *var, expr_t *body);
-appl_t *new_appl(expr_t *f, expr_t *x);
+expr_t *new_var(unsigned int index, sym_t sym);
+expr_t *new_lam(sym_t sym, expr_t *body);
+expr_t *new_appl(expr_t *f, expr_t *x);
 expr_t *deep_copy_expr(expr_t *e);
-void free_var(var_t *var);
 void free_expr(expr_t *expr);
-void free_lam(lam_t *lam);
-void free_appl(appl_t *appl);
+int format_expr(sink_t *sink, expr_t *expr);
 void format_ast(expr_t *expr);
+void format_free_all();
+void ast_release_all();
+void ast_stats(arena_stats_t *stats);
 
 #endif /* _AST_H_ */
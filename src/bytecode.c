@@ -0,0 +1,471 @@
+/**
+ * @file bytecode.c
+ *
+ * @brief Bytecode compiler & file format implementation
+ *
+ * @author Lars Wander
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* fstat & fileno are POSIX, not C11 */
+#define _DEFAULT_SOURCE
+#define BC_FSTAT
+#endif
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef BC_FSTAT
+#include <sys/stat.h>
+#endif
+
+#include <err.h>
+
+#include "lexer.h"
+#include "bytecode.h"
+#include "work.h"
+
+/* Operand words following each opcode, indexed by `_bc_op_e` */
+static const unsigned int _operands[BC_OP_COUNT] = { 1, 2, 0, 0, 0, 0 };
+
+/**
+ * @brief Lambda whose body is still to be compiled
+ */
+typedef struct _pending {
+    expr_t *lam;
+
+    /* Word of the BC_CLOSURE operand receiving the body's offset */
+    unsigned int patch;
+} pending_t;
+
+typedef struct _compile {
+    bc_t *bc;
+    pending_t *pending;
+    unsigned int pending_len;
+    unsigned int pending_cap;
+} compile_t;
+
+static int _emit(bc_t *bc, unsigned int word) {
+    if (bc->len == bc->cap) {
+        unsigned int cap = bc->cap == 0 ? 0x100 : bc->cap * 2;
+        unsigned int *code;
+        if ((code = realloc(bc->code, cap * sizeof(unsigned int))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        bc->code = code;
+        bc->cap = cap;
+    }
+
+    bc->code[bc->len++] = word;
+    return 0;
+}
+
+static int _defer(compile_t *c, expr_t *lam, unsigned int patch) {
+    if (c->pending_len == c->pending_cap) {
+        unsigned int cap = c->pending_cap == 0 ? 0x40 : c->pending_cap * 2;
+        pending_t *pending;
+        if ((pending = realloc(c->pending, cap * sizeof(pending_t))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        c->pending = pending;
+        c->pending_cap = cap;
+    }
+
+    c->pending[c->pending_len].lam = lam;
+    c->pending[c->pending_len].patch = patch;
+    c->pending_len++;
+    return 0;
+}
+
+/**
+ * @brief Compile `expr`, leaving its value on the stack, or returning it if
+ *        `tail` is set. An application's argument & function are compiled
+ *        from a work stack before the application itself is emitted
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _compile(compile_t *c, expr_t *expr, int tail) {
+    work_t w;
+    work_init(&w);
+
+    int res = 0;
+    for (;;) {
+        switch (expr->type) {
+            case (VAR):
+                if ((res = _emit(c->bc, BC_ACCESS)) < 0 ||
+                        (res = _emit(c->bc, expr->var.index)) < 0)
+                    goto cleanup;
+
+                break;
+            case (LAMBDA):
+                if ((res = _emit(c->bc, BC_CLOSURE)) < 0 ||
+                        (res = _defer(c, expr, c->bc->len)) < 0 ||
+                        (res = _emit(c->bc, 0)) < 0 ||
+                        (res = _emit(c->bc, expr->lam.sym)) < 0)
+                    goto cleanup;
+
+                break;
+            case (APPL):
+                /* The argument is evaluated first & sits below the
+                 * function */
+                if ((res = work_push(&w, NULL, NULL, 0,
+                                tail ? BC_TAILAPPLY : BC_APPLY)) < 0 ||
+                        (res = work_push(&w, expr->appl.f, NULL, 0,
+                            BC_OP_COUNT)) < 0)
+                    goto cleanup;
+
+                expr = expr->appl.x;
+                tail = 0;
+                continue;
+            default:
+                res = ERR_CORRUPT;
+                goto cleanup;
+        }
+
+        if (tail && (res = _emit(c->bc, BC_RETURN)) < 0)
+            goto cleanup;
+
+        /* Emit the applications whose operands are done, then move on to
+         * the next function still to be compiled, marked BC_OP_COUNT */
+        for (;;) {
+            if (work_empty(&w))
+                goto cleanup;
+
+            work_frame_t frame = work_pop(&w);
+            if (frame.state == BC_OP_COUNT) {
+                expr = frame.expr;
+                tail = 0;
+                break;
+            }
+
+            if ((res = _emit(c->bc, frame.state)) < 0)
+                goto cleanup;
+        }
+    }
+
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Compile a closed term, which starts at offset 0 of the result
+ *
+ * @param expr Term being compiled, left untouched
+ * @param out Freshly allocated program on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int bc_compile(expr_t *expr, bc_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    compile_t c = { 0 };
+    if ((c.bc = calloc(1, sizeof(bc_t))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    int res;
+    if ((res = _compile(&c, expr, 0)) < 0 ||
+            (res = _emit(c.bc, BC_HALT)) < 0)
+        goto cleanup;
+
+    /* Bodies may defer further lambdas, which are appended as we go */
+    for (unsigned int i = 0; i < c.pending_len; i++) {
+        c.bc->code[c.pending[i].patch] = c.bc->len;
+        if ((res = _compile(&c, c.pending[i].lam->lam.body, 1)) < 0)
+            goto cleanup;
+    }
+
+    free(c.pending);
+    *out = c.bc;
+    return 0;
+
+cleanup:
+    free(c.pending);
+    bc_free(c.bc);
+    return res;
+}
+
+static inline int _write_word(FILE *fp, unsigned int word) {
+    return fwrite(&word, sizeof(word), 1, fp) == 1 ? 0 : ERR_FILE_ACTION;
+}
+
+static inline int _read_word(FILE *fp, unsigned int *word) {
+    return fread(word, sizeof(*word), 1, fp) == 1 ? 0 : ERR_CORRUPT;
+}
+
+/**
+ * @brief Write `bc` & the names of every interned symbol to `fp`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int bc_write(bc_t *bc, FILE *fp) {
+    if (bc == NULL || fp == NULL)
+        return ERR_INP;
+
+    int res;
+    unsigned int nsyms = sym_count();
+    if (fwrite(BC_MAGIC, 4, 1, fp) != 1)
+        return ERR_FILE_ACTION;
+
+    if ((res = _write_word(fp, BC_VERSION)) < 0 ||
+            (res = _write_word(fp, nsyms)) < 0)
+        return res;
+
+    for (unsigned int i = 0; i < nsyms; i++) {
+        const char *name = sym_name(i);
+        unsigned int len = strlen(name);
+        if ((res = _write_word(fp, len)) < 0)
+            return res;
+
+        if (len > 0 && fwrite(name, len, 1, fp) != 1)
+            return ERR_FILE_ACTION;
+    }
+
+    if ((res = _write_word(fp, bc->len)) < 0)
+        return res;
+
+    if (bc->len > 0 && fwrite(bc->code, sizeof(unsigned int), bc->len, fp)
+            != bc->len)
+        return ERR_FILE_ACTION;
+
+    return 0;
+}
+
+/**
+ * @brief Check for the bytecode magic, leaving `fp` at its start
+ *
+ * @return 1 if `fp` holds bytecode, 0 otherwise
+ */
+int bc_is_bytecode(FILE *fp) {
+    /* A pipe can only be relied on to take back a single byte. No source
+     * file starts with the magic's first byte, as a lone variable is never
+     * bound, so anything else gets past untouched */
+    int ch;
+    if ((ch = fgetc(fp)) != BC_MAGIC[0]) {
+        if (ch != EOF)
+            ungetc(ch, fp);
+        return 0;
+    }
+
+    char magic[3];
+    int res = fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, BC_MAGIC + 1, sizeof(magic)) == 0;
+
+    rewind(fp);
+    return res;
+}
+
+/**
+ * @brief Check every instruction is whole & every operand in range, mapping
+ *        the file's symbols onto the ones interned in this process. Code is
+ *        followed from offset 0 & from every closure body, so that each
+ *        variable access is checked against the binders around it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _validate(bc_t *bc, sym_t *syms, unsigned int nsyms) {
+    unsigned int pc, op;
+    int res = ERR_CORRUPT;
+
+    /* Per word: 0 inside an instruction, 1 at one not yet followed, 2 +
+     * the binders around it once followed */
+    unsigned int *depth;
+    if (bc->len == 0 || (depth = calloc(bc->len, sizeof(unsigned int)))
+            == NULL)
+        return bc->len == 0 ? ERR_CORRUPT : ERR_MEM_ALLOC;
+
+    work_t w;
+    work_init(&w);
+
+    for (pc = 0; pc < bc->len; pc += 1 + _operands[op]) {
+        if ((op = bc->code[pc]) >= BC_OP_COUNT ||
+                pc + _operands[op] >= bc->len)
+            goto cleanup;
+
+        depth[pc] = 1;
+    }
+
+    /* Execution must not run off the end */
+    if (op != BC_HALT && op != BC_RETURN && op != BC_TAILAPPLY)
+        goto cleanup;
+
+    /* Closure bodies must begin on an instruction */
+    for (pc = 0; pc < bc->len; pc += 1 + _operands[op]) {
+        if ((op = bc->code[pc]) != BC_CLOSURE)
+            continue;
+
+        if (bc->code[pc + 1] >= bc->len || depth[bc->code[pc + 1]] == 0 ||
+                bc->code[pc + 2] >= nsyms)
+            goto cleanup;
+
+        bc->code[pc + 2] = syms[bc->code[pc + 2]];
+    }
+
+    /* The program runs without binders, a closure's body under one more
+     * than the closure was made under */
+    if (work_push(&w, NULL, NULL, 0, 0) < 0)
+        goto oom;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        for (pc = frame.state; ; pc += 1 + _operands[op]) {
+            if (depth[pc] != 1) {
+                /* Fell through into code that was already followed */
+                if (depth[pc] != frame.depth + 2)
+                    goto cleanup;
+                break;
+            }
+
+            depth[pc] = frame.depth + 2;
+            if ((op = bc->code[pc]) == BC_ACCESS &&
+                    bc->code[pc + 1] >= frame.depth)
+                goto cleanup;
+
+            if (op == BC_CLOSURE) {
+                unsigned int body = bc->code[pc + 1];
+                if (depth[body] == 1) {
+                    if (work_push(&w, NULL, NULL, frame.depth + 1, body) < 0)
+                        goto oom;
+                } else if (depth[body] != frame.depth + 3) {
+                    goto cleanup;
+                }
+            }
+
+            if (op == BC_HALT || op == BC_RETURN || op == BC_TAILAPPLY)
+                break;
+        }
+    }
+
+    res = 0;
+    goto cleanup;
+
+oom:
+    res = ERR_MEM_ALLOC;
+cleanup:
+    work_free(&w);
+    free(depth);
+    return res;
+}
+
+/**
+ * @brief Bytes left in `fp`, or ULLONG_MAX when that can't be told, as with
+ *        pipes
+ */
+static unsigned long long _remaining(FILE *fp) {
+#ifdef BC_FSTAT
+    struct stat st;
+    long pos;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) &&
+            (pos = ftell(fp)) >= 0 && pos <= st.st_size)
+        return st.st_size - pos;
+#endif
+    return ULLONG_MAX;
+}
+
+/**
+ * @brief Bytes taken by `count` + 1 elements of `size` bytes, so that an
+ *        empty array is still allocated
+ *
+ * @return The size, 0 if it doesn't fit in a size_t
+ */
+static size_t _array_size(unsigned int count, size_t size) {
+    if (count >= SIZE_MAX / size)
+        return 0;
+
+    return ((size_t)count + 1) * size;
+}
+
+/**
+ * @brief Load a program written by `bc_write`
+ *
+ * @param fp Positioned at the magic
+ * @param out Freshly allocated program on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int bc_read(FILE *fp, bc_t **out) {
+    if (fp == NULL || out == NULL)
+        return ERR_INP;
+
+    char magic[4];
+    unsigned int version, nsyms, len;
+    int res;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 ||
+            memcmp(magic, BC_MAGIC, sizeof(magic)) != 0)
+        return ERR_CORRUPT;
+
+    if ((res = _read_word(fp, &version)) < 0 ||
+            (res = _read_word(fp, &nsyms)) < 0)
+        return res;
+
+    /* Every symbol takes at least its length word */
+    size_t size;
+    if (version != BC_VERSION ||
+            nsyms > _remaining(fp) / sizeof(unsigned int) ||
+            (size = _array_size(nsyms, sizeof(sym_t))) == 0)
+        return ERR_CORRUPT;
+
+    sym_t *syms;
+    if ((syms = malloc(size)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    char name[MAX_VAR_LEN + 1];
+    for (unsigned int i = 0; i < nsyms; i++) {
+        if ((res = _read_word(fp, &len)) < 0)
+            goto cleanup_syms;
+
+        if (len > MAX_VAR_LEN || (len > 0 && fread(name, len, 1, fp) != 1)) {
+            res = ERR_CORRUPT;
+            goto cleanup_syms;
+        }
+
+        name[len] = '\0';
+        if ((res = sym_intern(name, &syms[i])) < 0)
+            goto cleanup_syms;
+    }
+
+    bc_t *bc;
+    if ((res = _read_word(fp, &len)) < 0)
+        goto cleanup_syms;
+
+    if (len > _remaining(fp) / sizeof(unsigned int) ||
+            (size = _array_size(len, sizeof(unsigned int))) == 0) {
+        res = ERR_CORRUPT;
+        goto cleanup_syms;
+    }
+
+    if ((bc = calloc(1, sizeof(bc_t))) == NULL ||
+            (bc->code = malloc(size)) == NULL) {
+        free(bc);
+        res = ERR_MEM_ALLOC;
+        goto cleanup_syms;
+    }
+
+    bc->len = bc->cap = len;
+    if (len > 0 && fread(bc->code, sizeof(unsigned int), len, fp) != len)
+        res = ERR_CORRUPT;
+    else
+        res = _validate(bc, syms, nsyms);
+
+    if (res < 0) {
+        bc_free(bc);
+        goto cleanup_syms;
+    }
+
+    *out = bc;
+
+cleanup_syms:
+    free(syms);
+    return res;
+}
+
+void bc_free(bc_t *bc) {
+    if (bc == NULL)
+        return;
+
+    free(bc->code);
+    free(bc);
+}
@@ -0,0 +1,69 @@
+/**
+ * @file bytecode.h
+ *
+ * @brief Bytecode compiler & file format
+ *
+ * A program is a flat array of 32 bit words: an opcode followed by its
+ * operands. Lambda bodies are compiled out of line after the main code &
+ * referred to by their offset, variables are de Bruijn indices into the
+ * environment. Applications in tail position become `BC_TAILAPPLY`, which
+ * reuses the caller's frame.
+ *
+ * Compiled programs can be written to a file & loaded back, skipping the
+ * lexer & parser. The file is the magic "LCBC", a version word, the symbol
+ * table (length prefixed names) & the code, all words in host byte order.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _BYTECODE_H_
+#define _BYTECODE_H_
+
+#include <stdio.h>
+
+#include "ast.h"
+
+#define BC_MAGIC "LCBC"
+#define BC_VERSION (1)
+
+/**
+ * @brief Opcodes, operands follow the opcode word
+ */
+typedef enum _bc_op_e {
+    /* (index) push the environment entry `index` links in */
+    BC_ACCESS,
+
+    /* (body, sym) push a closure of `body` over the current environment */
+    BC_CLOSURE,
+
+    /* pop a function & then its argument, call the function */
+    BC_APPLY,
+
+    /* as BC_APPLY, but the callee returns straight to our caller */
+    BC_TAILAPPLY,
+
+    /* pop the result & resume the caller */
+    BC_RETURN,
+
+    /* pop the program's result & stop */
+    BC_HALT,
+
+    BC_OP_COUNT
+} bc_op_e;
+
+/**
+ * @brief A compiled program
+ */
+typedef struct _bc {
+    unsigned int *code;
+    unsigned int len;
+    unsigned int cap;
+} bc_t;
+
+int bc_compile(expr_t *expr, bc_t **out);
+int bc_write(bc_t *bc, FILE *fp);
+int bc_is_bytecode(FILE *fp);
+int bc_read(FILE *fp, bc_t **out);
+void bc_free(bc_t *bc);
+
+#endif /* _BYTECODE_H_ */
@@ -0,0 +1,699 @@
+/**
+ * @file cgen.c
+ *
+ * @brief Ahead-of-time C backend implementation
+ *
+ * Lambda `n` of the closure conversion becomes the C function `lam_n`.
+ * Its argument & flat environment are the function's parameters, & a
+ * closure's environment is filled in from the enclosing function's own when
+ * the closure is built. Evaluation is call-by-value, like the bytecode VM.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <err.h>
+
+#include "closure.h"
+#include "cgen.h"
+#include "work.h"
+
+/* Runtime emitted ahead of the generated functions */
+static const char *_runtime[] = {
+    "#include <stdarg.h>\n",
+    "#include <stdio.h>\n",
+    "#include <stdlib.h>\n",
+    "#include <string.h>\n",
+    "\n",
+    "typedef struct _val val_t;\n",
+    "typedef val_t *(*code_t)(val_t **env, val_t *arg);\n",
+    "\n",
+    "/* A closure when `code` is set, otherwise a neutral: the variable\n",
+    " * bound `level` lambdas deep when `head` is NULL, else `head`\n",
+    " * applied to `arg` */\n",
+    "struct _val {\n",
+    "    code_t code;\n",
+    "    unsigned int sym;\n",
+    "    unsigned int level;\n",
+    "    val_t *head;\n",
+    "    val_t *arg;\n",
+    "    val_t *env[];\n",
+    "};\n",
+    "\n",
+    "/* Normal form being printed: 0 variable, 1 lambda, 2 application */\n",
+    "typedef struct _term {\n",
+    "    int kind;\n",
+    "    unsigned int index;\n",
+    "    unsigned int sym;\n",
+    "    struct _term *a;\n",
+    "    struct _term *b;\n",
+    "} term_t;\n",
+    "\n",
+    "#define RT_CHUNK (1 << 20)\n",
+    "\n",
+    "static char *rt_heap = NULL;\n",
+    "static size_t rt_left = 0;\n",
+    "\n",
+    "/* Nothing is freed, the program exits once the result is printed */\n",
+    "static void *rt_alloc(size_t size) {\n",
+    "    void *res;\n",
+    "    size = (size + 7) & ~(size_t)7;\n",
+    "    if (size > rt_left) {\n",
+    "        rt_left = size > RT_CHUNK ? size : RT_CHUNK;\n",
+    "        if ((rt_heap = malloc(rt_left)) == NULL) {\n",
+    "            fputs(\"out of memory\\n\", stderr);\n",
+    "            exit(1);\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    res = rt_heap;\n",
+    "    rt_heap += size;\n",
+    "    rt_left -= size;\n",
+    "    return res;\n",
+    "}\n",
+    "\n",
+    "static val_t *rt_clos(code_t code, unsigned int sym, unsigned int n,\n",
+    "        ...) {\n",
+    "    val_t *res = rt_alloc(sizeof(val_t) + n * sizeof(val_t *));\n",
+    "    va_list ap;\n",
+    "    unsigned int i;\n",
+    "    res->code = code;\n",
+    "    res->sym = sym;\n",
+    "    va_start(ap, n);\n",
+    "    for (i = 0; i < n; i++)\n",
+    "        res->env[i] = va_arg(ap, val_t *);\n",
+    "\n",
+    "    va_end(ap);\n",
+    "    return res;\n",
+    "}\n",
+    "\n",
+    "static val_t *rt_neutral(unsigned int level, val_t *head, val_t *arg) {\n",
+    "    val_t *res = rt_alloc(sizeof(val_t));\n",
+    "    res->code = NULL;\n",
+    "    res->level = level;\n",
+    "    res->head = head;\n",
+    "    res->arg = arg;\n",
+    "    return res;\n",
+    "}\n",
+    "\n",
+    "static inline val_t *rt_apply(val_t *f, val_t *x) {\n",
+    "    if (f->code != NULL)\n",
+    "        return f->code(f->env, x);\n",
+    "\n",
+    "    return rt_neutral(0, f, x);\n",
+    "}\n",
+    "\n",
+    "static term_t *rt_term(int kind, unsigned int index, unsigned int sym,\n",
+    "        term_t *a, term_t *b) {\n",
+    "    term_t *res = rt_alloc(sizeof(term_t));\n",
+    "    res->kind = kind;\n",
+    "    res->index = index;\n",
+    "    res->sym = sym;\n",
+    "    res->a = a;\n",
+    "    res->b = b;\n",
+    "    return res;\n",
+    "}\n",
+    "\n",
+    "/* Pending work of the walks below, which must not recurse since a\n",
+    " * normal form can nest far deeper than the C stack allows */\n",
+    "typedef struct _frame {\n",
+    "    void *node;\n",
+    "    term_t **slot;\n",
+    "    unsigned int depth;\n",
+    "    unsigned int state;\n",
+    "} frame_t;\n",
+    "\n",
+    "static frame_t *rt_work = NULL;\n",
+    "static size_t rt_len = 0;\n",
+    "static size_t rt_cap = 0;\n",
+    "\n",
+    "/* Double a growable array of `size` byte elements */\n",
+    "static void *rt_grow(void *buf, size_t *cap, size_t size) {\n",
+    "    *cap = *cap == 0 ? 0x100 : *cap * 2;\n",
+    "    if ((buf = realloc(buf, *cap * size)) == NULL) {\n",
+    "        fputs(\"out of memory\\n\", stderr);\n",
+    "        exit(1);\n",
+    "    }\n",
+    "\n",
+    "    return buf;\n",
+    "}\n",
+    "\n",
+    "static void rt_push(void *node, term_t **slot, unsigned int depth,\n",
+    "        unsigned int state) {\n",
+    "    frame_t *f;\n",
+    "    if (rt_len == rt_cap)\n",
+    "        rt_work = rt_grow(rt_work, &rt_cap, sizeof(frame_t));\n",
+    "\n",
+    "    f = &rt_work[rt_len++];\n",
+    "    f->node = node;\n",
+    "    f->slot = slot;\n",
+    "    f->depth = depth;\n",
+    "    f->state = state;\n",
+    "}\n",
+    "\n",
+    "/* Read back a value, each term filled into the slot its parent left */\n",
+    "static term_t *rt_quote(val_t *v) {\n",
+    "    term_t *res = NULL;\n",
+    "    val_t *body;\n",
+    "    frame_t f;\n",
+    "    rt_push(v, &res, 0, 0);\n",
+    "    while (rt_len > 0) {\n",
+    "        f = rt_work[--rt_len];\n",
+    "        v = f.node;\n",
+    "        if (v->code != NULL) {\n",
+    "            body = v->code(v->env, rt_neutral(f.depth, NULL, NULL));\n",
+    "            *f.slot = rt_term(1, 0, v->sym, NULL, NULL);\n",
+    "            rt_push(body, &(*f.slot)->a, f.depth + 1, 0);\n",
+    "        } else if (v->head == NULL) {\n",
+    "            *f.slot = rt_term(0, f.depth - 1 - v->level, 0, NULL, NULL);\n",
+    "        } else {\n",
+    "            *f.slot = rt_term(2, 0, 0, NULL, NULL);\n",
+    "            rt_push(v->arg, &(*f.slot)->b, f.depth, 0);\n",
+    "            rt_push(v->head, &(*f.slot)->a, f.depth, 0);\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    return res;\n",
+    "}\n",
+    "\n",
+    "/* The printed normal form is collected here & written at once */\n",
+    "static char *rt_out = NULL;\n",
+    "static size_t rt_out_len = 0;\n",
+    "static size_t rt_out_cap = 0;\n",
+    "\n",
+    "static void rt_puts(const char *str) {\n",
+    "    size_t len = strlen(str);\n",
+    "    while (rt_out_len + len > rt_out_cap)\n",
+    "        rt_out = rt_grow(rt_out, &rt_out_cap, 1);\n",
+    "\n",
+    "    memcpy(rt_out + rt_out_len, str, len);\n",
+    "    rt_out_len += len;\n",
+    "}\n",
+    "\n",
+    "#define RT_NONE ((unsigned int)-1)\n",
+    "\n",
+    "/* What `rt_scan` learns about the node at one position of the printing\n",
+    " * order. A lambda's first use & the end of its body, a variable's next\n",
+    " * use of the same binder */\n",
+    "typedef struct _pos {\n",
+    "    unsigned int use;\n",
+    "    unsigned int end;\n",
+    "} pos_t;\n",
+    "\n",
+    "/* Binder in scope while printing, `shadowed` being the level of the\n",
+    " * next one out with the same symbol */\n",
+    "typedef struct _binder {\n",
+    "    unsigned int sym;\n",
+    "    unsigned int suffix;\n",
+    "    unsigned int shadowed;\n",
+    "    unsigned int at;\n",
+    "    unsigned int use;\n",
+    "} binder_t;\n",
+    "\n",
+    "static pos_t *rt_pos = NULL;\n",
+    "static size_t rt_pos_cap = 0;\n",
+    "static binder_t *rt_binders = NULL;\n",
+    "static size_t rt_binders_cap = 0;\n",
+    "\n",
+    "/* Number the nodes in printing order, chaining each use of a variable to\n",
+    " * the next use of the same binder. While a body is scanned, its lambda's\n",
+    " * `end` holds the last use found so far */\n",
+    "static void rt_scan(term_t *t) {\n",
+    "    unsigned int n = 0, depth = 0, at;\n",
+    "    frame_t f;\n",
+    "    rt_push(t, NULL, 0, 0);\n",
+    "    while (rt_len > 0) {\n",
+    "        f = rt_work[--rt_len];\n",
+    "        t = f.node;\n",
+    "        if (f.state == 1) {\n",
+    "            rt_pos[rt_binders[--depth].at].end = n;\n",
+    "            continue;\n",
+    "        }\n",
+    "\n",
+    "        if (n == rt_pos_cap)\n",
+    "            rt_pos = rt_grow(rt_pos, &rt_pos_cap, sizeof(pos_t));\n",
+    "\n",
+    "        rt_pos[n].use = RT_NONE;\n",
+    "        rt_pos[n].end = n + 1;\n",
+    "        switch (t->kind) {\n",
+    "            case 0:\n",
+    "                if (t->index >= depth)\n",
+    "                    break;\n",
+    "\n",
+    "                at = rt_binders[depth - 1 - t->index].at;\n",
+    "                if (rt_pos[at].end == RT_NONE)\n",
+    "                    rt_pos[at].use = n;\n",
+    "                else\n",
+    "                    rt_pos[rt_pos[at].end].use = n;\n",
+    "                rt_pos[at].end = n;\n",
+    "                break;\n",
+    "            case 1:\n",
+    "                if (depth == rt_binders_cap)\n",
+    "                    rt_binders = rt_grow(rt_binders, &rt_binders_cap,\n",
+    "                            sizeof(binder_t));\n",
+    "\n",
+    "                rt_pos[n].end = RT_NONE;\n",
+    "                rt_binders[depth++].at = n;\n",
+    "                rt_push(t, NULL, 0, 1);\n",
+    "                rt_push(t->a, NULL, 0, 0);\n",
+    "                break;\n",
+    "            default:\n",
+    "                rt_push(t->b, NULL, 0, 0);\n",
+    "                rt_push(t->a, NULL, 0, 0);\n",
+    "        }\n",
+    "\n",
+    "        n++;\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "static void rt_binder(binder_t *b) {\n",
+    "    char num[16];\n",
+    "    if (b == NULL) {\n",
+    "        rt_puts(\"???\");\n",
+    "        return;\n",
+    "    }\n",
+    "\n",
+    "    rt_puts(rt_names[b->sym]);\n",
+    "    if (b->suffix > 0) {\n",
+    "        sprintf(num, \"_%u\", b->suffix);\n",
+    "        rt_puts(num);\n",
+    "    }\n",
+    "}\n",
+    "\n",
+    "/* Same naming as lcc: a binder is renamed only when it would hide an\n",
+    " * outer binder of the same name that its body still uses, which is when\n",
+    " * that binder's next use comes before the body ends */\n",
+    "static void rt_print(term_t *t) {\n",
+    "    unsigned int at = 0, depth = 0, level;\n",
+    "    unsigned int *levels;\n",
+    "    binder_t *b;\n",
+    "    frame_t f;\n",
+    "    if ((levels = calloc(sizeof(rt_names) / sizeof(rt_names[0]),\n",
+    "                    sizeof(unsigned int))) == NULL) {\n",
+    "        fputs(\"out of memory\\n\", stderr);\n",
+    "        exit(1);\n",
+    "    }\n",
+    "\n",
+    "    rt_scan(t);\n",
+    "    rt_push(t, NULL, 0, 0);\n",
+    "    while (rt_len > 0) {\n",
+    "        f = rt_work[--rt_len];\n",
+    "        t = f.node;\n",
+    "        switch (t->kind) {\n",
+    "            case 0:\n",
+    "                if (t->index >= depth) {\n",
+    "                    rt_binder(NULL);\n",
+    "                } else {\n",
+    "                    b = &rt_binders[depth - 1 - t->index];\n",
+    "                    b->use = rt_pos[at].use;\n",
+    "                    rt_binder(b);\n",
+    "                }\n",
+    "\n",
+    "                at++;\n",
+    "                break;\n",
+    "            case 1:\n",
+    "                if (f.state == 1) {\n",
+    "                    b = &rt_binders[--depth];\n",
+    "                    levels[b->sym] = b->shadowed;\n",
+    "                    rt_puts(\")\");\n",
+    "                    break;\n",
+    "                }\n",
+    "\n",
+    "                b = &rt_binders[depth];\n",
+    "                b->sym = t->sym;\n",
+    "                b->suffix = 0;\n",
+    "                b->at = at;\n",
+    "                b->use = rt_pos[at].use;\n",
+    "                level = levels[t->sym];\n",
+    "                while (level > 0) {\n",
+    "                    if (rt_binders[level - 1].suffix != b->suffix) {\n",
+    "                        level = rt_binders[level - 1].shadowed;\n",
+    "                    } else if (rt_binders[level - 1].use < rt_pos[at].end) {\n",
+    "                        b->suffix++;\n",
+    "                        level = levels[t->sym];\n",
+    "                    } else {\n",
+    "                        break;\n",
+    "                    }\n",
+    "                }\n",
+    "\n",
+    "                b->shadowed = levels[t->sym];\n",
+    "                levels[t->sym] = ++depth;\n",
+    "                at++;\n",
+    "                rt_puts(\"(\\xCE\\xBB\");\n",
+    "                rt_binder(b);\n",
+    "                rt_puts(\". \");\n",
+    "                rt_push(t, NULL, 0, 1);\n",
+    "                rt_push(t->a, NULL, 0, 0);\n",
+    "                break;\n",
+    "            default:\n",
+    "                if (f.state == 2) {\n",
+    "                    rt_puts(\")\");\n",
+    "                    break;\n",
+    "                }\n",
+    "\n",
+    "                if (f.state == 0)\n",
+    "                    at++;\n",
+    "\n",
+    "                rt_puts(f.state == 0 ? \"(\" : \" \");\n",
+    "                rt_push(t, NULL, 0, f.state + 1);\n",
+    "                rt_push(f.state == 0 ? t->a : t->b, NULL, 0, 0);\n",
+    "        }\n",
+    "    }\n",
+    "\n",
+    "    rt_puts(\"\\n\");\n",
+    "    fwrite(rt_out, 1, rt_out_len, stdout);\n",
+    "    free(levels);\n",
+    "}\n",
+    NULL
+};
+
+typedef struct _cgen {
+    FILE *fp;
+    cc_prog_t *prog;
+
+    /* How temporary `n` is written, a local or an element of the array
+     * that chunked bodies share */
+    const char *temp;
+} cgen_t;
+
+/**
+ * @brief Emit a reference to variable `index` inside `self`, NULL for the
+ *        top level, which has no variables
+ */
+static int _emit_var(cgen_t *g, unsigned int index, cc_lam_t *self) {
+    int slot;
+    if (self == NULL)
+        return ERR_UNBOUND_VAR;
+
+    if (index == 0) {
+        fputs("arg", g->fp);
+        return 0;
+    }
+
+    if ((slot = cc_slot(self, index)) < 0)
+        return ERR_CORRUPT;
+
+    fprintf(g->fp, "env[%d]", slot);
+    return 0;
+}
+
+/**
+ * @brief Frames of `_cgen_count` & `_emit_stmts`
+ */
+typedef enum _cgen_todo_e {
+    /* Compute the expression into its temporary */
+    CG_EXPR,
+
+    /* Apply the computed function to the computed argument */
+    CG_APPLY
+} cgen_todo_e;
+
+/**
+ * @brief Is `expr` written in place rather than computed into a temporary.
+ *        Only variables are, so lambdas get their numbers in pre-order
+ */
+static inline int _cgen_atom(expr_t *expr) {
+    return expr->type == VAR;
+}
+
+/**
+ * @brief Temporary the argument of an application computed into `slot`
+ *        goes to. A function held in a variable needs no temporary, so the
+ *        argument reuses the application's own
+ */
+static inline unsigned int _arg_slot(expr_t *appl, unsigned int slot) {
+    return _cgen_atom(appl->appl.f) ? slot : slot + 1;
+}
+
+/**
+ * @brief Count the temporaries & statements `_emit_stmts` needs for `expr`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _cgen_count(expr_t *expr, unsigned int *ntemps,
+        unsigned int *nstmts) {
+    work_t w;
+    work_init(&w);
+
+    *ntemps = *nstmts = 0;
+    int res = 0;
+    if (!_cgen_atom(expr))
+        res = work_push(&w, expr, NULL, 0, CG_EXPR);
+
+    while (res == 0 && !work_empty(&w)) {
+        work_frame_t f = work_pop(&w);
+        if (f.depth >= *ntemps)
+            *ntemps = f.depth + 1;
+
+        (*nstmts)++;
+        if (f.expr->type != APPL)
+            continue;
+
+        if (!_cgen_atom(f.expr->appl.x))
+            res = work_push(&w, f.expr->appl.x, NULL,
+                    _arg_slot(f.expr, f.depth), CG_EXPR);
+
+        if (res == 0 && !_cgen_atom(f.expr->appl.f))
+            res = work_push(&w, f.expr->appl.f, NULL, f.depth, CG_EXPR);
+    }
+
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Emit the variable `expr` in place, or the temporary `slot` it was
+ *        computed into
+ */
+static int _emit_operand(cgen_t *g, expr_t *expr, unsigned int slot,
+        cc_lam_t *self) {
+    if (_cgen_atom(expr))
+        return _emit_var(g, expr->var.index, self);
+
+    fprintf(g->fp, g->temp, slot);
+    return 0;
+}
+
+/**
+ * @brief Emit statements computing `expr` into temporary 0, one per lambda
+ *        & application. Nested applications become a flat run of
+ *        statements, which neither this walk nor the C compiler has to
+ *        recurse through
+ *
+ * @param next Number of the next lambda met in pre-order
+ * @param chunk NULL to emit into the enclosing function, else the name the
+ *        helpers holding every CGEN_CHUNK statements are numbered after
+ * @param nchunks Helpers emitted
+ */
+static int _emit_stmts(cgen_t *g, expr_t *expr, cc_lam_t *self,
+        unsigned int *next, const char *chunk, unsigned int *nchunks) {
+    cc_lam_t *lam;
+    unsigned int nstmts = 0;
+    work_t w;
+    work_init(&w);
+
+    *nchunks = 0;
+    int res = 0;
+    if (!_cgen_atom(expr))
+        res = work_push(&w, expr, NULL, 0, CG_EXPR);
+
+    while (res == 0 && !work_empty(&w)) {
+        work_frame_t f = work_pop(&w);
+        expr_t *e = f.expr;
+        if (f.state == CG_EXPR && e->type == APPL) {
+            if ((res = work_push(&w, e, NULL, f.depth, CG_APPLY)) < 0)
+                break;
+
+            if (!_cgen_atom(e->appl.x) && (res = work_push(&w, e->appl.x,
+                            NULL, _arg_slot(e, f.depth), CG_EXPR)) < 0)
+                break;
+
+            if (!_cgen_atom(e->appl.f))
+                res = work_push(&w, e->appl.f, NULL, f.depth, CG_EXPR);
+            continue;
+        }
+
+        if (chunk != NULL && nstmts++ % CGEN_CHUNK == 0) {
+            if (*nchunks > 0)
+                fputs("}\n\n", g->fp);
+
+            fprintf(g->fp, "static void %s_%u(val_t **env, val_t *arg, "
+                    "val_t **t) {\n    (void)env;\n    (void)arg;\n",
+                    chunk, (*nchunks)++);
+        }
+
+        fputs("    ", g->fp);
+        fprintf(g->fp, g->temp, f.depth);
+        if (f.state == CG_APPLY) {
+            fputs(" = rt_apply(", g->fp);
+            if ((res = _emit_operand(g, e->appl.f, f.depth, self)) < 0)
+                break;
+
+            fputs(", ", g->fp);
+            if ((res = _emit_operand(g, e->appl.x,
+                            _arg_slot(e, f.depth), self)) < 0)
+                break;
+
+            fputs(");\n", g->fp);
+        } else if (e->type == LAMBDA) {
+            lam = &g->prog->lams[*next];
+            fprintf(g->fp, " = rt_clos(lam_%u, %u, %u", *next,
+                    e->lam.sym, lam->ncaps);
+
+            /* The body's lambdas are numbered, & emitted, separately */
+            *next += 1 + lam->nested;
+            for (unsigned int i = 0; i < lam->ncaps && res == 0; i++) {
+                fputs(", ", g->fp);
+                res = _emit_var(g, lam->caps[i], self);
+            }
+
+            fputs(");\n", g->fp);
+        } else {
+            res = ERR_CORRUPT;
+        }
+    }
+
+    if (*nchunks > 0)
+        fputs("}\n\n", g->fp);
+
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Emit the code of a function computing `expr`: its helpers, if it
+ *        is long enough to be split, & then its own statements, ending in
+ *        `lead` followed by the value
+ *
+ * @param name Name of the function, whose header must come next
+ * @param header Header of the function & what it declares first
+ * @param env, arg What the function hands its helpers
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _emit_func(cgen_t *g, expr_t *expr, cc_lam_t *self,
+        unsigned int *next, const char *name, const char *header,
+        const char *env, const char *arg, const char *lead) {
+    int res;
+    unsigned int ntemps, nstmts, nchunks, i;
+    if ((res = _cgen_count(expr, &ntemps, &nstmts)) < 0)
+        return res;
+
+    if (nstmts > CGEN_CHUNK) {
+        g->temp = "t[%u]";
+        if ((res = _emit_stmts(g, expr, self, next, name, &nchunks)) < 0)
+            return res;
+
+        fprintf(g->fp, "%s    val_t *t[%u];\n", header, ntemps);
+        for (i = 0; i < nchunks; i++)
+            fprintf(g->fp, "    %s_%u(%s, %s, t);\n", name, i, env, arg);
+    } else {
+        g->temp = "t%u";
+        fputs(header, g->fp);
+        for (i = 0; i < ntemps; i++)
+            fprintf(g->fp, i == 0 ? "    val_t *t0" : i % 8 == 0 ?
+                    ",\n        *t%u" : ", *t%u", i);
+
+        if (ntemps > 0)
+            fputs(";\n", g->fp);
+
+        if (self != NULL && self->ncaps == 0)
+            fputs("    (void)env;\n", g->fp);
+
+        if (self != NULL && !self->uses_arg)
+            fputs("    (void)arg;\n", g->fp);
+
+        if ((res = _emit_stmts(g, expr, self, next, NULL, &nchunks)) < 0)
+            return res;
+    }
+
+    fputs(lead, g->fp);
+    if ((res = _emit_operand(g, expr, 0, self)) < 0)
+        return res;
+
+    fputs(";\n", g->fp);
+    return 0;
+}
+
+/**
+ * @brief Emit the symbol table, escaping anything that isn't plain ASCII
+ */
+static void _emit_names(cgen_t *g) {
+    fputs("static const char *rt_names[] = {\n", g->fp);
+    for (int i = 0; i < sym_count(); i++) {
+        fputs("    \"", g->fp);
+        for (const unsigned char *c = (const unsigned char *)sym_name(i);
+                *c != '\0'; c++) {
+            if (*c < 0x20 || *c >= 0x7f || *c == '"' || *c == '\\')
+                fprintf(g->fp, "\\%03o", *c);
+            else
+                fputc(*c, g->fp);
+        }
+
+        fputs("\",\n", g->fp);
+    }
+
+    fputs("    \"\"\n};\n\n", g->fp);
+}
+
+/**
+ * @brief Emit a standalone C program printing the normal form of `expr`
+ *
+ * @param expr Closed term being compiled, left untouched
+ * @param fp Destination of the C source
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int cgen_emit(expr_t *expr, FILE *fp) {
+    if (expr == NULL || fp == NULL)
+        return ERR_INP;
+
+    cgen_t g = { 0 };
+    g.fp = fp;
+
+    int res;
+    unsigned int i, next;
+    if ((res = cc_convert(expr, &g.prog)) < 0)
+        return res;
+
+    fputs("/* Generated by lcc -c */\n\n", fp);
+    _emit_names(&g);
+    for (i = 0; _runtime[i] != NULL; i++)
+        fputs(_runtime[i], fp);
+
+    fputs("\n", fp);
+    for (i = 0; i < g.prog->len; i++)
+        fprintf(fp, "static val_t *lam_%u(val_t **env, val_t *arg);\n", i);
+
+    char name[32], header[80];
+    for (i = 0; i < g.prog->len; i++) {
+        cc_lam_t *lam = &g.prog->lams[i];
+        sprintf(name, "lam_%u", i);
+        sprintf(header, "\nstatic val_t *lam_%u(val_t **env, val_t *arg) "
+                "{\n", i);
+
+        next = i + 1;
+        if ((res = _emit_func(&g, lam->lam->lam.body, lam, &next, name,
+                        header, "env", "arg", "    return ")) < 0)
+            goto cleanup;
+
+        fputs("}\n", fp);
+    }
+
+    fputs("\n", fp);
+    next = 0;
+    if ((res = _emit_func(&g, expr, NULL, &next, "main", "int main(void) {\n"
+                    "    val_t *res;\n", "NULL", "NULL", "    res = ")) < 0)
+        goto cleanup;
+
+    fputs("\n    rt_puts(\"\\x1B[34m-\\033[0m \");\n"
+            "    rt_print(rt_quote(res));\n"
+            "    return 0;\n}\n", fp);
+
+    res = ferror(fp) ? ERR_FILE_ACTION : 0;
+
+cleanup:
+    cc_free(g.prog);
+    return res;
+}
@@ -0,0 +1,28 @@
+/**
+ * @file cgen.h
+ *
+ * @brief Ahead-of-time C backend
+ *
+ * Closure-converts a term into a standalone C translation unit: every
+ * lambda becomes a C function taking its flat environment & argument, &
+ * a small runtime (closure allocation, apply, read back & printing) is
+ * emitted alongside. The result builds with `gcc -O2 out.c` & prints the
+ * same normal form `lcc` does.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _CGEN_H_
+#define _CGEN_H_
+
+#include <stdio.h>
+
+#include "ast.h"
+
+/* Statements per generated function. Longer bodies are split into helpers
+ * of this size, gcc's optimizer slows down sharply on one huge function */
+#define CGEN_CHUNK (256)
+
+int cgen_emit(expr_t *expr, FILE *fp);
+
+#endif /* _CGEN_H_ */
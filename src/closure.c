@@ -0,0 +1,270 @@
+/**
+ * @file closure.c
+ *
+ * @brief Closure conversion implementation
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <err.h>
+
+#include "closure.h"
+#include "work.h"
+
+/**
+ * @brief Sorted set of de Bruijn indices
+ */
+typedef struct _idx_set {
+    unsigned int *v;
+    unsigned int len;
+} idx_set_t;
+
+/**
+ * @brief Union of `a` & `b` into `out`, both inputs are freed
+ */
+static int _set_union(idx_set_t *a, idx_set_t *b, idx_set_t *out) {
+    unsigned int i = 0, j = 0, n = 0;
+    out->v = malloc((a->len + b->len + 1) * sizeof(unsigned int));
+    if (out->v != NULL) {
+        while (i < a->len || j < b->len) {
+            if (j == b->len || (i < a->len && a->v[i] < b->v[j]))
+                out->v[n++] = a->v[i++];
+            else if (i == a->len || b->v[j] < a->v[i])
+                out->v[n++] = b->v[j++];
+            else {
+                /* In both */
+                out->v[n++] = a->v[i++];
+                j++;
+            }
+        }
+    }
+
+    out->len = n;
+    free(a->v);
+    free(b->v);
+    return out->v == NULL ? ERR_MEM_ALLOC : 0;
+}
+
+/**
+ * @brief Free variable sets of the subterms `_collect` has finished
+ */
+typedef struct _idx_sets {
+    idx_set_t *v;
+    unsigned int len;
+    unsigned int cap;
+} idx_sets_t;
+
+static int _sets_push(idx_sets_t *sets, idx_set_t *set) {
+    if (sets->len == sets->cap) {
+        unsigned int cap = sets->cap == 0 ? 0x40 : sets->cap * 2;
+        idx_set_t *v;
+        if ((v = realloc(sets->v, cap * sizeof(idx_set_t))) == NULL) {
+            free(set->v);
+            return ERR_MEM_ALLOC;
+        }
+
+        sets->v = v;
+        sets->cap = cap;
+    }
+
+    sets->v[sets->len++] = *set;
+    return 0;
+}
+
+/**
+ * @brief Start the table entry of the lambda `expr`
+ *
+ * @return Its number on success, ERR_* otherwise
+ */
+static long _number(cc_prog_t *g, expr_t *expr) {
+    if (g->len == g->cap) {
+        unsigned int cap = g->cap == 0 ? 0x40 : g->cap * 2;
+        cc_lam_t *lams;
+        if ((lams = realloc(g->lams, cap * sizeof(cc_lam_t))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        g->lams = lams;
+        g->cap = cap;
+    }
+
+    unsigned int id = g->len++;
+    g->lams[id].lam = expr;
+    g->lams[id].caps = NULL;
+    g->lams[id].ncaps = 0;
+    return id;
+}
+
+/**
+ * @brief Finish lambda `id` given the free variables of its body, which
+ *        become those of the lambda
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _capture(cc_prog_t *g, unsigned int id, idx_set_t *fv) {
+    unsigned int i, n = 0;
+    g->lams[id].nested = g->len - id - 1;
+
+    /* Drop the lambda's own variable & re-base the rest */
+    g->lams[id].uses_arg = fv->len > 0 && fv->v[0] == 0;
+    for (i = 0; i < fv->len; i++) {
+        if (fv->v[i] > 0)
+            fv->v[n++] = fv->v[i] - 1;
+    }
+
+    fv->len = n;
+    if ((g->lams[id].caps = malloc((n + 1) * sizeof(unsigned int))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    for (i = 0; i < n; i++)
+        g->lams[id].caps[i] = fv->v[i];
+
+    g->lams[id].ncaps = n;
+    return 0;
+}
+
+/**
+ * @brief Number every lambda in `expr` in pre-order & record what it
+ *        captures. Subterms are visited from a work stack & leave their
+ *        free variables on a stack of sets for their parent
+ *
+ * @param out Free variables of `expr`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _collect(cc_prog_t *g, expr_t *expr, idx_set_t *out) {
+    work_t w;
+    work_init(&w);
+
+    idx_sets_t sets = { 0 };
+    idx_set_t set, f, x;
+    long id;
+    int res;
+    if ((res = work_push(&w, expr, NULL, 0, 0)) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        expr = frame.expr;
+
+        switch (expr->type) {
+            case (VAR):
+                if ((set.v = malloc(sizeof(unsigned int))) == NULL)
+                    goto oom;
+
+                set.v[0] = expr->var.index;
+                set.len = 1;
+                break;
+            case (APPL):
+                if (frame.state == 0) {
+                    /* The function's lambdas are numbered first */
+                    if ((res = work_push(&w, expr, NULL, 0, 1)) < 0 ||
+                            (res = work_push(&w, expr->appl.x, NULL, 0,
+                                             0)) < 0 ||
+                            (res = work_push(&w, expr->appl.f, NULL, 0,
+                                             0)) < 0)
+                        goto cleanup;
+                    continue;
+                }
+
+                x = sets.v[--sets.len];
+                f = sets.v[--sets.len];
+                if ((res = _set_union(&f, &x, &set)) < 0)
+                    goto cleanup;
+                break;
+            case (LAMBDA):
+                if (frame.state == 0) {
+                    if ((id = _number(g, expr)) < 0 ||
+                            work_push(&w, expr, NULL, id, 1) < 0 ||
+                            work_push(&w, expr->lam.body, NULL, 0, 0) < 0)
+                        goto oom;
+                    continue;
+                }
+
+                set = sets.v[--sets.len];
+                if ((res = _capture(g, frame.depth, &set)) < 0) {
+                    free(set.v);
+                    goto cleanup;
+                }
+                break;
+            default:
+                res = ERR_CORRUPT;
+                goto cleanup;
+        }
+
+        if ((res = _sets_push(&sets, &set)) < 0)
+            goto cleanup;
+    }
+
+    *out = sets.v[--sets.len];
+    goto cleanup;
+
+oom:
+    res = ERR_MEM_ALLOC;
+cleanup:
+    while (sets.len > 0)
+        free(sets.v[--sets.len].v);
+
+    free(sets.v);
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Closure-convert a closed term
+ *
+ * @param expr Term being converted, left untouched
+ * @param out Freshly allocated lambda table on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int cc_convert(expr_t *expr, cc_prog_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    cc_prog_t *prog;
+    if ((prog = calloc(1, sizeof(cc_prog_t))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    int res;
+    idx_set_t fv;
+    if ((res = _collect(prog, expr, &fv)) < 0) {
+        cc_free(prog);
+        return res;
+    }
+
+    free(fv.v);
+    if (fv.len > 0) {
+        cc_free(prog);
+        return ERR_UNBOUND_VAR;
+    }
+
+    *out = prog;
+    return 0;
+}
+
+/**
+ * @brief Environment slot of variable `index` (> 0) inside `lam`
+ *
+ * @return The slot, -1 if `lam` doesn't capture the variable
+ */
+int cc_slot(cc_lam_t *lam, unsigned int index) {
+    for (unsigned int i = 0; i < lam->ncaps; i++) {
+        if (lam->caps[i] == index - 1)
+            return i;
+    }
+
+    return -1;
+}
+
+void cc_free(cc_prog_t *prog) {
+    if (prog == NULL)
+        return;
+
+    for (unsigned int i = 0; i < prog->len; i++)
+        free(prog->lams[i].caps);
+
+    free(prog->lams);
+    free(prog);
+}
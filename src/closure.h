@@ -0,0 +1,52 @@
+/**
+ * @file closure.h
+ *
+ * @brief Closure conversion shared by the native backends
+ *
+ * Every lambda of a closed term is numbered in pre-order & given the list
+ * of variables it captures from its enclosing scope. Inside the lambda,
+ * variable 0 is its argument & variable `i > 0` is the captured variable
+ * `i - 1`, found in the closure's flat environment at `cc_slot`.
+ *
+ * A backend walking a body meets its nested lambdas in pre-order: the first
+ * is numbered one past the enclosing lambda & each one is followed by the
+ * number after its own `nested` lambdas.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#include "ast.h"
+
+/**
+ * @brief What closure conversion found out about one lambda
+ */
+typedef struct _cc_lam {
+    expr_t *lam;
+
+    /* Enclosing scope's indices of the captured variables, ascending; the
+     * closure's environment holds them in this order */
+    unsigned int *caps;
+    unsigned int ncaps;
+
+    /* Lambdas inside this one's body */
+    unsigned int nested;
+
+    /* Whether the body refers to the lambda's own variable */
+    int uses_arg;
+} cc_lam_t;
+
+typedef struct _cc_prog {
+    /* Indexed by pre-order lambda number */
+    cc_lam_t *lams;
+    unsigned int len;
+    unsigned int cap;
+} cc_prog_t;
+
+int cc_convert(expr_t *expr, cc_prog_t **out);
+int cc_slot(cc_lam_t *lam, unsigned int index);
+void cc_free(cc_prog_t *prog);
+
+#endif /* _CLOSURE_H_ */
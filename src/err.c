@@ -60,6 +60,10 @@ const char *err_to_string(int err) {
             return "ERR_BAD_PARSE";
         case (ERR_UNBOUND_VAR):
             return "ERR_UNBOUND_VAR";
+        case (ERR_UNSUPPORTED):
+            return "ERR_UNSUPPORTED";
+        case (ERR_BUDGET):
+            return "ERR_BUDGET";
         case (0):
             return "NOT AN ERR";
         default:
@@ -0,0 +1,781 @@
+/**
+ * @file hcons.c
+ *
+ * @brief Hash-consing implementation
+ *
+ * Nodes are interned in a chained hash table keyed on their type & the
+ * (already interned) children, so structural equality of children is
+ * pointer equality and interning a node is O(1). Variables carry de Bruijn
+ * indices & lambdas don't take part in the key with their name, which makes
+ * alpha-equivalent subterms collapse into one node.
+ *
+ * Reduction never mutates a node. The term being reduced is held by a cursor:
+ * the subterm in focus & the path of enclosing nodes back to the root. A beta
+ * step replaces the focus & the search for the next redex carries on from
+ * there, as `normalize` does, so enclosing nodes are only rebuilt on the way
+ * back up or when the whole term is asked for. Substitution is functional;
+ * subterms without free variables above the substitution depth are reused
+ * as-is, & substitution results for shared open subterms are memoized so each
+ * one is only rebuilt once.
+ *
+ * Terms can be nested far deeper than the C stack allows, so every traversal
+ * keeps its pending work on an explicit stack.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <err.h>
+#include <lib/arena.h>
+
+#include "hcons.h"
+#include "work.h"
+
+/* Node storage & table */
+static arena_t *_hc_arena = NULL;
+static hc_node_t **_hc_buckets = NULL;
+static unsigned int _hc_nbuckets = 0;
+static hc_stats_t _hc_counters;
+
+/**
+ * @brief Memoized result of substituting/shifting `node` with key (a, b)
+ */
+typedef struct _hc_memo {
+    hc_node_t *node;
+    unsigned int a;
+    unsigned int b;
+    /* Entries from earlier beta steps are stale */
+    unsigned int gen;
+    hc_node_t *res;
+} hc_memo_t;
+
+/**
+ * @brief Which child of an enclosing node a cursor's path leads through
+ */
+typedef enum _hc_ctx_e {
+    HC_BODY,
+    HC_FUNC,
+    HC_ARG
+} hc_ctx_e;
+
+/**
+ * @brief Functional rewrites done by `_hc_map`
+ */
+typedef enum _hc_map_e {
+    /* Add `a` to the free indices >= `b` */
+    HC_SHIFT,
+
+    /* Substitute for index `a`, lowering the free indices above it */
+    HC_SUBST
+} hc_map_e;
+
+static hc_memo_t _hc_subst_memo[HC_MEMO_SIZE];
+static hc_memo_t _hc_shift_memo[HC_MEMO_SIZE];
+static unsigned int _hc_gen = 0;
+
+static inline unsigned int _hc_mix(unsigned int a, unsigned int b) {
+    a ^= b + 0x9e3779b9 + (a << 6) + (a >> 2);
+    return a * 0x85ebca6b;
+}
+
+/**
+ * @brief Hash of a node from its key fields
+ */
+static unsigned int _hc_hash(hc_node_t *node) {
+    switch (node->type) {
+        case (VAR):
+            return _hc_mix(VAR, node->index);
+        case (LAMBDA):
+            return _hc_mix(LAMBDA, node->lam.body->hash);
+        default:
+            return _hc_mix(_hc_mix(APPL, node->appl.f->hash),
+                    node->appl.x->hash);
+    }
+}
+
+/**
+ * @brief Do `a` & `b` have the same key fields
+ */
+static int _hc_same(hc_node_t *a, hc_node_t *b) {
+    if (a->type != b->type || a->hash != b->hash)
+        return 0;
+
+    switch (a->type) {
+        case (VAR):
+            return a->index == b->index;
+        case (LAMBDA):
+            return a->lam.body == b->lam.body;
+        default:
+            return a->appl.f == b->appl.f && a->appl.x == b->appl.x;
+    }
+}
+
+/**
+ * @brief Set up the node table on first use
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _hc_init() {
+    if (_hc_buckets != NULL)
+        return 0;
+
+    if ((_hc_arena = arena_new(0)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    if ((_hc_buckets = calloc(HC_INIT_BUCKETS, sizeof(hc_node_t *))) == NULL) {
+        arena_free(_hc_arena);
+        _hc_arena = NULL;
+        return ERR_MEM_ALLOC;
+    }
+
+    _hc_nbuckets = HC_INIT_BUCKETS;
+    return 0;
+}
+
+/**
+ * @brief Double the bucket count & rehash every node. Failing to grow only
+ *        costs longer chains, so errors are swallowed
+ */
+static void _hc_grow() {
+    unsigned int nbuckets = _hc_nbuckets * 2;
+    hc_node_t **buckets;
+    if ((buckets = calloc(nbuckets, sizeof(hc_node_t *))) == NULL)
+        return;
+
+    for (unsigned int i = 0; i < _hc_nbuckets; i++) {
+        hc_node_t *node = _hc_buckets[i];
+        while (node != NULL) {
+            hc_node_t *next = node->next;
+            unsigned int ind = node->hash & (nbuckets - 1);
+            node->next = buckets[ind];
+            buckets[ind] = node;
+            node = next;
+        }
+    }
+
+    free(_hc_buckets);
+    _hc_buckets = buckets;
+    _hc_nbuckets = nbuckets;
+}
+
+/**
+ * @brief Take a reference to `node`
+ */
+hc_node_t *hc_retain(hc_node_t *node) {
+    if (node != NULL)
+        node->refs++;
+
+    return node;
+}
+
+/**
+ * @brief Drop a reference to `node`. Once it's unreachable it is taken out
+ *        of the table & its bucket link is reused to put it on `dead`
+ *
+ * @return The new head of `dead`
+ */
+static hc_node_t *_hc_drop(hc_node_t *node, hc_node_t *dead) {
+    if (node == NULL || --node->refs > 0)
+        return dead;
+
+    hc_node_t **link = _hc_buckets + (node->hash & (_hc_nbuckets - 1));
+    while (*link != node)
+        link = &(*link)->next;
+
+    *link = node->next;
+    _hc_counters.live--;
+
+    node->next = dead;
+    return node;
+}
+
+/**
+ * @brief Drop a reference to `node`, deleting it once it's unreachable
+ */
+void hc_release(hc_node_t *node) {
+    hc_node_t *dead = _hc_drop(node, NULL);
+    while (dead != NULL) {
+        node = dead;
+        dead = node->next;
+
+        if (node->type == LAMBDA) {
+            dead = _hc_drop(node->lam.body, dead);
+        } else if (node->type == APPL) {
+            dead = _hc_drop(node->appl.f, dead);
+            dead = _hc_drop(node->appl.x, dead);
+        }
+
+        arena_release(_hc_arena, node, sizeof(hc_node_t));
+    }
+}
+
+/**
+ * @brief Return the canonical node matching `proto`. The references to
+ *        children held by `proto` are consumed either way
+ *
+ * @return Owned reference on success, NULL otherwise
+ */
+static hc_node_t *_hc_intern(hc_node_t *proto) {
+    proto->hash = _hc_hash(proto);
+    _hc_counters.lookups++;
+
+    unsigned int ind = proto->hash & (_hc_nbuckets - 1);
+    hc_node_t *node;
+    for (node = _hc_buckets[ind]; node != NULL; node = node->next)
+        if (_hc_same(node, proto))
+            break;
+
+    if (node != NULL) {
+        _hc_counters.hits++;
+        hc_retain(node);
+        goto cleanup_proto;
+    }
+
+    if ((node = arena_alloc(_hc_arena, sizeof(hc_node_t))) == NULL)
+        goto cleanup_proto;
+
+    memcpy(node, proto, sizeof(hc_node_t));
+    node->refs = 1;
+
+    unsigned int fd;
+    switch (node->type) {
+        case (VAR):
+            node->free_depth = node->index + 1;
+            break;
+        case (LAMBDA):
+            fd = node->lam.body->free_depth;
+            node->free_depth = fd > 0 ? fd - 1 : 0;
+            break;
+        default:
+            fd = node->appl.f->free_depth;
+            node->free_depth = node->appl.x->free_depth;
+            if (fd > node->free_depth)
+                node->free_depth = fd;
+    }
+
+    node->next = _hc_buckets[ind];
+    _hc_buckets[ind] = node;
+
+    if (++_hc_counters.live > _hc_counters.high_water)
+        _hc_counters.high_water = _hc_counters.live;
+
+    if (_hc_counters.live > _hc_nbuckets)
+        _hc_grow();
+
+    return node;
+
+cleanup_proto:
+    if (proto->type == LAMBDA) {
+        hc_release(proto->lam.body);
+    } else if (proto->type == APPL) {
+        hc_release(proto->appl.f);
+        hc_release(proto->appl.x);
+    }
+
+    return node;
+}
+
+static hc_node_t *_hc_var(unsigned int index) {
+    hc_node_t proto = { .type = VAR, .index = index };
+    return _hc_intern(&proto);
+}
+
+/**
+ * @brief Canonical lambda, consumes the reference to `body`
+ */
+static hc_node_t *_hc_lam(sym_t sym, hc_node_t *body) {
+    if (body == NULL)
+        return NULL;
+
+    hc_node_t proto = { .type = LAMBDA, .lam = { sym, body } };
+    return _hc_intern(&proto);
+}
+
+/**
+ * @brief Canonical application, consumes the references to `f` & `x`
+ */
+static hc_node_t *_hc_appl(hc_node_t *f, hc_node_t *x) {
+    if (f == NULL || x == NULL) {
+        hc_release(f);
+        hc_release(x);
+        return NULL;
+    }
+
+    hc_node_t proto = { .type = APPL, .appl = { f, x } };
+    return _hc_intern(&proto);
+}
+
+/**
+ * @brief Look up a memoized result for (node, a, b)
+ */
+static hc_memo_t *_hc_memo(hc_memo_t *memo, hc_node_t *node, unsigned int a,
+        unsigned int b) {
+    unsigned int ind = _hc_mix(_hc_mix(node->hash, a), b) & (HC_MEMO_SIZE - 1);
+    return memo + ind;
+}
+
+/**
+ * @brief Release the results of a traversal that failed part way
+ */
+static void _hc_unwind(work_t *results) {
+    while (!work_empty(results))
+        hc_release(work_pop(results).node);
+
+    work_free(results);
+}
+
+static hc_node_t *_hc_map(hc_map_e op, hc_node_t *node, unsigned int a,
+        unsigned int b, hc_node_t *x);
+
+/**
+ * @brief Result of mapping `node` when it can be had without visiting its
+ *        children: unchanged, memoized or a variable
+ *
+ * @return Owned reference, NULL if the children must be visited first
+ */
+static hc_node_t *_hc_map_leaf(hc_map_e op, hc_node_t *node, unsigned int a,
+        unsigned int b, hc_node_t *x, int *err) {
+    unsigned int bound = op == HC_SHIFT ? b : a;
+    if ((op == HC_SHIFT && a == 0) || node->free_depth <= bound)
+        return hc_retain(node);
+
+    hc_memo_t *memo = _hc_memo(op == HC_SHIFT ? _hc_shift_memo :
+            _hc_subst_memo, node, a, b);
+    if (memo->gen == _hc_gen && memo->node == node && memo->a == a &&
+            memo->b == b)
+        return hc_retain(memo->res);
+
+    if (node->type != VAR)
+        return NULL;
+
+    hc_node_t *res;
+    if (op == HC_SHIFT)
+        res = _hc_var(node->index + a);
+    else if (node->index == a)
+        res = _hc_map(HC_SHIFT, x, a, 0, NULL);
+    else
+        res = _hc_var(node->index - 1);
+
+    if (res == NULL)
+        *err = ERR_MEM_ALLOC;
+
+    return res;
+}
+
+/**
+ * @brief Shift (by `a`, for indices >= `b`) or substitute (`x` for index `a`)
+ *        in `node`. The binder depth is added to the cutoff or index on the
+ *        way down, & nodes are rebuilt bottom up from a stack of results
+ *
+ * @return Owned reference on success, NULL otherwise
+ */
+static hc_node_t *_hc_map(hc_map_e op, hc_node_t *node, unsigned int a,
+        unsigned int b, hc_node_t *x) {
+    work_t w, results;
+    work_init(&w);
+    work_init(&results);
+
+    hc_node_t *res = NULL;
+    int err = 0;
+    if (work_push_node(&w, node, NULL, 0, 0) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        node = frame.node;
+        unsigned int fa = op == HC_SUBST ? a + frame.depth : a;
+        unsigned int fb = op == HC_SHIFT ? b + frame.depth : b;
+
+        if (frame.state == 0) {
+            if ((res = _hc_map_leaf(op, node, fa, fb, x, &err)) != NULL) {
+                if (work_push_node(&results, res, NULL, 0, 0) < 0)
+                    goto cleanup_res;
+                continue;
+            } else if (err < 0) {
+                goto cleanup;
+            }
+
+            if (work_push_node(&w, node, NULL, frame.depth, 1) < 0)
+                goto cleanup;
+
+            if (node->type == LAMBDA) {
+                if (work_push_node(&w, node->lam.body, NULL,
+                            frame.depth + 1, 0) < 0)
+                    goto cleanup;
+            } else if (work_push_node(&w, node->appl.x, NULL,
+                        frame.depth, 0) < 0 ||
+                    work_push_node(&w, node->appl.f, NULL,
+                        frame.depth, 0) < 0) {
+                goto cleanup;
+            }
+
+            continue;
+        }
+
+        if (node->type == LAMBDA) {
+            res = _hc_lam(node->lam.sym, work_pop(&results).node);
+        } else {
+            hc_node_t *mx = work_pop(&results).node;
+            res = _hc_appl(work_pop(&results).node, mx);
+        }
+
+        if (res == NULL)
+            goto cleanup;
+
+        hc_memo_t *memo = _hc_memo(op == HC_SHIFT ? _hc_shift_memo :
+                _hc_subst_memo, node, fa, fb);
+        *memo = (hc_memo_t){ node, fa, fb, _hc_gen, res };
+
+        if (work_push_node(&results, res, NULL, 0, 0) < 0)
+            goto cleanup_res;
+    }
+
+    res = work_pop(&results).node;
+    work_free(&w);
+    work_free(&results);
+    return res;
+
+cleanup_res:
+    hc_release(res);
+cleanup:
+    work_free(&w);
+    _hc_unwind(&results);
+    return NULL;
+}
+
+/**
+ * @brief Convert a parsed term into its canonical node. Children are
+ *        converted before their parent from a stack of results
+ */
+static hc_node_t *_hc_from_expr(expr_t *expr) {
+    work_t w, results;
+    work_init(&w);
+    work_init(&results);
+
+    hc_node_t *res = NULL;
+    if (work_push(&w, expr, NULL, 0, 0) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        expr = frame.expr;
+
+        if (frame.state == 0 && expr->type != VAR) {
+            if (work_push(&w, expr, NULL, 0, 1) < 0)
+                goto cleanup;
+
+            /* Convert left to right so the first name seen for a shared
+             * lambda is the leftmost one */
+            if (expr->type == LAMBDA) {
+                if (work_push(&w, expr->lam.body, NULL, 0, 0) < 0)
+                    goto cleanup;
+            } else if (expr->type == APPL) {
+                if (work_push(&w, expr->appl.x, NULL, 0, 0) < 0 ||
+                        work_push(&w, expr->appl.f, NULL, 0, 0) < 0)
+                    goto cleanup;
+            } else {
+                goto cleanup;
+            }
+
+            continue;
+        }
+
+        if (expr->type == VAR) {
+            res = _hc_var(expr->var.index);
+        } else if (expr->type == LAMBDA) {
+            res = _hc_lam(expr->lam.sym, work_pop(&results).node);
+        } else {
+            hc_node_t *x = work_pop(&results).node;
+            res = _hc_appl(work_pop(&results).node, x);
+        }
+
+        if (res == NULL)
+            goto cleanup;
+
+        if (work_push_node(&results, res, NULL, 0, 0) < 0) {
+            hc_release(res);
+            goto cleanup;
+        }
+    }
+
+    res = work_pop(&results).node;
+    work_free(&w);
+    work_free(&results);
+    return res;
+
+cleanup:
+    work_free(&w);
+    _hc_unwind(&results);
+    return NULL;
+}
+
+/**
+ * @brief Intern a parsed term. The input is left untouched
+ *
+ * @param expr Term being converted
+ * @param out Owned reference to the canonical node on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int hc_from_expr(expr_t *expr, hc_node_t **out) {
+    int res;
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    if ((res = _hc_init()) < 0)
+        return res;
+
+    if ((*out = _hc_from_expr(expr)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    return 0;
+}
+
+/**
+ * @brief Unfold a node back into a tree, top down, filling in the slot each
+ *        node's parent left for it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _hc_to_expr(hc_node_t *node, expr_t **out) {
+    work_t w;
+    work_init(&w);
+
+    *out = NULL;
+    int res = 0;
+    if ((res = work_push_node(&w, node, out, 0, 0)) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        node = frame.node;
+
+        switch (node->type) {
+            case (VAR):
+                /* Printing names variables after their binder */
+                *frame.slot = new_var(node->index, 0);
+                break;
+            case (LAMBDA):
+                if ((*frame.slot = new_lam(node->lam.sym, NULL)) == NULL)
+                    break;
+
+                res = work_push_node(&w, node->lam.body,
+                        &(*frame.slot)->lam.body, 0, 0);
+                break;
+            default:
+                if ((*frame.slot = new_appl(NULL, NULL)) == NULL)
+                    break;
+
+                if ((res = work_push_node(&w, node->appl.x,
+                                &(*frame.slot)->appl.x, 0, 0)) == 0)
+                    res = work_push_node(&w, node->appl.f,
+                            &(*frame.slot)->appl.f, 0, 0);
+        }
+
+        if (*frame.slot == NULL)
+            res = ERR_MEM_ALLOC;
+
+        if (res < 0)
+            goto cleanup;
+    }
+
+cleanup:
+    work_free(&w);
+    if (res < 0 && *out != NULL) {
+        free_expr(*out);
+        *out = NULL;
+    }
+
+    return res;
+}
+
+/**
+ * @brief Unfold a hash-consed term into a fresh expr_t tree
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int hc_to_expr(hc_node_t *node, expr_t **out) {
+    if (node == NULL || out == NULL)
+        return ERR_INP;
+
+    return _hc_to_expr(node, out);
+}
+
+/**
+ * @brief Rebuild `parent` with `child` in place of the one `ctx` names. Both
+ *        references are consumed, an unchanged child gives back `parent`
+ *
+ * @return Owned reference on success, NULL otherwise
+ */
+static hc_node_t *_hc_up(hc_node_t *parent, hc_ctx_e ctx, hc_node_t *child) {
+    hc_node_t *res;
+    switch (ctx) {
+        case (HC_BODY):
+            if (child == parent->lam.body)
+                goto unchanged;
+
+            res = _hc_lam(parent->lam.sym, child);
+            break;
+        case (HC_FUNC):
+            if (child == parent->appl.f)
+                goto unchanged;
+
+            res = _hc_appl(child, hc_retain(parent->appl.x));
+            break;
+        default:
+            if (child == parent->appl.x)
+                goto unchanged;
+
+            res = _hc_appl(hc_retain(parent->appl.f), child);
+    }
+
+    hc_release(parent);
+    return res;
+
+unchanged:
+    hc_release(child);
+    return parent;
+}
+
+/**
+ * @brief Start reducing `root`, taking over the reference to it
+ */
+void hc_cursor_init(hc_cursor_t *cur, hc_node_t *root) {
+    cur->focus = root;
+    work_init(&cur->path);
+}
+
+/**
+ * @brief Move the focus to the next redex in the same order as `step_expr`.
+ *        The search picks up where the last contraction left the focus
+ *
+ * @return ERR_* on error, 0 if the focus is a redex, 1 if the term is normal
+ */
+int hc_find(hc_cursor_t *cur) {
+    if (cur->focus == NULL)
+        return ERR_INP;
+
+    hc_node_t *focus = cur->focus;
+    for (;;) {
+        if (focus->type == LAMBDA || (focus->type == APPL &&
+                    focus->appl.f->type != LAMBDA)) {
+            if (work_push_node(&cur->path, focus, NULL, 0,
+                        focus->type == LAMBDA ? HC_BODY : HC_FUNC) < 0)
+                goto oom;
+
+            focus = hc_retain(focus->type == LAMBDA ? focus->lam.body :
+                    focus->appl.f);
+            continue;
+        } else if (focus->type == APPL) {
+            cur->focus = focus;
+            return 0;
+        }
+
+        /* The focus is normal, move on to the innermost argument that
+         * hasn't been searched yet */
+        for (;;) {
+            if (work_empty(&cur->path)) {
+                cur->focus = focus;
+                return 1;
+            }
+
+            work_frame_t *top = work_top(&cur->path);
+            if (top->state == HC_FUNC) {
+                if ((top->node = _hc_up(top->node, HC_FUNC, focus)) == NULL)
+                    goto oom_popped;
+
+                top->state = HC_ARG;
+                focus = hc_retain(((hc_node_t *)top->node)->appl.x);
+                break;
+            }
+
+            work_frame_t done = work_pop(&cur->path);
+            if ((focus = _hc_up(done.node, done.state, focus)) == NULL)
+                goto oom;
+        }
+    }
+
+oom_popped:
+    work_pop(&cur->path);
+    focus = NULL;
+oom:
+    hc_release(focus);
+    cur->focus = NULL;
+    return ERR_MEM_ALLOC;
+}
+
+/**
+ * @brief Contract the redex `hc_find` left in focus. If it was in function
+ *        position the focus backs up one level, since it may have become a
+ *        lambda
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int hc_contract(hc_cursor_t *cur) {
+    hc_node_t *redex = cur->focus;
+    if (redex == NULL || redex->type != APPL ||
+            redex->appl.f->type != LAMBDA)
+        return ERR_INP;
+
+    /* Invalidate the memo of the previous contraction */
+    _hc_gen++;
+    cur->focus = _hc_map(HC_SUBST, redex->appl.f->lam.body, 0, 0,
+            redex->appl.x);
+    hc_release(redex);
+    if (cur->focus == NULL)
+        return ERR_MEM_ALLOC;
+
+    if (!work_empty(&cur->path) && work_top(&cur->path)->state == HC_FUNC) {
+        work_frame_t done = work_pop(&cur->path);
+        if ((cur->focus = _hc_up(done.node, HC_FUNC, cur->focus)) == NULL)
+            return ERR_MEM_ALLOC;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief The whole term under the cursor, rebuilt from the focus up. The
+ *        cursor is left as it was
+ *
+ * @param out Owned reference to the term on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int hc_root(hc_cursor_t *cur, hc_node_t **out) {
+    if (cur->focus == NULL)
+        return ERR_INP;
+
+    hc_node_t *node = hc_retain(cur->focus);
+    for (size_t i = cur->path.len; i-- > 0 && node != NULL;) {
+        work_frame_t *frame = &cur->path.frames[i];
+        node = _hc_up(hc_retain(frame->node), frame->state, node);
+    }
+
+    if ((*out = node) == NULL)
+        return ERR_MEM_ALLOC;
+
+    return 0;
+}
+
+/**
+ * @brief Drop the cursor's references
+ */
+void hc_cursor_free(hc_cursor_t *cur) {
+    while (!work_empty(&cur->path))
+        hc_release(work_pop(&cur->path).node);
+
+    work_free(&cur->path);
+    hc_release(cur->focus);
+    cur->focus = NULL;
+}
+
+/**
+ * @brief Report sharing counters
+ */
+void hc_stats(hc_stats_t *stats) {
+    if (stats != NULL)
+        memcpy(stats, &_hc_counters, sizeof(hc_stats_t));
+}
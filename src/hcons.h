@@ -0,0 +1,108 @@
+/**
+ * @file hcons.h
+ *
+ * @brief Hash-consed term representation
+ *
+ * Terms are stored as a DAG in which every structurally identical subterm
+ * exists exactly once. Variables are de Bruijn indices, so alpha-equivalent
+ * subterms are shared as well & equality is a pointer compare. Nodes are
+ * immutable & reference counted; copying a term is taking a reference.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _HCONS_H_
+#define _HCONS_H_
+
+#include "ast.h"
+#include "work.h"
+
+/* Starting (power of two) bucket count of the node table */
+#define HC_INIT_BUCKETS (0x400)
+
+/* Entries in the direct-mapped substitution memo */
+#define HC_MEMO_SIZE (0x1000)
+
+typedef struct _hc_node {
+    /* Shared with `expr_t` */
+    expr_e type;
+
+    /* Structural hash, invariant under alpha renaming */
+    unsigned int hash;
+
+    /* Parents, roots & callers holding this node */
+    unsigned int refs;
+
+    /* 1 + the largest free de Bruijn index, 0 if the term is closed */
+    unsigned int free_depth;
+
+    union {
+        /* VAR: distance to the binding lambda */
+        unsigned int index;
+
+        /* LAMBDA: `sym` is cosmetic - the first name seen for this term */
+        struct {
+            sym_t sym;
+            struct _hc_node *body;
+        } lam;
+
+        /* APPL */
+        struct {
+            struct _hc_node *f;
+            struct _hc_node *x;
+        } appl;
+    };
+
+    /* Next node in the same table bucket */
+    struct _hc_node *next;
+} hc_node_t;
+
+/**
+ * @brief Sharing counters
+ */
+typedef struct _hc_stats {
+    /* Distinct nodes currently alive */
+    unsigned long live;
+
+    /* Largest value `live` has reached */
+    unsigned long high_water;
+
+    /* Node constructions requested */
+    unsigned long lookups;
+
+    /* Constructions answered with an existing node */
+    unsigned long hits;
+} hc_stats_t;
+
+/**
+ * @brief A term under reduction: the subterm in focus & the enclosing nodes
+ *        on the path back to the root, outermost first. Public so that it
+ *        can live on the stack
+ */
+typedef struct _hc_cursor {
+    hc_node_t *focus;
+
+    /* Each frame holds a reference to an enclosing node as it was before
+     * the focus changed, & which of its children leads to the focus */
+    work_t path;
+} hc_cursor_t;
+
+/**
+ * @brief Alpha-equivalence of two hash-consed terms
+ */
+static inline int hc_equal(hc_node_t *a, hc_node_t *b) {
+    return a == b;
+}
+
+int hc_from_expr(expr_t *expr, hc_node_t **out);
+int hc_to_expr(hc_node_t *node, expr_t **out);
+void hc_cursor_init(hc_cursor_t *cur, hc_node_t *root);
+int hc_find(hc_cursor_t *cur);
+int hc_contract(hc_cursor_t *cur);
+int hc_root(hc_cursor_t *cur, hc_node_t **out);
+void hc_cursor_free(hc_cursor_t *cur);
+hc_node_t *hc_retain(hc_node_t *node);
+void hc_release(hc_node_t *node);
+void hc_stats(hc_stats_t *stats);
+
+#endif /* _HCONS_H_ */
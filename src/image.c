@@ -0,0 +1,424 @@
+/**
+ * @file image.c
+ *
+ * @brief Precompiled term image implementation
+ *
+ * Loading maps the image & builds the term straight from its node array in
+ * a single pass, one arena node per image node, checking as it goes that
+ * every reference points back at a node no other node has claimed & that
+ * every variable is bound, so that a corrupt image is rejected rather than
+ * handed to an engine. The names are interned up front, once each.
+ *
+ * @author Lars Wander
+ */
+
+#if defined(__unix__) || defined(__APPLE__)
+/* mmap & friends are POSIX, not C11 */
+#define _DEFAULT_SOURCE
+#define IMG_MMAP
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef IMG_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <err.h>
+
+#include "image.h"
+#include "lexer.h"
+#include "work.h"
+
+/**
+ * @brief Nodes flattened for writing
+ */
+typedef struct _img_nodes {
+    img_node_t *nodes;
+    unsigned int len;
+    unsigned int cap;
+} img_nodes_t;
+
+/**
+ * @brief Node built while loading
+ */
+typedef struct _img_built {
+    /* NULL once claimed by its parent */
+    expr_t *expr;
+
+    /* One more than the largest index of a variable the node leaves
+     * unbound, 0 if it is closed */
+    unsigned int free;
+} img_built_t;
+
+static int _emit(img_nodes_t *ns, unsigned int type, unsigned int a,
+        unsigned int b) {
+    if (ns->len == ns->cap) {
+        unsigned int cap = ns->cap == 0 ? 0x100 : ns->cap * 2;
+        img_node_t *nodes;
+        if ((nodes = realloc(ns->nodes, cap * sizeof(img_node_t))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        ns->nodes = nodes;
+        ns->cap = cap;
+    }
+
+    img_node_t *n = &ns->nodes[ns->len++];
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    return 0;
+}
+
+/**
+ * @brief Number the nodes of `expr` children first
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _flatten(expr_t *expr, img_nodes_t *ns) {
+    work_t w;
+    work_init(&w);
+
+    work_frame_t *f;
+    expr_t *e;
+    int res = work_push(&w, expr, NULL, 0, 0);
+    while (res == 0 && !work_empty(&w)) {
+        f = work_top(&w);
+        e = f->expr;
+        switch (e->type) {
+            case (VAR):
+                work_pop(&w);
+                res = _emit(ns, VAR, e->var.index, e->var.sym);
+                break;
+            case (LAMBDA):
+                if (f->state == 0) {
+                    f->state = 1;
+                    res = work_push(&w, e->lam.body, NULL, 0, 0);
+                    break;
+                }
+
+                /* The body was numbered last */
+                work_pop(&w);
+                res = _emit(ns, LAMBDA, e->lam.sym, 1);
+                break;
+            case (APPL):
+                if (f->state == 0) {
+                    f->state = 1;
+                    res = work_push(&w, e->appl.f, NULL, 0, 0);
+                    break;
+                } else if (f->state == 1) {
+                    /* Remember where the function ended up */
+                    f->state = 2;
+                    f->depth = ns->len - 1;
+                    res = work_push(&w, e->appl.x, NULL, 0, 0);
+                    break;
+                }
+
+                /* The argument was numbered last, the function before it */
+                work_pop(&w);
+                res = _emit(ns, APPL, ns->len - f->depth, 1);
+                break;
+        }
+    }
+
+    work_free(&w);
+    return res;
+}
+
+static inline int _write_word(FILE *fp, unsigned int word) {
+    return fwrite(&word, sizeof(word), 1, fp) == 1 ? 0 : ERR_FILE_ACTION;
+}
+
+/**
+ * @brief Write `expr` & the names of every interned symbol to `fp`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int img_write(expr_t *expr, FILE *fp) {
+    if (expr == NULL || fp == NULL)
+        return ERR_INP;
+
+    int res;
+    img_nodes_t ns = { NULL, 0, 0 };
+    if ((res = _flatten(expr, &ns)) < 0)
+        goto cleanup_nodes;
+
+    unsigned int nsyms = sym_count();
+    unsigned int names_len = 0;
+    for (unsigned int i = 0; i < nsyms; i++)
+        names_len += strlen(sym_name(i)) + 1;
+
+    res = ERR_FILE_ACTION;
+    if (fwrite(IMG_MAGIC, 4, 1, fp) != 1)
+        goto cleanup_nodes;
+
+    if ((res = _write_word(fp, IMG_VERSION)) < 0 ||
+            (res = _write_word(fp, nsyms)) < 0 ||
+            (res = _write_word(fp, ns.len)) < 0 ||
+            (res = _write_word(fp, names_len)) < 0)
+        goto cleanup_nodes;
+
+    unsigned int off = 0;
+    for (unsigned int i = 0; i < nsyms; i++) {
+        if ((res = _write_word(fp, off)) < 0)
+            goto cleanup_nodes;
+
+        off += strlen(sym_name(i)) + 1;
+    }
+
+    if ((res = _write_word(fp, off)) < 0)
+        goto cleanup_nodes;
+
+    res = ERR_FILE_ACTION;
+    if (fwrite(ns.nodes, sizeof(img_node_t), ns.len, fp) != ns.len)
+        goto cleanup_nodes;
+
+    for (unsigned int i = 0; i < nsyms; i++) {
+        if (fputs(sym_name(i), fp) == EOF || fputc('\0', fp) == EOF)
+            goto cleanup_nodes;
+    }
+
+    res = 0;
+
+cleanup_nodes:
+    free(ns.nodes);
+    return res;
+}
+
+/**
+ * @brief Check for the image magic, leaving `fp` at its start
+ *
+ * @return 1 if `fp` holds an image, 0 otherwise
+ */
+int img_is_image(FILE *fp) {
+    /* As with bytecode, no source file starts with the magic's first byte */
+    int ch;
+    if ((ch = fgetc(fp)) != IMG_MAGIC[0]) {
+        if (ch != EOF)
+            ungetc(ch, fp);
+        return 0;
+    }
+
+    char magic[3];
+    int res = fread(magic, sizeof(magic), 1, fp) == 1 &&
+        memcmp(magic, IMG_MAGIC + 1, sizeof(magic)) == 0;
+
+    rewind(fp);
+    return res;
+}
+
+/**
+ * @brief Hand the node `dist` before node `i` to its parent
+ *
+ * @return 0 on success, ERR_CORRUPT if there is no such node or it already
+ *         has a parent
+ */
+static int _claim(img_built_t *built, unsigned int i, unsigned int dist,
+        expr_t **slot, unsigned int *free) {
+    if (dist == 0 || dist > i || built[i - dist].expr == NULL)
+        return ERR_CORRUPT;
+
+    *slot = built[i - dist].expr;
+    *free = built[i - dist].free;
+    built[i - dist].expr = NULL;
+    return 0;
+}
+
+/**
+ * @brief Build the term held by the `len` bytes of `img`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _build(const unsigned char *img, size_t len, expr_t **out) {
+    const unsigned int *words = (const unsigned int *)img;
+    if (len < IMG_HEADER_WORDS * sizeof(unsigned int) ||
+            memcmp(img, IMG_MAGIC, 4) != 0 || words[1] != IMG_VERSION)
+        return ERR_CORRUPT;
+
+    unsigned int nsyms = words[2], nnodes = words[3], names_len = words[4];
+
+    /* Sized in 64 bits so that no count can wrap the total around */
+    unsigned long long want = (IMG_HEADER_WORDS + nsyms + 1ULL) *
+        sizeof(unsigned int) + (unsigned long long)nnodes *
+        sizeof(img_node_t) + names_len;
+    if (nnodes == 0 || want != len)
+        return ERR_CORRUPT;
+
+    const unsigned int *offs = words + IMG_HEADER_WORDS;
+    const img_node_t *nodes = (const img_node_t *)(offs + nsyms + 1);
+    const char *names = (const char *)(nodes + nnodes);
+    if (offs[0] != 0 || offs[nsyms] != names_len)
+        return ERR_CORRUPT;
+
+    int res;
+    sym_t *syms;
+    if ((syms = malloc((nsyms + 1) * sizeof(sym_t))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    for (unsigned int i = 0; i < nsyms; i++) {
+        if (offs[i + 1] <= offs[i] || offs[i + 1] > names_len ||
+                offs[i + 1] - offs[i] - 1 > MAX_VAR_LEN ||
+                names[offs[i + 1] - 1] != '\0') {
+            res = ERR_CORRUPT;
+            goto cleanup_syms;
+        }
+
+        if ((res = sym_intern_n(names + offs[i], offs[i + 1] - offs[i] - 1,
+                        &syms[i])) < 0)
+            goto cleanup_syms;
+    }
+
+    img_built_t *built;
+    if ((built = calloc(nnodes, sizeof(img_built_t))) == NULL) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup_syms;
+    }
+
+    /* Each node is allocated before its children are claimed, so anything
+     * built so far is always reachable from `built` */
+    unsigned int i, claimed = 0, ffree, xfree;
+    expr_t *e;
+    for (i = 0; i < nnodes; i++) {
+        const img_node_t *n = &nodes[i];
+        res = ERR_CORRUPT;
+        switch (n->type) {
+            case (VAR):
+                if (n->a >= nnodes || n->b >= nsyms)
+                    goto cleanup_built;
+
+                if ((e = new_var(n->a, syms[n->b])) == NULL)
+                    goto cleanup_mem;
+
+                built[i].expr = e;
+                built[i].free = n->a + 1;
+                break;
+            case (LAMBDA):
+                if (n->a >= nsyms)
+                    goto cleanup_built;
+
+                if ((e = new_lam(syms[n->a], NULL)) == NULL)
+                    goto cleanup_mem;
+
+                built[i].expr = e;
+                if ((res = _claim(built, i, n->b, &e->lam.body, &ffree)) < 0)
+                    goto cleanup_built;
+
+                built[i].free = ffree > 0 ? ffree - 1 : 0;
+                claimed++;
+                break;
+            case (APPL):
+                if ((e = new_appl(NULL, NULL)) == NULL)
+                    goto cleanup_mem;
+
+                built[i].expr = e;
+                if ((res = _claim(built, i, n->a, &e->appl.f, &ffree)) < 0 ||
+                        (res = _claim(built, i, n->b, &e->appl.x, &xfree)) < 0)
+                    goto cleanup_built;
+
+                built[i].free = ffree > xfree ? ffree : xfree;
+                claimed += 2;
+                break;
+            default:
+                goto cleanup_built;
+        }
+    }
+
+    /* References only point backwards, so the last node is never claimed &
+     * every other node must have been, exactly once, to form a single
+     * closed tree */
+    if (claimed != nnodes - 1 || built[nnodes - 1].free != 0) {
+        res = ERR_CORRUPT;
+        goto cleanup_built;
+    }
+
+    *out = built[nnodes - 1].expr;
+    res = 0;
+    goto cleanup_array;
+
+cleanup_mem:
+    res = ERR_MEM_ALLOC;
+
+cleanup_built:
+    for (i = 0; i < nnodes; i++) {
+        if (built[i].expr != NULL)
+            free_expr(built[i].expr);
+    }
+
+cleanup_array:
+    free(built);
+
+cleanup_syms:
+    free(syms);
+    return res;
+}
+
+/**
+ * @brief Read all of a stream that can't be mapped
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _read_all(FILE *fp, unsigned char **out, size_t *len) {
+    size_t cap = 0x1000, n;
+    unsigned char *buf, *grown;
+    if ((buf = malloc(cap)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    *len = 0;
+    while ((n = fread(buf + *len, 1, cap - *len, fp)) > 0) {
+        *len += n;
+        if (*len < cap)
+            continue;
+
+        if ((grown = realloc(buf, cap * 2)) == NULL) {
+            free(buf);
+            return ERR_MEM_ALLOC;
+        }
+
+        buf = grown;
+        cap *= 2;
+    }
+
+    *out = buf;
+    return 0;
+}
+
+/**
+ * @brief Load a term written by `img_write`
+ *
+ * @param fp Positioned at the magic. A regular file is mapped as a whole
+ * @param out Freshly built term on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int img_load(FILE *fp, expr_t **out) {
+    if (fp == NULL || out == NULL)
+        return ERR_INP;
+
+    int res;
+#ifdef IMG_MMAP
+    struct stat st;
+    int fd = fileno(fp);
+    void *map;
+    if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > 0 && (map = mmap(NULL, st.st_size, PROT_READ,
+                    MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+        /* Read front to back exactly once */
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        res = _build(map, st.st_size, out);
+        munmap(map, st.st_size);
+        return res;
+    }
+#endif
+
+    unsigned char *buf;
+    size_t len;
+    if ((res = _read_all(fp, &buf, &len)) < 0)
+        return res;
+
+    res = _build(buf, len, out);
+    free(buf);
+    return res;
+}
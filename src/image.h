@@ -0,0 +1,56 @@
+/**
+ * @file image.h
+ *
+ * @brief Precompiled term images
+ *
+ * A parsed term can be written to a file & loaded back without lexing or
+ * parsing it again. The file is laid out so that it can be mapped & read
+ * in place, all words in host byte order:
+ *
+ *   "LCTM", version, symbol count, node count, name bytes
+ *   name offsets   (symbol count + 1 words into the names)
+ *   nodes          (node count `img_node_t`s, children before parents)
+ *   names          (NUL terminated)
+ *
+ * Children are referred to by their distance back from their parent, so the
+ * last node is the root & every reference points strictly backwards.
+ *
+ * Loading skips the lexer & parser but still builds an ordinary `expr_t`
+ * tree from the node array & interns each name once. Engines can't run on
+ * the mapped nodes themselves: they rewrite & free the tree in the AST
+ * arena, & symbols are numbered per process, not per image.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include <stdio.h>
+
+#include "ast.h"
+
+#define IMG_MAGIC "LCTM"
+#define IMG_VERSION (1)
+
+/* Words before the name offsets */
+#define IMG_HEADER_WORDS (5)
+
+/**
+ * @brief One term node, `type` is an `_expr_e`
+ *
+ *   VAR     a = de Bruijn index  b = symbol
+ *   LAMBDA  a = symbol           b = distance back to the body
+ *   APPL    a = distance back to the function, b = to the argument
+ */
+typedef struct _img_node {
+    unsigned int type;
+    unsigned int a;
+    unsigned int b;
+} img_node_t;
+
+int img_write(expr_t *expr, FILE *fp);
+int img_is_image(FILE *fp);
+int img_load(FILE *fp, expr_t **out);
+
+#endif /* _IMAGE_H_ */
@@ -0,0 +1,685 @@
+/**
+ * @file inet.c
+ *
+ * @brief Interaction net implementation
+ *
+ * Every node has a principal port (0) & two auxiliary ports (1 & 2), save
+ * erasers which only use their principal port. Lambdas & applications share
+ * one node kind: a lambda's ports are (itself, variable, body), an
+ * application's are (function, argument, result), so a beta redex is simply
+ * two such nodes meeting on their principal ports. A variable used more than
+ * once is shared through a tree of fans, each given a fresh label, & an
+ * unused variable is plugged with an eraser.
+ *
+ * Reduction rewrites active pairs (two principal ports wired together):
+ * nodes of the same kind annihilate, nodes of different kinds commute past
+ * each other, copying both. Each rewrite is local & touches only the pair &
+ * its immediate wires, so the pairs on the redex stack are independent & the
+ * loop could be split across threads; here it runs them one at a time.
+ *
+ * Without the oracle of Lamping's full algorithm fans are only matched
+ * correctly for terms typable in elementary affine logic, which covers
+ * Church numeral arithmetic but not every term. Nets which cannot be read
+ * back are reported as ERR_CORRUPT. Every active pair is reduced, including
+ * those in discarded arguments, so a diverging argument that is never used
+ * still diverges here, & nets outside that logic may grow without end.
+ * Callers bound the reduction through a check run before every rewrite.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <err.h>
+
+#include "inet.h"
+#include "work.h"
+
+typedef enum _kind_e {
+    K_FREE,
+    K_ROOT,
+    K_ERA,
+    K_CON,
+
+    /* Fans with label `n` have kind `K_FAN + n` */
+    K_FAN
+} kind_e;
+
+typedef struct _inode {
+    /* Port (`node << 2 | slot`) each of this node's ports is wired to */
+    unsigned int port[3];
+
+    /* See `_kind_e`, free nodes keep the next free node in `port[0]` */
+    unsigned int kind;
+
+    /* Lambdas only, cosmetic */
+    sym_t sym;
+} inode_t;
+
+#define PORT(node, slot) (((node) << 2) | (slot))
+#define NODE(port) ((port) >> 2)
+#define SLOT(port) ((port) & 3)
+
+/* Nodes of the current net, node 0 is the root */
+static inode_t *_net = NULL;
+static unsigned int _net_cap = 0;
+static unsigned int _net_used = 0;
+static unsigned int _net_free = 0;
+
+/* Active pairs waiting to be rewritten, two node indices per pair */
+static unsigned int *_redex = NULL;
+static unsigned int _redex_len = 0;
+static unsigned int _redex_cap = 0;
+
+/* Last fan label handed out */
+static unsigned int _label = 0;
+
+/* Rewrites performed by the last normalization */
+static unsigned long _rewrites = 0;
+
+/* Nodes in use, the root included */
+static unsigned int _net_live = 0;
+
+/* Set once an allocation fails, checked by the rewrite loop */
+static int _net_err = 0;
+
+static unsigned int _node(unsigned int kind) {
+    unsigned int res;
+    if (_net_free != 0) {
+        res = _net_free;
+        _net_free = _net[res].port[0];
+    } else {
+        if (_net_used == _net_cap) {
+            unsigned int cap = _net_cap * 2;
+            inode_t *net;
+
+            /* Ports hold node indices shifted past their slot */
+            if (cap > NODE(~0u) + 1 ||
+                    (net = realloc(_net, cap * sizeof(inode_t))) == NULL) {
+                _net_err = ERR_MEM_ALLOC;
+                return 0;
+            }
+
+            _net = net;
+            _net_cap = cap;
+        }
+
+        res = _net_used++;
+    }
+
+    _net[res].kind = kind;
+    _net[res].sym = 0;
+    _net_live++;
+    return res;
+}
+
+static inline void _release(unsigned int node) {
+    _net[node].kind = K_FREE;
+    _net[node].port[0] = _net_free;
+    _net_free = node;
+    _net_live--;
+}
+
+static inline unsigned int _enter(unsigned int port) {
+    return _net[NODE(port)].port[SLOT(port)];
+}
+
+static void _push_redex(unsigned int a, unsigned int b) {
+    if (_redex_len + 2 > _redex_cap) {
+        unsigned int cap = _redex_cap == 0 ? 0x100 : _redex_cap * 2;
+        unsigned int *redex;
+        if ((redex = realloc(_redex, cap * sizeof(unsigned int))) == NULL) {
+            _net_err = ERR_MEM_ALLOC;
+            return;
+        }
+
+        _redex = redex;
+        _redex_cap = cap;
+    }
+
+    _redex[_redex_len++] = a;
+    _redex[_redex_len++] = b;
+}
+
+/**
+ * @brief Wire two ports together, recording the pair if it becomes active
+ */
+static void _link(unsigned int a, unsigned int b) {
+    _net[NODE(a)].port[SLOT(a)] = b;
+    _net[NODE(b)].port[SLOT(b)] = a;
+
+    if (SLOT(a) == 0 && SLOT(b) == 0 &&
+            _net[NODE(a)].kind != K_ROOT && _net[NODE(b)].kind != K_ROOT)
+        _push_redex(NODE(a), NODE(b));
+}
+
+/**
+ * @brief Same kinds meet: wire the neighbours of `x` to those of `y`
+ */
+static void _annihilate(unsigned int x, unsigned int y) {
+    /* Partners are re-read after each link in case `x` & `y` share a wire */
+    _link(_enter(PORT(x, 1)), _enter(PORT(y, 1)));
+    _link(_enter(PORT(x, 2)), _enter(PORT(y, 2)));
+    _release(x);
+    _release(y);
+}
+
+/**
+ * @brief Different kinds meet: each is copied past the other
+ */
+static void _commute(unsigned int x, unsigned int y) {
+    unsigned int a, b;
+    if ((a = _node(_net[x].kind)) == 0 || (b = _node(_net[y].kind)) == 0)
+        return;
+
+    _net[a].sym = _net[x].sym;
+    _net[b].sym = _net[y].sym;
+
+    _link(PORT(b, 0), _enter(PORT(x, 1)));
+    _link(PORT(y, 0), _enter(PORT(x, 2)));
+    _link(PORT(a, 0), _enter(PORT(y, 1)));
+    _link(PORT(x, 0), _enter(PORT(y, 2)));
+    _link(PORT(a, 1), PORT(b, 1));
+    _link(PORT(a, 2), PORT(y, 1));
+    _link(PORT(x, 1), PORT(b, 2));
+    _link(PORT(x, 2), PORT(y, 2));
+}
+
+/**
+ * @brief An eraser meets a binary node: erase both of its neighbours
+ */
+static void _erase(unsigned int era, unsigned int x) {
+    unsigned int p1 = _enter(PORT(x, 1)), p2 = _enter(PORT(x, 2));
+    if (p1 == PORT(x, 2)) {
+        /* The node's auxiliary ports only lead to each other */
+        _release(era);
+        _release(x);
+        return;
+    }
+
+    unsigned int other;
+    if ((other = _node(K_ERA)) == 0)
+        return;
+
+    _release(x);
+    _link(PORT(era, 0), p1);
+    _link(PORT(other, 0), p2);
+}
+
+static void _rewrite(unsigned int x, unsigned int y) {
+    _rewrites++;
+    if (_net[x].kind == K_ERA && _net[y].kind == K_ERA) {
+        _release(x);
+        _release(y);
+    } else if (_net[x].kind == K_ERA) {
+        _erase(x, y);
+    } else if (_net[y].kind == K_ERA) {
+        _erase(y, x);
+    } else if (_net[x].kind == _net[y].kind) {
+        _annihilate(x, y);
+    } else {
+        _commute(x, y);
+    }
+}
+
+/**
+ * @brief Compile `expr` into the net. Each node is wired to the port its
+ *        parent left for it on the way down, so subterms are compiled from a
+ *        work stack in the order a recursive compiler would take
+ *
+ * @param scope Lambda node of each enclosing binder, outermost first
+ * @param target Port the value of `expr` is wired to
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _encode(expr_t *expr, unsigned int *scope, unsigned int target) {
+    work_t w;
+    work_init(&w);
+
+    int res = 0;
+    unsigned int node, era, port, fan, depth = 0;
+    for (;;) {
+        switch (expr->type) {
+            case (VAR):
+                if (expr->var.index >= depth)
+                    goto corrupt;
+
+                node = scope[depth - 1 - expr->var.index];
+                port = _enter(PORT(node, 1));
+                if (_net[NODE(port)].kind == K_ERA) {
+                    /* First use takes the eraser's place */
+                    _release(NODE(port));
+                    _link(target, PORT(node, 1));
+                    break;
+                }
+
+                /* Later uses share the variable through a fresh fan */
+                if ((fan = _node(K_FAN + ++_label)) == 0)
+                    goto corrupt;
+
+                _link(PORT(fan, 1), port);
+                _link(PORT(fan, 0), PORT(node, 1));
+                _link(target, PORT(fan, 2));
+                break;
+            case (LAMBDA):
+                if ((node = _node(K_CON)) == 0 || (era = _node(K_ERA)) == 0)
+                    goto corrupt;
+
+                _net[node].sym = expr->lam.sym;
+                _link(PORT(node, 1), PORT(era, 0));
+                _link(target, PORT(node, 0));
+                scope[depth++] = node;
+                expr = expr->lam.body;
+                target = PORT(node, 2);
+                continue;
+            case (APPL):
+                if ((node = _node(K_CON)) == 0)
+                    goto corrupt;
+
+                _link(target, PORT(node, 2));
+                if ((res = work_push(&w, expr->appl.x, NULL, depth,
+                                PORT(node, 1))) < 0)
+                    goto cleanup;
+
+                expr = expr->appl.f;
+                target = PORT(node, 0);
+                continue;
+            default:
+                goto corrupt;
+        }
+
+        if (work_empty(&w))
+            goto cleanup;
+
+        work_frame_t frame = work_pop(&w);
+        expr = frame.expr;
+        depth = frame.depth;
+        target = frame.state;
+    }
+
+corrupt:
+    res = _net_err != 0 ? _net_err : ERR_CORRUPT;
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Deepest lambda nesting in `expr`, bounding the encoder's scope
+ *
+ * @return The nesting on success, ERR_* otherwise
+ */
+static long _lam_depth(expr_t *expr) {
+    work_t w;
+    work_init(&w);
+
+    long res = 0;
+    unsigned int depth = 0;
+    for (;;) {
+        switch (expr->type) {
+            case (LAMBDA):
+                if (++depth > res)
+                    res = depth;
+
+                expr = expr->lam.body;
+                continue;
+            case (APPL):
+                if (work_push(&w, expr->appl.x, NULL, depth, 0) < 0) {
+                    res = ERR_MEM_ALLOC;
+                    goto cleanup;
+                }
+
+                expr = expr->appl.f;
+                continue;
+            default:
+                break;
+        }
+
+        if (work_empty(&w))
+            break;
+
+        work_frame_t frame = work_pop(&w);
+        expr = frame.expr;
+        depth = frame.depth;
+    }
+
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief A fan port walked in through on the way to a subterm. The ports
+ *        form a persistent stack, so every subterm still to be read back
+ *        keeps the one it was reached with
+ */
+typedef struct _exit {
+    unsigned int slot;
+
+    /* 1 + index of the next port in, 0 at the bottom */
+    unsigned int next;
+} exit_t;
+
+/**
+ * @brief A subterm still to be read back
+ */
+typedef struct _pending {
+    unsigned int port;
+    unsigned int depth;
+    unsigned int exit;
+    expr_t **slot;
+
+    /* Fan ports in use when it was put off, later ones are only used by
+     * the walk in progress */
+    unsigned int mark;
+} pending_t;
+
+/* `up` of a fan whose principal port doesn't lead straight to a binder */
+#define UP_NONE (~0u)
+
+/* `up` of a fan whose climb is still being followed */
+#define UP_BUSY (~0u - 1)
+
+/**
+ * @brief Read-back state: the binder depth of each lambda node met so far,
+ *        the fan ports walked in through & the subterms still to be read
+ *        back
+ */
+typedef struct _decode {
+    unsigned int *depth;
+
+    /* Lambda whose variable each fan's principal port climbs to, through
+     * the auxiliary ports of further fans only, 0 until looked up */
+    unsigned int *up;
+
+    exit_t *exit;
+    unsigned int exit_len;
+    unsigned int exit_cap;
+
+    pending_t *todo;
+    unsigned int todo_len;
+    unsigned int todo_cap;
+} decode_t;
+
+/**
+ * @brief Walk in through the auxiliary port `slot` of a fan
+ *
+ * @return The new top of the exit stack, 0 on failure
+ */
+static unsigned int _exit_push(decode_t *dec, unsigned int slot,
+        unsigned int exit) {
+    if (dec->exit_len == dec->exit_cap) {
+        unsigned int cap = dec->exit_cap == 0 ? 0x40 : dec->exit_cap * 2;
+        exit_t *cells;
+        if ((cells = realloc(dec->exit, cap * sizeof(exit_t))) == NULL)
+            return 0;
+
+        dec->exit = cells;
+        dec->exit_cap = cap;
+    }
+
+    dec->exit[dec->exit_len].slot = slot;
+    dec->exit[dec->exit_len].next = exit;
+    return ++dec->exit_len;
+}
+
+/**
+ * @brief Find the lambda whose variable is reached by leaving `fan` through
+ *        its principal port & climbing through fans from then on. Such a
+ *        climb ends at the variable whatever ports were walked in through,
+ *        so it is only taken once per fan rather than once per use of the
+ *        variable, which would be quadratic along a chain of fans
+ *
+ * @return The lambda node, UP_NONE if the climb meets anything else
+ */
+static unsigned int _climb(decode_t *dec, unsigned int fan) {
+    unsigned int node, port, res = fan;
+    while (dec->up[res] == 0) {
+        dec->up[res] = UP_BUSY;
+        port = _enter(PORT(res, 0));
+        node = NODE(port);
+        if (_net[node].kind == K_CON && SLOT(port) == 1) {
+            dec->up[res] = node;
+        } else if (_net[node].kind >= K_FAN && SLOT(port) != 0) {
+            res = node;
+        } else {
+            dec->up[res] = UP_NONE;
+        }
+    }
+
+    /* Settle every fan climbed through on the way, a climb that came back
+     * to one of them is going round in circles */
+    res = dec->up[res] == UP_BUSY ? UP_NONE : dec->up[res];
+    while (dec->up[fan] == UP_BUSY) {
+        dec->up[fan] = res;
+        fan = NODE(_enter(PORT(fan, 0)));
+    }
+
+    return res;
+}
+
+/**
+ * @brief Put a subterm off until the current one has been read back
+ *
+ * @return 0 on success, ERR_MEM_ALLOC otherwise
+ */
+static int _todo_push(decode_t *dec, unsigned int port, unsigned int depth,
+        unsigned int exit, expr_t **slot) {
+    if (dec->todo_len == dec->todo_cap) {
+        unsigned int cap = dec->todo_cap == 0 ? 0x40 : dec->todo_cap * 2;
+        pending_t *todo;
+        if ((todo = realloc(dec->todo, cap * sizeof(pending_t))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        dec->todo = todo;
+        dec->todo_cap = cap;
+    }
+
+    dec->todo[dec->todo_len++] = (pending_t){ port, depth, exit, slot,
+        dec->exit_len };
+    return 0;
+}
+
+/**
+ * @brief Read back the term found by walking into `port`. The tree is built
+ *        top down, each subterm filling in the slot its parent left for it,
+ *        & the function of an application is read back before its argument
+ *
+ * @param check As for `inet_normalize`, charged the term nodes built & fan
+ *        ports held, since a net the rewrites got wrong may never finish
+ *        reading back
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _decode(decode_t *dec, unsigned int port,
+        int (*check)(unsigned long, unsigned long), expr_t **out) {
+    int res;
+    unsigned long built = 0;
+    unsigned int node, slot, depth = 0, exit = 0;
+    expr_t **dst = out;
+
+    *out = NULL;
+    for (;;) {
+        if (check != NULL &&
+                (res = check(_rewrites, built + dec->exit_len)) < 0)
+            goto fail;
+
+        built++;
+        node = NODE(port);
+        slot = SLOT(port);
+
+        if (_net[node].kind == K_CON && slot == 0) {
+            dec->depth[node] = depth;
+            if ((*dst = new_lam(_net[node].sym, NULL)) == NULL)
+                goto oom;
+
+            dst = &(*dst)->lam.body;
+            port = _enter(PORT(node, 2));
+            depth++;
+            continue;
+        } else if (_net[node].kind == K_CON && slot == 2) {
+            if ((*dst = new_appl(NULL, NULL)) == NULL ||
+                    _todo_push(dec, _enter(PORT(node, 1)), depth, exit,
+                        &(*dst)->appl.x) < 0)
+                goto oom;
+
+            dst = &(*dst)->appl.f;
+            port = _enter(PORT(node, 0));
+            continue;
+        } else if (_net[node].kind >= K_FAN && slot != 0 &&
+                _climb(dec, node) != UP_NONE) {
+            node = dec->up[node];
+        } else if (_net[node].kind >= K_FAN && slot != 0) {
+            /* Leave through the principal port, remembering the way in */
+            if ((exit = _exit_push(dec, slot, exit)) == 0)
+                goto oom;
+
+            port = _enter(PORT(node, 0));
+            continue;
+        } else if (_net[node].kind >= K_FAN) {
+            /* Leave through the auxiliary port matching the way in */
+            if (exit == 0)
+                goto corrupt;
+
+            unsigned int top = exit;
+            port = _enter(PORT(node, dec->exit[top - 1].slot));
+            exit = dec->exit[top - 1].next;
+
+            /* Reuse the port's cell unless a pending subterm shares it */
+            if (top == dec->exit_len && (dec->todo_len == 0 ||
+                        top > dec->todo[dec->todo_len - 1].mark))
+                dec->exit_len--;
+            continue;
+        } else if (_net[node].kind != K_CON) {
+            /* Erasers & the root are never part of a readable normal form */
+            goto corrupt;
+        }
+
+        /* Reached a lambda's variable port from one of its uses */
+        if (dec->depth[node] >= depth)
+            goto corrupt;
+
+        if ((*dst = new_var(depth - 1 - dec->depth[node], 0)) == NULL)
+            goto oom;
+
+        if (dec->todo_len == 0)
+            return 0;
+
+        pending_t *next = &dec->todo[--dec->todo_len];
+        port = next->port;
+        depth = next->depth;
+        exit = next->exit;
+        dst = next->slot;
+        dec->exit_len = next->mark;
+    }
+
+oom:
+    res = ERR_MEM_ALLOC;
+    goto fail;
+corrupt:
+    res = ERR_CORRUPT;
+fail:
+    free_expr(*out);
+    *out = NULL;
+    return res;
+}
+
+static void _net_free_all() {
+    free(_net);
+    free(_redex);
+    _net = NULL;
+    _redex = NULL;
+    _net_cap = _net_used = _net_free = 0;
+    _redex_len = _redex_cap = 0;
+}
+
+/**
+ * @brief Compute the normal form of `expr` by optimal reduction, `expr` is
+ *        left untouched
+ *
+ * @param expr Closed term being normalized
+ * @param check Called with the rewrites so far & the live nodes before each
+ *        rewrite, & with the nodes built so far while reading back, stops
+ *        the normalization with its error once it returns one. May be NULL
+ * @param out Freshly allocated normal form on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int inet_normalize(expr_t *expr, int (*check)(unsigned long, unsigned long),
+        expr_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    _net_cap = INET_INIT_NODES;
+    if ((_net = malloc(_net_cap * sizeof(inode_t))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    _net_used = _net_free = _net_live = _redex_len = _label = 0;
+    _rewrites = 0;
+    _net_err = 0;
+
+    int res = 0;
+    long nest;
+    unsigned int *scope, root;
+    decode_t dec = { 0 };
+    if ((nest = _lam_depth(expr)) < 0) {
+        res = (int)nest;
+        goto cleanup_net;
+    }
+
+    if ((scope = malloc((nest + 1) * sizeof(unsigned int))) == NULL) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup_net;
+    }
+
+    /* The root's only port is wired to the whole term */
+    root = _node(K_ROOT);
+    res = _encode(expr, scope, PORT(root, 0));
+    free(scope);
+    if (res == 0 && _net_err != 0)
+        res = _net_err;
+
+    if (res < 0)
+        goto cleanup_net;
+
+    while (_redex_len > 0 && _net_err == 0) {
+        if (check != NULL && (res = check(_rewrites, _net_live)) < 0)
+            goto cleanup_net;
+
+        unsigned int y = _redex[--_redex_len];
+        unsigned int x = _redex[--_redex_len];
+        _rewrite(x, y);
+    }
+
+    if ((res = _net_err) < 0)
+        goto cleanup_net;
+
+    if ((dec.depth = malloc(_net_used * sizeof(unsigned int))) == NULL ||
+            (dec.up = calloc(_net_used, sizeof(unsigned int))) == NULL) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup_dec;
+    }
+
+    /* Marks lambdas the walk has not passed yet */
+    memset(dec.depth, 0xff, _net_used * sizeof(unsigned int));
+
+    res = _decode(&dec, _enter(PORT(root, 0)), check, out);
+
+cleanup_dec:
+    free(dec.depth);
+    free(dec.up);
+    free(dec.exit);
+    free(dec.todo);
+
+cleanup_net:
+    _net_free_all();
+    return res;
+}
+
+/**
+ * @brief Number of rewrites performed by the last `inet_normalize`
+ */
+unsigned long inet_rewrites() {
+    return _rewrites;
+}
@@ -0,0 +1,29 @@
+/**
+ * @file inet.h
+ *
+ * @brief Optimal reduction on interaction nets
+ *
+ * Terms are compiled into a net of lambda/application, fan & eraser nodes
+ * & reduced with Lamping's abstract algorithm (without the bookkeeping
+ * oracle). Sharing is never undone, so duplicated redexes - even under
+ * lambdas - are only ever reduced once.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _INET_H_
+#define _INET_H_
+
+#include "ast.h"
+
+/* Starting node capacity of a net */
+#define INET_INIT_NODES (0x400)
+
+/* Most live nodes a net may grow to unless a lower limit is asked for */
+#define INET_MAX_NODES (0x1000000)
+
+int inet_normalize(expr_t *expr, int (*check)(unsigned long, unsigned long),
+        expr_t **out);
+unsigned long inet_rewrites();
+
+#endif /* _INET_H_ */
@@ -7,54 +7,176 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <err.h>
 
 #include "lexer.h"
 #include "parser.h"
 #include "ast.h"
+#include "work.h"
+#include "hcons.h"
+#include "machine.h"
+#include "nbe.h"
+#include "inet.h"
+#include "bytecode.h"
+#include "vm.h"
+#include "jit.h"
+#include "interpreter.h"
 
 const char *interp_prompt = "\x1B[34m\xCE\xBB.>\033[0m ";
 int step_expr(expr_t *expr);
 
+/* Indexed by `_engine_e` */
+static const char *_engine_names[] = {
+    "step",
+    "hcons",
+    "krivine",
+    "cek",
+    "need",
+    "nbe",
+    "inet",
+    "vm",
+    "jit"
+};
+
 /**
- * @brief Propagate substitution through expression. We provide a double 
- *        pointer because we need to replace var expression structs once 
- *        we encounter them.
+ * @brief Look up an engine by its command line name
+ *
+ * @return 0 on success, ERR_INP if there is no such engine
+ */
+int engine_from_name(const char *name, engine_e *out) {
+    int count = sizeof(_engine_names) / sizeof(_engine_names[0]);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, _engine_names[i]) == 0) {
+            *out = (engine_e)i;
+            return 0;
+        }
+    }
+
+    return ERR_INP;
+}
+
+/**
+ * @brief Shift the free variables of an expression in place. A variable is
+ *        free when its index reaches past the lambdas within `expr`
+ *
+ * @param expr The expression being shifted
+ * @param d Amount added to every free variable's index
+ * @param cutoff Number of lambdas between `expr` & the root of the shift
+ *
+ * @return 0 on success, ERR_* othewise
+ */
+int shift_expr(expr_t *expr, unsigned int d, unsigned int cutoff) {
+    work_t w;
+    work_init(&w);
+
+    int res = 0;
+    for (;;) {
+        switch (expr->type) {
+            case (VAR):
+                if (expr->var.index >= cutoff)
+                    expr->var.index += d;
+                break;
+            case (LAMBDA):
+                expr = expr->lam.body;
+                cutoff++;
+                continue;
+            case (APPL):
+                if ((res = work_push(&w, expr->appl.x, NULL, cutoff, 0)) < 0)
+                    goto cleanup;
+
+                expr = expr->appl.f;
+                continue;
+            default:
+                res = ERR_BAD_PARSE;
+                goto cleanup;
+        }
+
+        if (work_empty(&w))
+            break;
+
+        work_frame_t f = work_pop(&w);
+        expr = f.expr;
+        cutoff = f.depth;
+    }
+
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Propagate substitution through the body of a lambda being applied.
+ *        We provide a double pointer because we need to replace var
+ *        expression structs once we encounter them.
  *
  * @param expr The expression where substitution is happening
- * @param id The id of the variable we are substituting into 
+ * @param k The index of the variable we are substituting into, i.e. the
+ *        number of lambdas between `expr` & the lambda being applied
  * @param x the new data being substituted in
  *
  * @return 0 on success, ERR_* othewise
  */
-int subst_var(expr_t **expr, unsigned int id, expr_t *x) {
-    int res;
-    switch ((*expr)->type) {
-        case (VAR):
-            if (((var_t *)((*expr)->data))->id == id) {
-                free_expr(*expr);
-                *expr = deep_copy_expr(x);
-            } 
-            return 0;
-        case (LAMBDA):
-            return subst_var(((expr_t **)&((lam_t *)(*expr)->data)->body), 
-                    id, x);
-        case (APPL):
-            if ((res = subst_var(((expr_t **)&((appl_t *)(*expr)->data)->f), 
-                    id, x)) < 0)
-                return res;
-            return subst_var(((expr_t **)&((appl_t *)(*expr)->data)->x), 
-                    id, x);
-        default:
-            return ERR_BAD_PARSE;
+int subst_var(expr_t **expr, unsigned int k, expr_t *x) {
+    work_t w;
+    work_init(&w);
+
+    int res = 0;
+    for (;;) {
+        switch ((*expr)->type) {
+            case (VAR):
+                if ((*expr)->var.index == k) {
+                    free_expr(*expr);
+                    if ((*expr = deep_copy_expr(x)) == NULL) {
+                        res = ERR_MEM_ALLOC;
+                        goto cleanup;
+                    }
+
+                    /* `x` was free in the context of the application, which
+                     * is now `k` lambdas further out */
+                    if (k > 0 && (res = shift_expr(*expr, k, 0)) < 0)
+                        goto cleanup;
+                } else if ((*expr)->var.index > k) {
+                    /* The lambda being applied no longer sits between this
+                     * variable & its binder */
+                    (*expr)->var.index--;
+                }
+                break;
+            case (LAMBDA):
+                expr = &(*expr)->lam.body;
+                k++;
+                continue;
+            case (APPL):
+                if ((res = work_push(&w, NULL, &(*expr)->appl.x, k, 0)) < 0)
+                    goto cleanup;
+
+                expr = &(*expr)->appl.f;
+                continue;
+            default:
+                res = ERR_BAD_PARSE;
+                goto cleanup;
+        }
+
+        if (work_empty(&w))
+            break;
+
+        work_frame_t f = work_pop(&w);
+        expr = f.slot;
+        k = f.depth;
     }
+
+cleanup:
+    work_free(&w);
+    return res;
 }
 
 /**
- * @brief Apply an expression to another. The reason we don't pass the appl_t
- *        struct inside the expr_t struct is that it's contents will change,
- *        and we want the reference to reflect that change
+ * @brief Apply an expression to another. The application node is
+ *        overwritten in place with the contracted term, so references to it
+ *        reflect the change
  *
  * @param expr The application expressoin
  *
@@ -64,85 +186,822 @@ int appl_expr(expr_t *expr) {
     if (expr->type != APPL)
         return ERR_INP;
 
-    appl_t *appl = (appl_t *)expr->data;
+    int res;
+    appl_t *appl = &expr->appl;
     if (appl->f->type != LAMBDA)
-        if (step_expr(appl->f) == 1)
-            return step_expr(appl->x);
-
-    lam_t *lam = (lam_t *)appl->f->data;
+        return step_expr(expr);
 
-    unsigned int var_id = lam->var->id;
-
-    int res;
-    if ((res = subst_var(&lam->body, var_id, appl->x)) < 0) 
+    lam_t *lam = &appl->f->lam;
+    if ((res = subst_var(&lam->body, 0, appl->x)) < 0) 
         return res;
     
-    /* Replace expression data with new program data */
-    expr->type = lam->body->type; 
-    expr->data = lam->body->data; 
-    /* After this, our appl struct is appl(lam([unused var], NULL), [copied
-     * expr]), which we can safely free */
+    /* Swap the substituted body into the application node. After this,
+     * `body` holds appl(lam([unused var], NULL), [copied expr]), which we
+     * can safely free */
+    expr_t *body = lam->body;
     lam->body = NULL;
-    free_appl(appl);
+
+    expr_t tmp = *expr;
+    *expr = *body;
+    *body = tmp;
+    free_expr(body);
 
     return 0;
 }
 
 /**
- * @brief Single step input expression
+ * @brief Single step input expression, contracting the leftmost outermost
+ *        redex. Arguments are only searched once the function they are
+ *        applied to has no redex left, so those are kept on a work stack
  *
  * @param Expression to be stepped (will be modified)
  *
  * @return ERR_* on error, 0 on success, 1 if no step can be taken
  */
 int step_expr(expr_t *expr) {
-    switch (expr->type) {
-        case (VAR):
-            return 1;
-        case (LAMBDA):
-            return step_expr((expr_t *)((lam_t *)expr->data)->body);
-        case (APPL):
-            return appl_expr(expr);
+    work_t w;
+    work_init(&w);
+
+    int res = 1;
+    for (;;) {
+        switch (expr->type) {
+            case (VAR):
+                if (work_empty(&w))
+                    goto cleanup;
+
+                expr = work_pop(&w).expr;
+                continue;
+            case (LAMBDA):
+                expr = expr->lam.body;
+                continue;
+            case (APPL):
+                if (expr->appl.f->type == LAMBDA) {
+                    res = appl_expr(expr);
+                    goto cleanup;
+                }
+
+                if (work_push(&w, expr->appl.x, NULL, 0, 0) < 0) {
+                    res = ERR_MEM_ALLOC;
+                    goto cleanup;
+                }
+
+                expr = expr->appl.f;
+                continue;
+            default:
+                res = ERR_BAD_PARSE;
+                goto cleanup;
+        }
+    }
+
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Which child of a context node `normalize` is focused on
+ */
+typedef enum _ctx_e {
+    CTX_BODY,
+    CTX_FUNC,
+    CTX_ARG
+} ctx_e;
+
+/**
+ * @brief Where a strategy looks for redexes
+ */
+typedef struct _strategy_spec {
+    const char *name;
+
+    /* Reduce inside lambda bodies */
+    int under_lam;
+
+    /* Reduce the arguments of applications that can't be contracted */
+    int neutral_args;
+
+    /* Reduce function & argument before contracting, innermost first */
+    int strict;
+} strategy_spec_t;
+
+/* Indexed by `_strategy_e` */
+static const strategy_spec_t _strategies[] = {
+    { "normal",      1, 1, 0 },
+    { "applicative", 1, 1, 1 },
+    { "cbv",         0, 1, 1 },
+    { "cbn",         0, 1, 0 },
+    { "whnf",        0, 0, 0 },
+    { "hnf",         1, 0, 0 }
+};
+
+/* Beta steps taken by the last `normalize` */
+static unsigned long _norm_steps = 0;
+
+/* Nodes of the copy TRACE_LAST replays, which the budget doesn't charge */
+static unsigned long _ast_reserved = 0;
+
+/* The clock is only read this often, it's comparatively slow */
+#define BUDGET_CLOCK_EVERY (0x100)
+
+/* Which limit the last ERR_BUDGET ran into */
+static const char *_budget_hit = NULL;
+
+/**
+ * @brief Milliseconds elapsed since `start`
+ */
+static unsigned long _millis_since(const struct timespec *start) {
+    struct timespec now;
+    timespec_get(&now, TIME_UTC);
+    return (unsigned long)(now.tv_sec - start->tv_sec) * 1000 +
+        (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/**
+ * @brief Check an evaluation that has taken `steps` steps against `budget`
+ *
+ * @param nodes Nodes live right now
+ * @param start When the evaluation began
+ *
+ * @return 0 while within budget, ERR_BUDGET once a limit is passed
+ */
+static int _budget_check(const budget_t *budget, unsigned long steps,
+        unsigned long nodes, const struct timespec *start) {
+    if (budget == NULL)
+        return 0;
+
+    if (budget->steps > 0 && steps >= budget->steps)
+        _budget_hit = "step";
+    else if (budget->nodes > 0 && nodes > budget->nodes)
+        _budget_hit = "node";
+    else if (budget->millis > 0 && steps % BUDGET_CLOCK_EVERY == 0 &&
+            _millis_since(start) >= budget->millis)
+        _budget_hit = "time";
+    else
+        return 0;
+
+    return ERR_BUDGET;
+}
+
+/**
+ * @brief Live AST nodes, for `_budget_check`
+ */
+static unsigned long _ast_nodes() {
+    arena_stats_t stats;
+    ast_stats(&stats);
+    return stats.live_bytes / sizeof(expr_t) - _ast_reserved;
+}
+
+/**
+ * @brief Look up a reduction strategy by its command line name
+ *
+ * @return 0 on success, ERR_INP if there is no such strategy
+ */
+int strategy_from_name(const char *name, strategy_e *out) {
+    int count = sizeof(_strategies) / sizeof(_strategies[0]);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, _strategies[i].name) == 0) {
+            *out = (strategy_e)i;
+            return 0;
+        }
+    }
+
+    return ERR_INP;
+}
+
+/**
+ * @brief Reduce according to `strategy` without searching from the root
+ *        after every step. The path from the root to the focus is kept as a
+ *        context stack. After a contraction the search resumes at the
+ *        contracted node. Lazy strategies back up one level first if the
+ *        node was in function position, since it may have become a lambda.
+ *        STRATEGY_NORMAL takes the same steps as repeated `step_expr` calls
+ *
+ * @param expr Expression to be reduced (will be modified)
+ * @param strategy See `_strategy_e`
+ * @param budget Limits on the reduction, may be NULL. When one is passed
+ *        `expr` is left holding the partially reduced term
+ * @param trace Called with `expr` before the first & after every step, may
+ *        be NULL. Reduction stops if it returns an ERR_*
+ *
+ * @return 0 on success, ERR_BUDGET if a limit was passed, ERR_* otherwise
+ */
+int normalize(expr_t *expr, strategy_e strategy, const budget_t *budget,
+        int (*trace)(expr_t *)) {
+    if ((unsigned int)strategy >= sizeof(_strategies) / sizeof(_strategies[0]))
+        return ERR_INP;
+
+    const strategy_spec_t *spec = &_strategies[strategy];
+    work_t ctx;
+    work_init(&ctx);
+    _norm_steps = 0;
+
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
+    int res = 0;
+    if (trace != NULL && (res = trace(expr)) < 0)
+        goto cleanup;
+
+    expr_t *focus = expr;
+    for (;;) {
+        switch (focus->type) {
+            case (VAR):
+                break;
+            case (LAMBDA):
+                if (!spec->under_lam)
+                    break;
+
+                if (work_push(&ctx, focus, NULL, 0, CTX_BODY) < 0)
+                    goto oom;
+
+                focus = focus->lam.body;
+                continue;
+            case (APPL):
+                if (!spec->strict && focus->appl.f->type == LAMBDA)
+                    goto contract;
+
+                if (work_push(&ctx, focus, NULL, 0, CTX_FUNC) < 0)
+                    goto oom;
+
+                focus = focus->appl.f;
+                continue;
+            default:
+                res = ERR_BAD_PARSE;
+                goto cleanup;
+        }
+
+        /* The focus is done, move on to the innermost argument that hasn't
+         * been searched yet, contracting finished strict redexes on the way
+         * out */
+        for (;;) {
+            if (work_empty(&ctx))
+                goto cleanup;
+
+            work_frame_t *top = work_top(&ctx);
+            if (top->state == CTX_FUNC &&
+                    (spec->strict || spec->neutral_args)) {
+                top->state = CTX_ARG;
+                focus = top->expr->appl.x;
+                break;
+            }
+
+            work_frame_t done = work_pop(&ctx);
+            if (spec->strict && done.state == CTX_ARG &&
+                    done.expr->appl.f->type == LAMBDA) {
+                focus = done.expr;
+                goto contract;
+            }
+        }
+
+        continue;
+
+contract:
+        if ((res = _budget_check(budget, _norm_steps, _ast_nodes(),
+                        &start)) < 0)
+            goto cleanup;
+
+        /* Contracted in place, so the context stays valid */
+        if ((res = appl_expr(focus)) < 0)
+            goto cleanup;
+
+        _norm_steps++;
+        if (trace != NULL && (res = trace(expr)) < 0)
+            goto cleanup;
+
+        if (!spec->strict && !work_empty(&ctx) &&
+                work_top(&ctx)->state == CTX_FUNC)
+            focus = work_pop(&ctx).expr;
+    }
+
+oom:
+    res = ERR_MEM_ALLOC;
+cleanup:
+    work_free(&ctx);
+    return res;
+}
+
+/**
+ * @brief Number of beta steps taken by the last `normalize`
+ */
+unsigned long normalize_steps() {
+    return _norm_steps;
+}
+
+#define MARK_STEP "\x1B[34m-\033[0m "
+#define MARK_PARTIAL "\x1B[31m!\033[0m "
+
+/**
+ * @brief Print a term of the evaluation trace behind `mark`
+ */
+void _print_marked(expr_t *expr, const char *mark) {
+    printf("%s", mark);
+    format_ast(expr);
+}
+
+/**
+ * @brief Print a single step of the evaluation trace
+ */
+void _print_step(expr_t *expr) {
+    _print_marked(expr, MARK_STEP);
+}
+
+/**
+ * @brief Decides which terms of a rewriting engine's reduction sequence get
+ *        printed. Engines offer every term they pass through, the tracer
+ *        only pays for printing the ones it wants. TRACE_LAST keeps no terms,
+ *        the first run only counts them & the engine then replays the
+ *        reduction so that the final `n` can be printed as they come by
+ */
+typedef struct _tracer {
+    trace_e mode;
+    unsigned long n;
+
+    /* Terms offered so far, one more than the steps taken */
+    unsigned long offered;
+
+    /* `offered` as of the last term printed */
+    unsigned long printed;
+
+    /* Terms the replay of a TRACE_LAST run lets by before printing */
+    unsigned long skip;
+
+    int (*print)(void *term, const char *mark);
+} tracer_t;
+
+static tracer_t _tracer;
+
+/**
+ * @brief Set up `_tracer` for one evaluation
+ */
+void _trace_begin(const eval_opts_t *opts,
+        int (*print)(void *, const char *)) {
+    _tracer.mode = opts->trace;
+    _tracer.n = opts->trace_n > 0 ? opts->trace_n : 1;
+    _tracer.offered = _tracer.printed = _tracer.skip = 0;
+    _tracer.print = print;
+}
+
+/**
+ * @brief Once a TRACE_LAST run has been counted, get ready to print the
+ *        final `n` of its terms as the engine replays it
+ *
+ * @return Steps the replay has to take
+ */
+unsigned long _trace_replay() {
+    unsigned long steps = _tracer.offered - 1;
+    _tracer.skip = _tracer.offered > _tracer.n ?
+        _tracer.offered - _tracer.n : 0;
+    _tracer.offered = _tracer.printed = 0;
+    _tracer.mode = TRACE_ALL;
+    return steps;
+}
+
+/**
+ * @brief Will the next term offered be printed or kept. Engines that have
+ *        to build the term they offer can offer NULL when it won't be
+ */
+int _trace_wants() {
+    switch (_tracer.mode) {
+        case (TRACE_ALL):
+            return _tracer.offered >= _tracer.skip;
+        case (TRACE_EVERY):
+            return _tracer.offered % _tracer.n == 0;
         default:
-            return ERR_BAD_PARSE;
+            return 0;
     }
 }
 
+/**
+ * @brief Offer the next term of the reduction sequence
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _trace_offer(void *term) {
+    unsigned long i = _tracer.offered++;
+    switch (_tracer.mode) {
+        case (TRACE_ALL):
+            if (i >= _tracer.skip)
+                break;
+            return 0;
+        case (TRACE_EVERY):
+            if (i % _tracer.n == 0)
+                break;
+            return 0;
+        default:
+            return 0;
+    }
+
+    _tracer.printed = _tracer.offered;
+    return _tracer.print(term, MARK_STEP);
+}
+
+/**
+ * @brief Finish the trace of an evaluation that ended with `res`. The final
+ *        term is printed if it hasn't been yet, & when a budget ran out it is
+ *        printed again as the partial result
+ *
+ * @param term Term the engine stopped at
+ *
+ * @return `res`, or an ERR_* if printing failed
+ */
+int _trace_end(void *term, int res) {
+    int err = 0;
+    if (_tracer.mode != TRACE_ALL && _tracer.mode != TRACE_LAST &&
+            res == 0 && _tracer.printed != _tracer.offered)
+        err = _tracer.print(term, MARK_STEP);
+
+    if (res == ERR_BUDGET) {
+        err_report("%s budget exhausted after %lu steps, partial result "
+                "follows", ERR_BUDGET, _budget_hit, _tracer.offered - 1);
+        if (err == 0)
+            err = _tracer.print(term, MARK_PARTIAL);
+    }
+
+    return err < 0 && res == 0 ? err : res;
+}
+
+static int _print_expr(void *term, const char *mark) {
+    _print_marked(term, mark);
+    return 0;
+}
+
+static int _trace_expr(expr_t *expr) {
+    return _trace_offer(expr);
+}
+
+static int _print_hc(void *term, const char *mark) {
+    int res;
+    expr_t *tree;
+    if ((res = hc_to_expr(term, &tree)) < 0)
+        return res;
+
+    _print_marked(tree, mark);
+    free_expr(tree);
+    return 0;
+}
+
+/**
+ * @brief Offer the term under `cur` to the tracer, which is only rebuilt up
+ *        to the root if the tracer wants it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _trace_hc(hc_cursor_t *cur) {
+    int res;
+    hc_node_t *root = NULL;
+    if (_trace_wants() && (res = hc_root(cur, &root)) < 0)
+        return res;
+
+    res = _trace_offer(root);
+    hc_release(root);
+    return res;
+}
+
+/**
+ * @brief Reduce `root` until it is normal or `budget` runs out, offering
+ *        every term to the tracer
+ *
+ * @param root Taken over by the reduction
+ * @param out Term the reduction stopped at, NULL if memory ran out
+ *
+ * @return 0 on success, ERR_BUDGET if a limit was passed, ERR_* otherwise
+ */
+static int _run_hcons(hc_node_t *root, const budget_t *budget,
+        hc_node_t **out) {
+    hc_cursor_t cur;
+    hc_cursor_init(&cur, root);
+
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+
+    int res;
+    unsigned long steps = 0;
+    hc_stats_t stats;
+    for (;;) {
+        if ((res = _trace_hc(&cur)) < 0)
+            break;
+
+        if ((res = hc_find(&cur)) != 0)
+            break;
+
+        /* Only charged once a redex is found, as in `normalize`, so a term
+         * that becomes normal on the last allowed step is within budget. The
+         * path holds the nodes above the focus as they were before it moved,
+         * which the DAG itself no longer has to share */
+        hc_stats(&stats);
+        if ((res = _budget_check(budget, steps, stats.live + cur.path.len,
+                        &start)) < 0 ||
+                (res = hc_contract(&cur)) < 0)
+            break;
+
+        steps++;
+    }
+
+    if (res == 1)
+        res = 0;
+
+    *out = NULL;
+    if (res != ERR_MEM_ALLOC && hc_root(&cur, out) < 0)
+        res = ERR_MEM_ALLOC;
+
+    hc_cursor_free(&cur);
+    return res;
+}
+
+/**
+ * @brief Evaluate on a hash-consed copy of `ast`, tracing every step
+ *
+ * @return 0 on success, ERR_BUDGET if a limit was passed, ERR_* otherwise
+ */
+int _eval_hcons(expr_t *ast, const eval_opts_t *opts) {
+    int res;
+    hc_node_t *root;
+    if ((res = hc_from_expr(ast, &root)) < 0)
+        return res;
+
+    /* The DAG is self-contained, so the tree can go right away unless
+     * TRACE_LAST has to replay from it */
+    if (opts->trace != TRACE_LAST)
+        ast_release_all();
+
+    _trace_begin(opts, _print_hc);
+    hc_node_t *nf;
+    res = _run_hcons(root, &opts->budget, &nf);
+
+    if (opts->trace == TRACE_LAST && res != ERR_MEM_ALLOC) {
+        const char *hit = _budget_hit;
+        budget_t replay = { .steps = _trace_replay() };
+
+        /* A budget of 0 is none, but with no steps the term is unchanged */
+        int err;
+        hc_node_t *again = NULL;
+        if (replay.steps == 0)
+            err = _trace_offer(nf);
+        else if ((err = hc_from_expr(ast, &root)) == 0)
+            err = _run_hcons(root, &replay, &again);
+
+        hc_release(again);
+        _budget_hit = hit;
+        if (err < 0 && err != ERR_BUDGET)
+            res = err;
+    }
+
+    res = _trace_end(nf, res);
+    hc_release(nf);
+    return res;
+}
+
+/**
+ * @brief Evaluate on an abstract machine, printing only the normal form
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _eval_machine(expr_t *ast, machine_e kind) {
+    int res;
+    expr_t *nf;
+    if ((res = machine_eval(ast, kind, &nf)) < 0)
+        return res;
+
+    _print_step(nf);
+    return 0;
+}
+
+/**
+ * @brief Normalize by evaluation, printing only the normal form
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _eval_nbe(expr_t *ast) {
+    int res;
+    expr_t *nf;
+    if ((res = nbe_normalize(ast, &nf)) < 0)
+        return res;
+
+    _print_step(nf);
+    return 0;
+}
+
+/* Budget of the running `inet_normalize` & when it began */
+static budget_t _inet_budget;
+static struct timespec _inet_start;
+
+static int _inet_check(unsigned long rewrites, unsigned long nodes) {
+    return _budget_check(&_inet_budget, rewrites, nodes, &_inet_start);
+}
+
+/**
+ * @brief Reduce as an interaction net, printing only the normal form. Every
+ *        rewrite is charged as a step, & the net is held to INET_MAX_NODES
+ *        even without a node budget. A net that is stopped can't be read
+ *        back, so there is no partial result
+ *
+ * @return 0 on success, ERR_BUDGET if a limit was passed, ERR_* otherwise
+ */
+int _eval_inet(expr_t *ast, const budget_t *budget) {
+    _inet_budget = *budget;
+    if (_inet_budget.nodes == 0 || _inet_budget.nodes > INET_MAX_NODES)
+        _inet_budget.nodes = INET_MAX_NODES;
+
+    timespec_get(&_inet_start, TIME_UTC);
+
+    int res;
+    expr_t *nf;
+    if ((res = inet_normalize(ast, _inet_check, &nf)) == ERR_BUDGET)
+        err_report("%s budget exhausted after %lu rewrites", ERR_BUDGET,
+                _budget_hit, inet_rewrites());
+
+    if (res < 0)
+        return res;
+
+    _print_step(nf);
+    return 0;
+}
+
+/**
+ * @brief Run a compiled program on the bytecode VM, printing only the normal
+ *        form
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int eval_bc(bc_t *bc) {
+    int res;
+    expr_t *nf;
+    if ((res = vm_run(bc, &nf)) < 0)
+        return res;
+
+    _print_step(nf);
+    ast_release_all();
+    return 0;
+}
+
+/**
+ * @brief Compile to bytecode & run it, printing only the normal form
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _eval_vm(expr_t *ast) {
+    int res;
+    bc_t *bc;
+    if ((res = bc_compile(ast, &bc)) < 0)
+        return res;
+
+    res = eval_bc(bc);
+    bc_free(bc);
+    return res;
+}
+
+/**
+ * @brief Run as native code, printing only the normal form. Falls back to
+ *        the bytecode VM where the JIT isn't available or the run nests too
+ *        deep for it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _eval_jit(expr_t *ast) {
+    int res;
+    expr_t *nf;
+    if ((res = jit_normalize(ast, &nf)) == ERR_UNSUPPORTED)
+        return _eval_vm(ast);
+    else if (res < 0)
+        return res;
+
+    _print_step(nf);
+    return 0;
+}
+
+/**
+ * @brief Normalize `ast` in place, tracing every step. TRACE_LAST replays
+ *        the reduction on a copy of `ast` taken beforehand
+ *
+ * @return 0 on success, ERR_BUDGET if a limit was passed, ERR_* otherwise
+ */
+int _eval_step(expr_t *ast, const eval_opts_t *opts) {
+    int res;
+    expr_t *copy = NULL;
+    if (opts->trace == TRACE_LAST) {
+        unsigned long before = _ast_nodes();
+        if ((copy = deep_copy_expr(ast)) == NULL)
+            return ERR_MEM_ALLOC;
+
+        _ast_reserved = _ast_nodes() - before;
+    }
+
+    _trace_begin(opts, _print_expr);
+    res = normalize(ast, opts->strategy, &opts->budget, _trace_expr);
+
+    if (opts->trace == TRACE_LAST && res != ERR_MEM_ALLOC) {
+        const char *hit = _budget_hit;
+        unsigned long steps = _norm_steps;
+        budget_t replay = { .steps = _trace_replay() };
+
+        /* A budget of 0 is none, but with no steps the term is unchanged */
+        int err = replay.steps == 0 ? _trace_offer(copy) :
+            normalize(copy, opts->strategy, &replay, _trace_expr);
+
+        _norm_steps = steps;
+        _budget_hit = hit;
+        if (err < 0 && err != ERR_BUDGET)
+            res = err;
+    }
+
+    _ast_reserved = 0;
+    return _trace_end(ast, res);
+}
+
+/**
+ * @brief Evaluate `ast` to normal form with the chosen engine, printing every
+ *        intermediate term the engine produces. The AST arena is released
+ *        afterwards
+ *
+ * @param ast Parsed program (NULL for an empty program)
+ * @param opts Engine & strategy to evaluate with
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int eval_ast(expr_t *ast, const eval_opts_t *opts) {
+    int res = 0;
+    if (ast == NULL)
+        return 0;
+
+    switch (opts->engine) {
+        case (ENGINE_HCONS):
+            res = _eval_hcons(ast, opts);
+            break;
+        case (ENGINE_KRIVINE):
+            res = _eval_machine(ast, MACHINE_KRIVINE);
+            break;
+        case (ENGINE_CEK):
+            res = _eval_machine(ast, MACHINE_CEK);
+            break;
+        case (ENGINE_NEED):
+            res = _eval_machine(ast, MACHINE_NEED);
+            break;
+        case (ENGINE_NBE):
+            res = _eval_nbe(ast);
+            break;
+        case (ENGINE_INET):
+            res = _eval_inet(ast, &opts->budget);
+            break;
+        case (ENGINE_VM):
+            res = _eval_vm(ast);
+            break;
+        case (ENGINE_JIT):
+            res = _eval_jit(ast);
+            break;
+        default:
+            res = _eval_step(ast, opts);
+    }
+
+    /* The arena owns the whole term, so drop it in one go */
+    ast_release_all();
+    return res;
+}
+
 /**
  * @brief Run one read eval print step
+ *
+ * @param opts Engine & strategy to evaluate with
+ *
+ * @return 1 once the input is exhausted, 0 on success, ERR_* otherwise
  */
-int run_interp() {
+int run_interp(const eval_opts_t *opts) {
     printf("%s", interp_prompt);
 
-    dyn_buf_t *tokens = NULL;
+    lexer_t lx;
     expr_t *ast = NULL;
 
+    /* The line is parsed as it is read, up to its \n */
     int res = 0;
-    if ((res = lex(stdin, &tokens, '\n')) < 0) {
+    if ((res = lexer_init(&lx, stdin, '\n')) < 0) {
         goto cleanup;
-    } else if ((res = parse(tokens, &ast)) < 0) {
-        goto cleanup_tokens;
+    } else if ((res = parse(&lx, &ast)) < 0) {
+        goto cleanup_lexer;
     } else {
 #ifdef _DEBUG_
         /*
-        if (dyn_buf_len(tokens) > 0) {
+        if (ast != NULL) {
             printf("[intermediate state]\n");
-            format_tokens(tokens);
             format_ast(ast);
         } */
 #endif /* _DEBUG_ */
 
     }
 
-    do { 
-        printf("\x1B[34m-\033[0m ");
-        format_ast(ast);
-    } while (step_expr(ast) == 0);
+    if (ast == NULL && feof(stdin)) {
+        res = 1;
+        goto cleanup_lexer;
+    }
 
-    free_expr(ast);
+    /* A stopped run has reported itself already */
+    int err;
+    if ((err = eval_ast(ast, opts)) < 0) {
+        if (err != ERR_BUDGET)
+            err_report("Evaluation failed", err);
+
+        res = err;
+    }
 
-cleanup_tokens:
-    dyn_buf_free(tokens, GET_VOID_FREE(free_token));
+cleanup_lexer:
+    lexer_free(&lx);
 
 cleanup:
     return res;
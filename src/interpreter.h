@@ -10,8 +10,121 @@
 #define _INTERPERTER_H_
 
 #include "ast.h"
+#include "bytecode.h"
 
+/**
+ * @brief Evaluation engines selectable from the command line
+ */
+typedef enum _engine_e {
+    /* In-place rewriting of the parsed tree by `normalize` */
+    ENGINE_STEP,
+
+    /* Rewriting of a hash-consed DAG by `hc_find` & `hc_contract` */
+    ENGINE_HCONS,
+
+    /* Call-by-name Krivine machine, prints the normal form only */
+    ENGINE_KRIVINE,
+
+    /* Call-by-value CEK machine, prints the normal form only */
+    ENGINE_CEK,
+
+    /* Call-by-need lazy Krivine machine, prints the normal form only */
+    ENGINE_NEED,
+
+    /* Normalization by evaluation, prints the normal form only */
+    ENGINE_NBE,
+
+    /* Optimal reduction of an interaction net, prints the normal form only */
+    ENGINE_INET,
+
+    /* Bytecode compiled & run on the VM, prints the normal form only */
+    ENGINE_VM,
+
+    /* x86-64 native code, falling back to ENGINE_VM, prints the normal form
+     * only */
+    ENGINE_JIT
+} engine_e;
+
+/**
+ * @brief Reduction strategies of the step engine
+ */
+typedef enum _strategy_e {
+    /* Leftmost outermost to full normal form */
+    STRATEGY_NORMAL,
+
+    /* Leftmost innermost to full normal form, arguments first */
+    STRATEGY_APPLICATIVE,
+
+    /* Call-by-value to weak normal form, never under lambdas */
+    STRATEGY_CBV,
+
+    /* Call-by-name to weak normal form, never under lambdas */
+    STRATEGY_CBN,
+
+    /* Stop once the head is a lambda or a variable */
+    STRATEGY_WHNF,
+
+    /* As STRATEGY_WHNF, but also reduce the head under lambdas */
+    STRATEGY_HNF
+} strategy_e;
+
+/**
+ * @brief Limits on a single evaluation, a limit of 0 is no limit
+ */
+typedef struct _budget {
+    /* Beta steps */
+    unsigned long steps;
+
+    /* Live term nodes, AST nodes or hash-consed nodes per engine */
+    unsigned long nodes;
+
+    /* Wall clock time in milliseconds */
+    unsigned long millis;
+} budget_t;
+
+/**
+ * @brief Which terms of the reduction sequence ENGINE_STEP & ENGINE_HCONS
+ *        print, the other engines only ever print the normal form
+ */
+typedef enum _trace_e {
+    /* Every term */
+    TRACE_ALL,
+
+    /* Only the final term */
+    TRACE_QUIET,
+
+    /* The first term, every `trace_n`th after it & the final term */
+    TRACE_EVERY,
+
+    /* The final `trace_n` terms, found by running the reduction twice */
+    TRACE_LAST
+} trace_e;
+
+/**
+ * @brief How `eval_ast` evaluates a program
+ */
+typedef struct _eval_opts {
+    engine_e engine;
+
+    /* Only honoured by ENGINE_STEP, the other engines always normalize */
+    strategy_e strategy;
+
+    /* Only honoured by ENGINE_STEP, ENGINE_HCONS & ENGINE_INET */
+    budget_t budget;
+
+    /* Only honoured by ENGINE_STEP & ENGINE_HCONS */
+    trace_e trace;
+    unsigned long trace_n;
+} eval_opts_t;
+
+int engine_from_name(const char *name, engine_e *out);
 int step_expr(expr_t *expr);
-int run_interp();
+int strategy_from_name(const char *name, strategy_e *out);
+int normalize(expr_t *expr, strategy_e strategy, const budget_t *budget,
+        int (*trace)(expr_t *));
+unsigned long normalize_steps();
+int eval_ast(expr_t *ast, const eval_opts_t *opts);
+int eval_bc(bc_t *bc);
+int run_interp(const eval_opts_t *opts);
 
 #endif /* _INTERPERTER_H_ */
@@ -0,0 +1,539 @@
+/**
+ * @file jit.c
+ *
+ * @brief x86-64 JIT compiler implementation
+ *
+ * Lambda `n` of the closure conversion becomes a System V function taking
+ * its environment in rdi & its argument in rsi, both spilled to the frame.
+ * Expressions are computed into rax, with pending function values pushed on
+ * the machine stack; the push depth is tracked so calls are always made
+ * with a 16 byte aligned stack. The top level term is one more function,
+ * placed first. Addresses of lambda bodies are patched in once the code is
+ * copied to its executable pages.
+ *
+ * Helpers called from generated code cannot return an error, so they
+ * longjmp back to `_jit_run` instead. Generated frames hold no resources,
+ * so this unwinds them safely.
+ *
+ * @author Lars Wander
+ */
+
+/* mmap & MAP_ANONYMOUS */
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <err.h>
+
+#include "jit.h"
+
+/* Size of the last program compiled */
+static unsigned long _jit_bytes = 0;
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <setjmp.h>
+#include <sys/mman.h>
+
+#include <lib/arena.h>
+
+#include "closure.h"
+#include "work.h"
+
+typedef struct _jit_val jit_val_t;
+typedef jit_val_t *(*jit_code_t)(jit_val_t **env, jit_val_t *arg);
+
+/**
+ * @brief A closure when `code` is set, otherwise a neutral: the variable
+ *        bound `level` lambdas deep when `head` is NULL, else `head` applied
+ *        to `arg`. Same shape as the C backend's runtime values
+ */
+struct _jit_val {
+    jit_code_t code;
+    sym_t sym;
+    unsigned int level;
+    jit_val_t *head;
+    jit_val_t *arg;
+    jit_val_t *env[];
+};
+
+/* Generated code reads these fields with 8 bit displacements */
+_Static_assert(offsetof(jit_val_t, code) == 0, "code must come first");
+_Static_assert(offsetof(jit_val_t, env) < 0x80, "env must be near");
+
+#define JIT_ENV_OFF ((unsigned char)offsetof(jit_val_t, env))
+
+/**
+ * @brief Code being generated
+ */
+typedef struct _jit {
+    cc_prog_t *prog;
+
+    unsigned char *code;
+    size_t len;
+    size_t cap;
+
+    /* Offset of each lambda's code, by number */
+    size_t *offsets;
+
+    /* Pairs of (code offset of an imm64, lambda number) to patch */
+    size_t *fixups;
+    size_t fixups_len;
+    size_t fixups_cap;
+
+    int err;
+} jit_t;
+
+/* Holds every value of the current run */
+static arena_t *_jit_arena = NULL;
+
+/* Where helpers bail out to on failure */
+static jmp_buf _jit_fail;
+
+/* Stack address the current run started at */
+static uintptr_t _jit_stack = 0;
+
+static void *_jit_alloc(size_t size) {
+    void *res;
+    if ((res = arena_alloc(_jit_arena, size)) == NULL)
+        longjmp(_jit_fail, ERR_MEM_ALLOC);
+
+    return res;
+}
+
+static jit_val_t *_jit_neutral(unsigned int level, jit_val_t *head,
+        jit_val_t *arg) {
+    jit_val_t *res = _jit_alloc(sizeof(jit_val_t));
+    res->code = NULL;
+    res->level = level;
+    res->head = head;
+    res->arg = arg;
+    return res;
+}
+
+/**
+ * @brief Called from generated code to build a closure, whose environment
+ *        the caller fills in
+ */
+static jit_val_t *_jit_clos(jit_code_t code, sym_t sym, unsigned int n) {
+    jit_val_t *res = _jit_alloc(sizeof(jit_val_t) + n * sizeof(jit_val_t *));
+    res->code = code;
+    res->sym = sym;
+    return res;
+}
+
+/**
+ * @brief Called from generated code for applications not in tail position,
+ *        which are the only ones that nest. A run that nests deeper than
+ *        JIT_STACK_MAX is abandoned to the caller rather than overflow the
+ *        machine stack
+ */
+static jit_val_t *_jit_apply(jit_val_t *f, jit_val_t *x) {
+    char here;
+    if (_jit_stack - (uintptr_t)&here > JIT_STACK_MAX)
+        longjmp(_jit_fail, ERR_UNSUPPORTED);
+
+    if (f->code != NULL)
+        return f->code(f->env, x);
+
+    return _jit_neutral(0, f, x);
+}
+
+static void _emit(jit_t *j, const unsigned char *bytes, size_t n) {
+    if (j->err < 0)
+        return;
+
+    if (j->len + n > j->cap) {
+        size_t cap = j->cap == 0 ? 0x1000 : j->cap * 2;
+        unsigned char *code;
+        while (cap < j->len + n)
+            cap *= 2;
+
+        if ((code = realloc(j->code, cap)) == NULL) {
+            j->err = ERR_MEM_ALLOC;
+            return;
+        }
+
+        j->code = code;
+        j->cap = cap;
+    }
+
+    memcpy(j->code + j->len, bytes, n);
+    j->len += n;
+}
+
+#define EMIT(j, ...) do { \
+    const unsigned char _b[] = { __VA_ARGS__ }; \
+    _emit((j), _b, sizeof(_b)); \
+} while (0)
+
+static void _emit32(jit_t *j, uint32_t v) {
+    _emit(j, (const unsigned char *)&v, sizeof(v));
+}
+
+static void _emit64(jit_t *j, uint64_t v) {
+    _emit(j, (const unsigned char *)&v, sizeof(v));
+}
+
+static void _fixup(jit_t *j, size_t pos, size_t lam) {
+    if (j->fixups_len + 2 > j->fixups_cap) {
+        size_t cap = j->fixups_cap == 0 ? 0x80 : j->fixups_cap * 2;
+        size_t *fixups;
+        if ((fixups = realloc(j->fixups, cap * sizeof(size_t))) == NULL) {
+            j->err = ERR_MEM_ALLOC;
+            return;
+        }
+
+        j->fixups = fixups;
+        j->fixups_cap = cap;
+    }
+
+    j->fixups[j->fixups_len++] = pos;
+    j->fixups[j->fixups_len++] = lam;
+}
+
+/**
+ * @brief Call a C helper, keeping the stack aligned under `depth` pushes
+ */
+static void _emit_call(jit_t *j, uintptr_t fn, unsigned int depth) {
+    if (depth & 1)
+        EMIT(j, 0x48, 0x83, 0xEC, 0x08);    /* sub rsp, 8 */
+
+    EMIT(j, 0x48, 0xB8);                    /* movabs rax, fn */
+    _emit64(j, fn);
+    EMIT(j, 0xFF, 0xD0);                    /* call rax */
+
+    if (depth & 1)
+        EMIT(j, 0x48, 0x83, 0xC4, 0x08);    /* add rsp, 8 */
+}
+
+static void _emit_ret(jit_t *j) {
+    EMIT(j, 0xC9, 0xC3);                    /* leave; ret */
+}
+
+/**
+ * @brief Load variable `index` of `self` into rax
+ */
+static void _emit_var(jit_t *j, unsigned int index, cc_lam_t *self) {
+    int slot;
+    if (self == NULL) {
+        j->err = ERR_UNBOUND_VAR;
+        return;
+    }
+
+    if (index == 0) {
+        EMIT(j, 0x48, 0x8B, 0x45, 0xF0);    /* mov rax, [rbp - 16] */
+        return;
+    }
+
+    if ((slot = cc_slot(self, index)) < 0) {
+        j->err = ERR_CORRUPT;
+        return;
+    }
+
+    EMIT(j, 0x48, 0x8B, 0x45, 0xF8);        /* mov rax, [rbp - 8] */
+    EMIT(j, 0x48, 0x8B, 0x80);              /* mov rax, [rax + 8 * slot] */
+    _emit32(j, (uint32_t)slot * 8);
+}
+
+/**
+ * @brief What `_emit_expr` still has to do for an application
+ */
+typedef enum _jit_todo_e {
+    /* Push the function's value & compute the argument */
+    J_ARG,
+
+    /* Call the function */
+    J_APPLY,
+
+    /* Call the function in tail position */
+    J_TAILAPPLY
+} jit_todo_e;
+
+/**
+ * @brief Compute `expr` into rax, or return it if `tail` is set. The parts
+ *        of applications still to be emitted wait on a work stack
+ *
+ * @param next Number of the next lambda met in pre-order
+ * @param depth Values pushed by the enclosing expressions
+ */
+static void _emit_expr(jit_t *j, expr_t *expr, cc_lam_t *self,
+        unsigned int *next, unsigned int depth, int tail) {
+    work_t w;
+    work_init(&w);
+
+    cc_lam_t *lam;
+    unsigned int id, i;
+    for (;;) {
+        switch (expr->type) {
+            case (VAR):
+                _emit_var(j, expr->var.index, self);
+                break;
+            case (LAMBDA):
+                id = *next;
+                lam = &j->prog->lams[id];
+                *next += 1 + lam->nested;
+
+                EMIT(j, 0x48, 0xBF);        /* movabs rdi, lam_id */
+                _fixup(j, j->len, id);
+                _emit64(j, 0);
+                EMIT(j, 0xBE);              /* mov esi, sym */
+                _emit32(j, expr->lam.sym);
+                EMIT(j, 0xBA);              /* mov edx, ncaps */
+                _emit32(j, lam->ncaps);
+                _emit_call(j, (uintptr_t)&_jit_clos, depth);
+
+                if (lam->ncaps == 0)
+                    break;
+
+                EMIT(j, 0x50);              /* push rax */
+                for (i = 0; i < lam->ncaps; i++) {
+                    _emit_var(j, lam->caps[i], self);
+                    EMIT(j, 0x48, 0x89, 0xC1);      /* mov rcx, rax */
+                    EMIT(j, 0x48, 0x8B, 0x14, 0x24);    /* mov rdx, [rsp] */
+                    EMIT(j, 0x48, 0x89, 0x8A);      /* mov [rdx + env + 8i], rcx */
+                    _emit32(j, JIT_ENV_OFF + i * 8);
+                }
+
+                EMIT(j, 0x58);              /* pop rax */
+                break;
+            case (APPL):
+                if (work_push(&w, expr, NULL, depth,
+                            tail ? J_TAILAPPLY : J_APPLY) < 0 ||
+                        work_push(&w, expr, NULL, depth, J_ARG) < 0) {
+                    j->err = ERR_MEM_ALLOC;
+                    goto cleanup;
+                }
+
+                expr = expr->appl.f;
+                tail = 0;
+                continue;
+            default:
+                j->err = ERR_CORRUPT;
+                goto cleanup;
+        }
+
+        if (tail)
+            _emit_ret(j);
+
+        /* Finish the applications whose operands are done */
+        for (;;) {
+            if (work_empty(&w))
+                goto cleanup;
+
+            work_frame_t frame = work_pop(&w);
+            if (frame.state == J_ARG) {
+                EMIT(j, 0x50);              /* push rax */
+                expr = frame.expr->appl.x;
+                depth = frame.depth + 1;
+                tail = 0;
+                break;
+            }
+
+            EMIT(j, 0x48, 0x89, 0xC6);      /* mov rsi, rax */
+            EMIT(j, 0x5F);                  /* pop rdi */
+
+            if (frame.state == J_APPLY) {
+                _emit_call(j, (uintptr_t)&_jit_apply, frame.depth);
+                continue;
+            }
+
+            /* Closures are entered with a jump, reusing our caller's
+             * return address */
+            EMIT(j, 0x48, 0x8B, 0x07);      /* mov rax, [rdi] */
+            EMIT(j, 0x48, 0x85, 0xC0);      /* test rax, rax */
+            EMIT(j, 0x74, 0x07);            /* jz neutral */
+            EMIT(j, 0x48, 0x83, 0xC7, JIT_ENV_OFF); /* add rdi, env */
+            EMIT(j, 0xC9);                  /* leave */
+            EMIT(j, 0xFF, 0xE0);            /* jmp rax */
+            _emit_call(j, (uintptr_t)&_jit_apply, frame.depth);
+            _emit_ret(j);
+        }
+    }
+
+cleanup:
+    work_free(&w);
+}
+
+/**
+ * @brief Emit one function computing `body`
+ */
+static void _emit_function(jit_t *j, expr_t *body, cc_lam_t *self,
+        unsigned int next) {
+    EMIT(j, 0x55);                          /* push rbp */
+    EMIT(j, 0x48, 0x89, 0xE5);              /* mov rbp, rsp */
+    EMIT(j, 0x48, 0x83, 0xEC, 0x10);        /* sub rsp, 16 */
+    EMIT(j, 0x48, 0x89, 0x7D, 0xF8);        /* mov [rbp - 8], rdi */
+    EMIT(j, 0x48, 0x89, 0x75, 0xF0);        /* mov [rbp - 16], rsi */
+    _emit_expr(j, body, self, &next, 0, 1);
+}
+
+/* Values still to be read back. Static so that it can be freed after a
+ * helper longjmps out of `_quote` */
+static work_t _jit_todo;
+
+/**
+ * @brief Read back the normal form of `val` into `out`. The tree is built
+ *        top down, each value filling in the slot its parent left for it.
+ *        Failures longjmp to `_jit_fail`
+ */
+static void _quote(jit_val_t *val, expr_t **out) {
+    work_init(&_jit_todo);
+    if (work_push_node(&_jit_todo, val, out, 0, 0) < 0)
+        longjmp(_jit_fail, ERR_MEM_ALLOC);
+
+    while (!work_empty(&_jit_todo)) {
+        work_frame_t frame = work_pop(&_jit_todo);
+        unsigned int depth = frame.depth;
+        expr_t **slot = frame.slot;
+
+        val = frame.node;
+        if (val->code != NULL) {
+            jit_val_t *body = val->code(val->env,
+                    _jit_neutral(depth, NULL, NULL));
+            if ((*slot = new_lam(val->sym, NULL)) == NULL ||
+                    work_push_node(&_jit_todo, body, &(*slot)->lam.body,
+                        depth + 1, 0) < 0)
+                longjmp(_jit_fail, ERR_MEM_ALLOC);
+
+            continue;
+        }
+
+        /* Walk down the heads, leaving the arguments for later so they are
+         * read back left to right */
+        for (; val->head != NULL; val = val->head) {
+            if ((*slot = new_appl(NULL, NULL)) == NULL ||
+                    work_push_node(&_jit_todo, val->arg, &(*slot)->appl.x,
+                        depth, 0) < 0)
+                longjmp(_jit_fail, ERR_MEM_ALLOC);
+
+            slot = &(*slot)->appl.f;
+        }
+
+        if ((*slot = new_var(depth - 1 - val->level, 0)) == NULL)
+            longjmp(_jit_fail, ERR_MEM_ALLOC);
+    }
+
+    work_free(&_jit_todo);
+}
+
+/**
+ * @brief Run the compiled top level & read back its normal form
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _jit_run(void *entry, expr_t **out) {
+    int res;
+    union {
+        void *addr;
+        jit_val_t *(*fn)(void);
+    } top;
+
+    /* Data to function pointer conversion without the pedantic warning */
+    top.addr = entry;
+    _jit_stack = (uintptr_t)&top;
+    *out = NULL;
+    if ((res = setjmp(_jit_fail)) != 0) {
+        work_free(&_jit_todo);
+        free_expr(*out);
+        *out = NULL;
+        return res;
+    }
+
+    _quote(top.fn(), out);
+    return 0;
+}
+
+/**
+ * @brief Compile `expr` to machine code, run it & read back its normal form
+ *
+ * @param expr Closed term being normalized, left untouched
+ * @param out Freshly allocated normal form on success
+ *
+ * @return 0 on success, ERR_UNSUPPORTED if the code could not be compiled
+ *         or mapped or ran too deep, ERR_* otherwise
+ */
+int jit_normalize(expr_t *expr, expr_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    int res;
+    jit_t j = { 0 };
+    if ((res = cc_convert(expr, &j.prog)) < 0)
+        return res;
+
+    if ((j.offsets = malloc((j.prog->len + 1) * sizeof(size_t))) == NULL) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup;
+    }
+
+    unsigned int i;
+    _emit_function(&j, expr, NULL, 0);
+    for (i = 0; i < j.prog->len && j.err == 0; i++) {
+        j.offsets[i] = j.len;
+        _emit_function(&j, j.prog->lams[i].lam->lam.body, &j.prog->lams[i],
+                i + 1);
+    }
+
+    if ((res = j.err) < 0)
+        goto cleanup;
+
+    unsigned char *base;
+    if ((base = mmap(NULL, j.len, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+        res = ERR_UNSUPPORTED;
+        goto cleanup;
+    }
+
+    memcpy(base, j.code, j.len);
+    for (size_t f = 0; f < j.fixups_len; f += 2) {
+        uint64_t addr = (uintptr_t)(base + j.offsets[j.fixups[f + 1]]);
+        memcpy(base + j.fixups[f], &addr, sizeof(addr));
+    }
+
+    if (mprotect(base, j.len, PROT_READ | PROT_EXEC) < 0) {
+        res = ERR_UNSUPPORTED;
+        goto cleanup_map;
+    }
+
+    _jit_bytes = j.len;
+    if ((_jit_arena = arena_new(JIT_ARENA_CHUNK)) == NULL) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup_map;
+    }
+
+    res = _jit_run(base, out);
+
+    arena_free(_jit_arena);
+    _jit_arena = NULL;
+
+cleanup_map:
+    munmap(base, j.len);
+
+cleanup:
+    cc_free(j.prog);
+    free(j.code);
+    free(j.offsets);
+    free(j.fixups);
+    return res;
+}
+
+#else
+
+int jit_normalize(expr_t *expr, expr_t **out) {
+    (void)expr;
+    (void)out;
+    return ERR_UNSUPPORTED;
+}
+
+#endif /* __x86_64__ && __linux__ */
+
+/**
+ * @brief Bytes of machine code generated for the last `jit_normalize`
+ */
+unsigned long jit_code_bytes() {
+    return _jit_bytes;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file jit.h
+ *
+ * @brief x86-64 JIT compiler
+ *
+ * Closure-converted lambda bodies are translated straight into x86-64
+ * machine code in mmap'd pages & run in process, call-by-value like the
+ * bytecode VM. Closure allocation & applying free variables go through
+ * small C helpers, applications in tail position jump straight into the
+ * callee. Elsewhere (other architectures, the -m32 build) nothing is
+ * compiled & ERR_UNSUPPORTED is returned so the caller can fall back to
+ * the VM, as it is for runs nesting deeper than the machine stack allows.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "ast.h"
+
+/* Closures & environments are small & short lived, use modest chunks */
+#define JIT_ARENA_CHUNK (0x10000)
+
+/* Bytes of machine stack a run may nest through, well within the usual
+ * 8MB limit of the main thread */
+#define JIT_STACK_MAX (0x400000)
+
+int jit_normalize(expr_t *expr, expr_t **out);
+unsigned long jit_code_bytes();
+
+#endif /* _JIT_H_ */
@@ -3,212 +3,187 @@
  *
  * @brief lcc lexer implementation
  *
+ * Tokens are lexed one at a time as the parser asks for them, so the only
+ * memory parsing needs is that of the term being built. Source files are
+ * mapped into memory & lexed in place, streams that can't be mapped (stdin,
+ * pipes, the REPL reading a line at a time) are lexed from a small buffer
+ * refilled as it runs out, the REPL's a byte at a time so that a line is
+ * parsed as it is typed. Names are interned straight from the source.
+ *
  * @author Lars Wander
  */
 
+#if defined(__unix__) || defined(__APPLE__)
+/* mmap & friends are POSIX, not C11 */
+#define _DEFAULT_SOURCE
+#define LEX_MMAP
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 #include <string.h>
 
+#ifdef LEX_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <err.h>
-#include <util.h>
 
 #include "lexer.h"
 
-MAKE_VOID_FREE(free_token)
-
 /**
- * @brief Pointer to new token struct
- *
- * @param sym Token type
- * @param ident NULL for non-identified tokens, otherwise should point to
- *        name. Memory will be copied for the token
- *
- * @return Pointer to token on success, NULL otherwise
+ * @brief [a-zA-Z0-9], without going through the locale
  */
-token_t *_new_token(token_e sym, char *ident) {
-    token_t *res;
-    if ((res = malloc(sizeof(token_t))) == NULL)
-        goto cleanup_default;
-
-    res->type = sym;
-
-    if (ident != NULL) {
-        size_t nlen;
-        MIN(nlen, strlen(ident), MAX_VAR_LEN);
-        if ((res->ident = malloc(nlen + 1)) == NULL)
-            goto cleanup_ident;
-
-        strncpy(res->ident, ident, nlen);
-        res->ident[nlen] = '\0';
-    } else {
-        res->ident = NULL;
-    }
-
-    return res;
-
-cleanup_ident:
-    free(res);
-
-cleanup_default:
-    return NULL;
-}
-
-void _format_token(token_t *token) {
-    switch (token->type) {
-        case (T_LPAREN):
-            printf("(");
-            break;
-        case (T_RPAREN):
-            printf(")");
-            break;
-        case (T_BSLASH):
-            printf("\\");
-            break;
-        case (T_DOT):
-            printf(".");
-            break;
-        case (T_VAR):
-            if (token->ident == NULL) {
-                err_report("Variable token type without name\n", ERR_INP);
-                exit(-2);
-            }
-            printf("%s", token->ident);
-            break;
-        default:
-            break;
-    }
+static inline int _is_ident(unsigned char c) {
+    return (unsigned char)((c | 0x20) - 'a') < 26 ||
+        (unsigned char)(c - '0') < 10;
 }
 
 /**
- * @brief Print input tokens to stdout for testing purposes
+ * @brief Map all of the regular file behind `fp` as the source
  *
- * @param buf Buffer of input tokens to be printed
+ * @return 0 on success, 1 if the file can't be mapped
  */
-void format_tokens(dyn_buf_t *buf) {
-    if (buf == NULL)
-        return;
-
-    int elems = dyn_buf_len(buf);
-    int i;
-    token_t *token;
-    for (i = 0; i < elems; i++) {
-        int res;
-        if ((res = dyn_buf_at(buf, i, (void **)&token)) < 0)
-            err_report("dyn_buf_t lookup failed", res);
-        _format_token(token);
-    }
-    printf("\n");
+int _lex_map(lexer_t *lx) {
+#ifdef LEX_MMAP
+    struct stat st;
+    int fd = fileno(lx->fp);
+    if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+            st.st_size == 0)
+        return 1;
+
+    void *map;
+    if ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+            == MAP_FAILED)
+        return 1;
+
+    /* Read front to back exactly once */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    lx->map = map;
+    lx->map_len = st.st_size;
+    lx->p = map;
+    lx->end = lx->p + st.st_size;
+    return 0;
+#else
+    (void)lx;
+    return 1;
+#endif
 }
 
 /**
- * @brief Free input token
+ * @brief Move on to the next bytes of the source
  *
- * @param token Token to be freed
+ * @return 0 if there are more, 1 at the end of the source, ERR_* otherwise
  */
-void free_token(token_t *token) {
-    if (token->ident != NULL)
-        free(token->ident);
-
-    free(token);
-}
+int _lex_refill(lexer_t *lx) {
+    if (lx->done || lx->map != NULL) {
+        lx->done = 1;
+        return 1;
+    }
 
-int _push_sym(dyn_buf_t *buf, token_e sym) {
-    token_t *token;
-    if ((token = _new_token(sym, NULL)) == NULL)
+    if (lx->buf == NULL && (lx->buf = malloc(LEX_READ_CHUNK)) == NULL)
         return ERR_MEM_ALLOC;
 
-    int res;
-    if ((res = dyn_buf_push(buf, (void *)token)) < 0)
-        goto cleanup_token;
+    /* Without a terminating character there is no need to look at every
+     * byte on the way in, with one nothing past it may be consumed */
+    size_t n = 0;
+    int ch;
+    if (lx->eof == EOF)
+        n = fread(lx->buf, 1, LEX_READ_CHUNK, lx->fp);
+    else if ((ch = fgetc(lx->fp)) != EOF && (char)ch != lx->eof)
+        lx->buf[n++] = ch;
+
+    if (n == 0) {
+        lx->done = 1;
+        return 1;
+    }
 
+    lx->p = lx->buf;
+    lx->end = lx->buf + n;
     return 0;
-
-cleanup_token:
-    free_token(token);
-    return res;
-}
-
-
-int _push_ident(dyn_buf_t *buf, token_e sym, char *ident) {
-    token_t *token;
-    if ((token = _new_token(sym, ident)) == NULL)
-        return ERR_MEM_ALLOC;
-
-    int res;
-    if ((res = dyn_buf_push(buf, (void *)token)) < 0)
-        goto cleanup_token;
-
-    return 0;
-
-cleanup_token:
-    free_token(token);
-    return res;
 }
 
 /**
- * @brief Lex input file into buf, terminating at eof character
- *
- * @param fp File pointer (stdin or some file)
- * @param buf Buffer where output goes
- * @param eof Terminating character (i.e. \n for interpreter)
+ * @brief Lex the identifier starting at the next byte
  *
  * @return 0 on success, ERR_* otherwise
  */
-int lex(FILE *fp, dyn_buf_t **buf, char eof) {
+int _lex_ident(lexer_t *lx) {
+    char copy[MAX_VAR_LEN];
+    const char *name = copy;
+    size_t len = 0, n;
     int res;
-    if (fp == NULL || buf == NULL) {
-        res = ERR_INP;
-        goto cleanup_default;
-    }
+    for (;;) {
+        const unsigned char *start = lx->p;
+        while (lx->p < lx->end && _is_ident(*lx->p))
+            lx->p++;
+
+        n = lx->p - start;
+
+        /* Names are usually whole in the source at hand, & are interned
+         * straight from it */
+        if (len == 0 && lx->p < lx->end) {
+            name = (const char *)start;
+            len = n;
+            break;
+        }
 
-    if ((*buf = dyn_buf_new()) == NULL) {
-        res = ERR_MEM_ALLOC;
-        goto cleanup_default;
+        if (len < MAX_VAR_LEN)
+            memcpy(copy + len, start,
+                    n < MAX_VAR_LEN - len ? n : MAX_VAR_LEN - len);
+
+        len += n;
+        if (lx->p < lx->end || (res = _lex_refill(lx)) > 0)
+            break;
+        else if (res < 0)
+            return res;
     }
 
-    char ch;
-    char *ident_buf;
-    if ((ident_buf = calloc(1, MAX_VAR_LEN + 1)) == NULL) {
-        res = ERR_MEM_ALLOC;
-        goto cleanup_dyn_buf;
+    if (len > MAX_VAR_LEN) {
+        res = ERR_SEMANTICS;
+        err_report("Identifier \"%.*s...\" too long\n", res, MAX_VAR_LEN,
+                name);
+        return res;
     }
 
-    int ident_ind = 0;
-    while ((ch = fgetc(fp)) != eof && ch != EOF) {
-        if (isalnum(ch)) {
-            ident_buf[ident_ind] = ch;
-            ident_ind++;
-            continue;
-        }
+    if ((res = sym_intern_n(name, len, &lx->sym)) < 0)
+        return res;
 
-        if (ident_ind > MAX_VAR_LEN) {
-            ident_buf[MAX_VAR_LEN] = '\0';
-            res = ERR_SEMANTICS;
-            err_report("Identifier \"%s...\" too long\n", res, ident_buf);
-            goto cleanup_buf;
-        }
+    lx->kind = T_VAR;
+    return 0;
+}
 
-        if (ident_ind > 0) {
-            ident_buf[ident_ind] = '\0';
-            _push_ident(*buf, T_VAR, ident_buf) ;
-            ident_ind = 0;
-        }
+/**
+ * @brief Lex the next token of the source
+ *
+ * @return 0 on success, ERR_OOB at the end of the source, ERR_* otherwise
+ */
+int _lex_token(lexer_t *lx) {
+    unsigned char c;
+    int res;
+    for (;;) {
+        if (lx->p == lx->end && (res = _lex_refill(lx)) != 0)
+            return res < 0 ? res : ERR_OOB;
 
-        switch (ch) {
+        if (_is_ident(c = *lx->p))
+            return _lex_ident(lx);
+
+        lx->p++;
+        switch (c) {
             case ('('):
-                _push_sym(*buf, T_LPAREN);
-                break;
+                lx->kind = T_LPAREN;
+                return 0;
             case (')'):
-                _push_sym(*buf, T_RPAREN);
-                break;
+                lx->kind = T_RPAREN;
+                return 0;
             case ('.'):
-                _push_sym(*buf, T_DOT);
-                break;
+                lx->kind = T_DOT;
+                return 0;
             case ('\\'):
-                _push_sym(*buf, T_BSLASH);
-                break;
+                lx->kind = T_BSLASH;
+                return 0;
             case (' '):
             case ('\t'):
             case ('\r'):
@@ -216,20 +191,92 @@ int lex(FILE *fp, dyn_buf_t **buf, char eof) {
                 break;
             default:
                 res = ERR_SEMANTICS;
-                err_report("Character %c not recognized\n", res, ch);
-                goto cleanup_buf;
+                err_report("Character %c not recognized\n", res, c);
+                return res;
         }
     }
+}
+
+/**
+ * @brief Start lexing a file, terminating at eof character
+ *
+ * @param lx Lexer to set up, release with `lexer_free`
+ * @param fp File pointer (stdin or some file). A regular file lexed to EOF
+ *        is mapped as a whole, regardless of its position
+ * @param eof Terminating character (i.e. \n for interpreter)
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int lexer_init(lexer_t *lx, FILE *fp, char eof) {
+    if (lx == NULL || fp == NULL)
+        return ERR_INP;
+
+    memset(lx, 0, sizeof(lexer_t));
+    lx->fp = fp;
+    lx->eof = eof;
+    if (eof == EOF)
+        _lex_map(lx);
+
+    return 0;
+}
+
+/**
+ * @brief Look at the next token without taking it
+ *
+ * @param kind Kind of the token is stored here if not NULL
+ * @param sym Name of a T_VAR token is stored here if not NULL
+ *
+ * @return 0 on success, ERR_OOB at the end of the source, ERR_* otherwise
+ */
+int lexer_peek(lexer_t *lx, token_e *kind, sym_t *sym) {
+    if (lx->err < 0)
+        return lx->err;
+
+    int res;
+    if (!lx->peeked) {
+        if ((res = _lex_token(lx)) < 0)
+            return lx->err = res;
+
+        lx->peeked = 1;
+    }
 
-    res = 0;
+    if (kind != NULL)
+        *kind = lx->kind;
 
-cleanup_buf:
-    free(ident_buf);
+    if (sym != NULL)
+        *sym = lx->sym;
+
+    return 0;
+}
+
+/**
+ * @brief Take the next token, see `lexer_peek`
+ */
+int lexer_next(lexer_t *lx, token_e *kind, sym_t *sym) {
+    int res;
+    if ((res = lexer_peek(lx, kind, sym)) < 0)
+        return res;
+
+    lx->peeked = 0;
+    lx->count++;
+    return 0;
+}
+
+/**
+ * @brief Release the lexer. Whatever is left of a terminated source is
+ *        skipped, so the next read starts past the terminating character
+ */
+void lexer_free(lexer_t *lx) {
+    int ch;
+    if (!lx->done && lx->eof != EOF) {
+        while ((ch = fgetc(lx->fp)) != EOF && (char)ch != lx->eof) { }
+    }
 
-cleanup_dyn_buf:
-    if (res != 0)
-        dyn_buf_free(*buf, GET_VOID_FREE(free_token));
+#ifdef LEX_MMAP
+    if (lx->map != NULL)
+        munmap(lx->map, lx->map_len);
+#endif
 
-cleanup_default:
-    return res;
+    free(lx->buf);
+    memset(lx, 0, sizeof(lexer_t));
 }
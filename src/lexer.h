@@ -10,11 +10,15 @@
 #define _LEXER_H_
 
 #include <stdio.h>
+#include <stddef.h>
 
-#include <lib/dyn_buf.h>
+#include "symbol.h"
 
 #define MAX_VAR_LEN 64
 
+/* Bytes read from a stream that can't be mapped at a time */
+#define LEX_READ_CHUNK (0x10000)
+
 /**
  * @brief All types of tokens enumerated
  */
@@ -27,21 +31,44 @@ typedef enum _token_e {
 } token_e;
 
 /**
- * @brief Token struct for representing every type of token
+ * @brief Lexer handing out tokens one at a time as the parser asks for
+ *        them, so no more than one token is ever held. Public so that it can
+ *        live on the stack
  */
-typedef struct _token {
-    /* Represents type of the token */
-    token_e type;
+typedef struct _lexer {
+    FILE *fp;
+
+    /* Terminating character (i.e. \n for interpreter), EOF for none */
+    char eof;
+
+    /* Unread part of the source: all of a mapped file, otherwise the last
+     * chunk read into `buf` */
+    const unsigned char *p;
+    const unsigned char *end;
+    unsigned char *buf;
+
+    /* Mapping of the file, NULL if it is being read instead */
+    void *map;
+    size_t map_len;
+
+    /* Set once the terminating character or the end of file is read */
+    int done;
 
-    /* NULL whenever non-VAR type token */
-    char *ident;
-} token_t;
+    /* Token looked at but not yet taken, if `peeked` */
+    int peeked;
+    token_e kind;
+    sym_t sym;
 
-MAKE_VOID_FREE_DEF(free_token)
+    /* First ERR_* hit, every later token is that error */
+    int err;
 
-int lex(FILE *fp, dyn_buf_t **buf, char eof);
-void format_tokens(dyn_buf_t *buf);
-void free_token(token_t *token);
+    /* Number of tokens taken so far */
+    int count;
+} lexer_t;
 
+int lexer_init(lexer_t *lx, FILE *fp, char eof);
+int lexer_peek(lexer_t *lx, token_e *kind, sym_t *sym);
+int lexer_next(lexer_t *lx, token_e *kind, sym_t *sym);
+void lexer_free(lexer_t *lx);
 
 #endif /* _LEXER_H_ */
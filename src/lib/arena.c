@@ -0,0 +1,219 @@
+/**
+ * @file arena.c
+ *
+ * @brief Region allocator implementation
+ *
+ * Allocations are bumped off the newest chunk. When it runs dry a fresh
+ * chunk is chained in front of it, so a chunk is never revisited once it
+ * fills up. Elements released individually are pushed onto a free list
+ * for their size class and handed out again before the bump pointer is
+ * touched, which keeps the footprint flat for workloads that repeatedly
+ * free and allocate nodes of the same shape.
+ *
+ * @author Lars Wander
+ */
+
+#include <lib/arena.h>
+#include <err.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena_private.h"
+
+/* Offset from chunk header to the first usable byte */
+#define ARENA_HDR_SIZE (_arena_round(sizeof(achunk_t)))
+
+static inline size_t _arena_round(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static inline char *_arena_chunk_data(achunk_t *chunk) {
+    return (char *)chunk + ARENA_HDR_SIZE;
+}
+
+/**
+ * @brief Create a new arena
+ *
+ * @param chunk_size Bytes to reserve per chunk, 0 for ARENA_DEFAULT_CHUNK
+ *
+ * @return New arena on success, NULL otherwise
+ */
+arena_t *arena_new(size_t chunk_size) {
+    arena_t *res;
+    if ((res = calloc(1, sizeof(arena_t))) == NULL)
+        return NULL;
+
+    if (chunk_size == 0)
+        chunk_size = ARENA_DEFAULT_CHUNK;
+
+    res->chunk_size = _arena_round(chunk_size);
+    return res;
+}
+
+/**
+ * @brief Chain a fresh chunk with at least `size` usable bytes
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _arena_grow(arena_t *arena, size_t size) {
+    size_t csize = arena->chunk_size;
+    if (size > csize)
+        csize = size;
+
+    achunk_t *chunk;
+    if ((chunk = malloc(ARENA_HDR_SIZE + csize)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    chunk->size = csize;
+    chunk->used = 0;
+
+    /* A dedicated chunk for an oversized element goes behind the head so
+     * the remainder of the head chunk stays usable */
+    if (size > arena->chunk_size && arena->head != NULL) {
+        chunk->next = arena->head->next;
+        arena->head->next = chunk;
+    } else {
+        chunk->next = arena->head;
+        arena->head = chunk;
+    }
+
+    arena->reserved_bytes += csize;
+    arena->chunks++;
+    return 0;
+}
+
+/**
+ * @brief Allocate `size` bytes from the arena. The memory is not zeroed
+ *
+ * @param arena Arena being allocated from
+ * @param size Bytes required
+ *
+ * @return Pointer to memory on success, NULL otherwise
+ */
+void *arena_alloc(arena_t *arena, size_t size) {
+    if (arena == NULL || size == 0)
+        return NULL;
+
+    size = _arena_round(size);
+
+    void *res;
+    size_t cls = size / ARENA_ALIGN - 1;
+    if (size <= ARENA_MAX_RECYCLE && arena->free_lists[cls] != NULL) {
+        afree_t *elem = arena->free_lists[cls];
+        arena->free_lists[cls] = elem->next;
+        arena->recycled++;
+        res = elem;
+        goto success;
+    }
+
+    achunk_t *chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        if (_arena_grow(arena, size) < 0)
+            return NULL;
+
+        /* Oversized elements get a chunk of their own behind the head */
+        chunk = arena->head;
+        if (chunk->size - chunk->used < size)
+            chunk = chunk->next;
+    }
+
+    res = _arena_chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+
+success:
+    arena->allocs++;
+    arena->live_bytes += size;
+    if (arena->live_bytes > arena->high_water)
+        arena->high_water = arena->live_bytes;
+
+    return res;
+}
+
+/**
+ * @brief Hand a single element back to the arena for reuse
+ *
+ * @param arena Arena the element was allocated from
+ * @param elem Element being released (NULL is ignored)
+ * @param size Size the element was allocated with
+ */
+void arena_release(arena_t *arena, void *elem, size_t size) {
+    if (arena == NULL || elem == NULL)
+        return;
+
+    size = _arena_round(size);
+    arena->releases++;
+    arena->live_bytes -= size;
+
+    /* Large elements are simply abandoned until the next reset */
+    if (size > ARENA_MAX_RECYCLE)
+        return;
+
+    size_t cls = size / ARENA_ALIGN - 1;
+    afree_t *node = elem;
+    node->next = arena->free_lists[cls];
+    arena->free_lists[cls] = node;
+}
+
+/**
+ * @brief Release every element in the arena at once. The oldest chunk is
+ *        kept around so the next workload doesn't start cold. Counters other
+ *        than the live byte count are preserved
+ */
+void arena_reset(arena_t *arena) {
+    if (arena == NULL)
+        return;
+
+    achunk_t *chunk = arena->head;
+    while (chunk != NULL && chunk->next != NULL) {
+        achunk_t *next = chunk->next;
+        arena->reserved_bytes -= chunk->size;
+        arena->chunks--;
+        free(chunk);
+        chunk = next;
+    }
+
+    if (chunk != NULL)
+        chunk->used = 0;
+
+    arena->head = chunk;
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    arena->live_bytes = 0;
+}
+
+/**
+ * @brief Copy the arena's counters into `stats`
+ */
+void arena_stats(arena_t *arena, arena_stats_t *stats) {
+    if (stats == NULL)
+        return;
+
+    memset(stats, 0, sizeof(arena_stats_t));
+    if (arena == NULL)
+        return;
+
+    stats->allocs = arena->allocs;
+    stats->recycled = arena->recycled;
+    stats->releases = arena->releases;
+    stats->live_bytes = arena->live_bytes;
+    stats->high_water = arena->high_water;
+    stats->reserved_bytes = arena->reserved_bytes;
+    stats->chunks = arena->chunks;
+}
+
+/**
+ * @brief Delete the arena and every chunk it holds
+ */
+void arena_free(arena_t *arena) {
+    if (arena == NULL)
+        return;
+
+    achunk_t *chunk = arena->head;
+    while (chunk != NULL) {
+        achunk_t *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
@@ -0,0 +1,61 @@
+/**
+ * @file arena_private.h
+ *
+ * @brief Arena data structure internals
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _ARENA_PRIVATE_H_
+#define _ARENA_PRIVATE_H_
+
+#include <stddef.h>
+
+/* Every allocation is rounded up to a multiple of this */
+#define ARENA_ALIGN (sizeof(void *) > 8 ? sizeof(void *) : 8)
+
+/* Released elements up to this size are recycled through free lists */
+#define ARENA_MAX_RECYCLE (128)
+
+#define ARENA_CLASSES (ARENA_MAX_RECYCLE / ARENA_ALIGN)
+
+/**
+ * @brief A single contiguous region, chunks are chained newest first
+ */
+typedef struct achunk {
+    struct achunk *next;
+
+    /* Usable bytes following this header */
+    size_t size;
+
+    /* Bytes already bumped off the region */
+    size_t used;
+} achunk_t;
+
+/**
+ * @brief Released element, threaded through the element's own memory
+ */
+typedef struct afree {
+    struct afree *next;
+} afree_t;
+
+typedef struct _arena {
+    /* Chunk currently being bumped from */
+    achunk_t *head;
+
+    /* Size requested for new chunks */
+    size_t chunk_size;
+
+    /* One free list per size class (ARENA_ALIGN * (i + 1) bytes) */
+    afree_t *free_lists[ARENA_CLASSES];
+
+    unsigned long allocs;
+    unsigned long recycled;
+    unsigned long releases;
+    size_t live_bytes;
+    size_t high_water;
+    size_t reserved_bytes;
+    int chunks;
+} arena_t;
+
+#endif /* _ARENA_PRIVATE_H_ */
@@ -94,6 +94,28 @@ cleanup_default:
     return res;
 }
 
+/**
+ * @brief Remove the most recently pushed element
+ *
+ * @param dyn Buffer being shrunk
+ * @param elem On success, the removed element is placed here if not NULL
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int dyn_buf_pop(dyn_buf_t *dyn, void **elem) {
+    if (dyn == NULL)
+        return ERR_INP;
+
+    if (dyn->cur_size == 0)
+        return ERR_OOB;
+
+    dyn->cur_size--;
+    if (elem != NULL)
+        *elem = dyn->buf[dyn->cur_size];
+
+    return 0;
+}
+
 /**
  * @brief Access element at specified index. Fails if OOB
  *
@@ -3,8 +3,16 @@
  *
  * @brief Hash table implementation
  *
- * The hash table is an array linked lists. Elements that hash to the
- * same value are stored in the same list inside the array.
+ * The hash table is open addressed in the style of a Swiss table. Every
+ * slot has a control byte, saying whether it is empty, deleted, or holds an
+ * element & 7 bits of that element's hash. Slots are probed a group of
+ * HTABLE_GROUP at a time by matching all of the group's control bytes at
+ * once, so a key is only ever compared against the rare slot whose 7 bits
+ * agree. Groups are probed in triangular order, which visits every group
+ * of a power of 2 sized table.
+ *
+ * Keys are copied back to back into a single pool rather than allocated
+ * one by one. The pool is compacted whenever the table is rebuilt.
  *
  * @author Lars Wander
  */
@@ -15,30 +23,233 @@
 
 #include <lib/hashtable.h>
 #include <err.h>
-#include <util.h>
 
 #include "hashtable_private.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief Length of `key` as far as the table is concerned
+ */
+static inline uint32_t _key_len(const char *key) {
+    uint32_t len = 0;
+    while (len < HTABLE_MAX_KEY_LEN && key[len] != '\0')
+        len++;
+
+    return len;
+}
+
+/**
+ * @brief 64 bit FNV-1a, mixed so that every bit of the result depends on
+ *        every byte of the key, folded to 32 bits
+ */
+static inline uint32_t _hash(const char *key, uint32_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (uint32_t i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)key[i]) * 0x100000001b3ULL;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+#ifndef __SSE2__
+/**
+ * @brief Gather the top bit of each byte of `w` into bit i for byte i
+ */
+static inline uint32_t _swar_pack(uint64_t w) {
+    return (uint32_t)((((w >> 7) & 0x0101010101010101ULL) *
+                0x0102040810204080ULL) >> 56);
+}
+
+/**
+ * @brief Load 8 control bytes with byte i as the i'th lowest
+ */
+static inline uint64_t _swar_load(const uint8_t *ctrl) {
+    uint64_t w;
+    memcpy(&w, ctrl, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+#endif /* __SSE2__ */
+
+/**
+ * @brief Bit i is set for each slot i of the group at `ctrl` whose control
+ *        byte is `c`
+ */
+static inline uint32_t _group_match(const uint8_t *ctrl, uint8_t c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)c)));
+#else
+    const uint64_t lo = 0x7F7F7F7F7F7F7F7FULL;
+    uint32_t mask = 0;
+    for (int half = 0; half < 2; half++) {
+        /* Zero bytes of `x` are the matches, found without carries leaking
+         * from one byte to the next */
+        uint64_t x = _swar_load(ctrl + 8 * half) ^
+            (0x0101010101010101ULL * c);
+        mask |= _swar_pack(~(((x & lo) + lo) | x | lo)) << (8 * half);
+    }
+
+    return mask;
+#endif
+}
+
+/**
+ * @brief Bit i is set for each slot i of the group at `ctrl` that is empty
+ *        or deleted, which are the control bytes with their top bit set
+ */
+static inline uint32_t _group_free(const uint8_t *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+#else
+    return _swar_pack(_swar_load(ctrl)) |
+        (_swar_pack(_swar_load(ctrl + 8)) << 8);
+#endif
+}
+
+/**
+ * @brief Find the slot holding `key`
+ *
+ * @return Index of the slot, -1 if the key isn't in the table
+ */
+static int _find(htable_t *ht, const char *key, uint32_t len, uint32_t hash) {
+    uint32_t groups = ht->table_size / HTABLE_GROUP - 1;
+    uint32_t g = (hash >> 7) & groups;
+    for (uint32_t step = 1; ; step++) {
+        const uint8_t *ctrl = ht->ctrl + g * HTABLE_GROUP;
+        for (uint32_t m = _group_match(ctrl, hash & 0x7F); m != 0;
+                m &= m - 1) {
+            int i = g * HTABLE_GROUP + __builtin_ctz(m);
+            hslot_t *s = &ht->slots[i];
+            if (s->hash == hash && s->len == len &&
+                    memcmp(ht->pool + s->key, key, len) == 0)
+                return i;
+        }
+
+        /* An insert would have stopped here */
+        if (_group_match(ctrl, HCTRL_EMPTY) != 0)
+            return -1;
+
+        g = (g + step) & groups;
+    }
+}
+
+/**
+ * @brief First empty or deleted slot along the probe sequence of `hash`
+ */
+static int _free_slot(htable_t *ht, uint32_t hash) {
+    uint32_t groups = ht->table_size / HTABLE_GROUP - 1;
+    uint32_t g = (hash >> 7) & groups;
+    uint32_t m;
+    for (uint32_t step = 1; ; step++) {
+        if ((m = _group_free(ht->ctrl + g * HTABLE_GROUP)) != 0)
+            return g * HTABLE_GROUP + __builtin_ctz(m);
+
+        g = (g + step) & groups;
+    }
+}
+
+/**
+ * @brief Make room for `len` more bytes in the key pool
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _pool_reserve(htable_t *ht, uint32_t len) {
+    if (ht->pool_cap - ht->pool_len >= len)
+        return 0;
+
+    uint32_t cap = ht->pool_cap == 0 ? HTABLE_INIT_POOL : ht->pool_cap;
+    while (cap - ht->pool_len < len)
+        cap *= 2;
+
+    char *pool;
+    if ((pool = realloc(ht->pool, cap)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    ht->pool = pool;
+    ht->pool_cap = cap;
+    return 0;
+}
+
 /**
- * @brief Compute index into hashtable for given key
+ * @brief Allocate empty slots & control bytes for `size` slots
  *
- * @param ht Hash table the index is computed for
- * @param key Key being hashed
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _alloc_slots(int size, uint8_t **ctrl, hslot_t **slots) {
+    if ((*ctrl = malloc(size)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    if ((*slots = malloc(size * sizeof(hslot_t))) == NULL) {
+        free(*ctrl);
+        return ERR_MEM_ALLOC;
+    }
+
+    memset(*ctrl, HCTRL_EMPTY, size);
+    return 0;
+}
+
+/**
+ * @brief Rebuild the table without any deleted slots or dead keys, doubling
+ *        it until it is at most half as full as it may get
  *
- * @return Hashed key -> index
+ * @return 0 on success, ERR_* otherwise
  */
-unsigned int htable_hash(htable_t *ht, char *key) {
-    int i = 0;
-    unsigned int hash = 0;
-    char ch;
-    while ((ch = key[i]) != '\0') {
-        hash += (HASH_LINEAR * ch + HASH_OFFSET);
-        i++;
-        if (i > HTABLE_MAX_KEY_LEN)
-            break;
+static int _rehash(htable_t *ht) {
+    int size = ht->table_size;
+    while (ht->elem_count + 1 > size / 16 * HTABLE_LOAD_FACTOR)
+        size *= 2;
+
+    uint8_t *ctrl;
+    hslot_t *slots;
+    int res;
+    if ((res = _alloc_slots(size, &ctrl, &slots)) < 0)
+        return res;
+
+    uint32_t pool_cap = HTABLE_INIT_POOL;
+    while (pool_cap < ht->pool_len - ht->pool_dead)
+        pool_cap *= 2;
+
+    char *pool;
+    if ((pool = malloc(pool_cap)) == NULL) {
+        free(ctrl);
+        free(slots);
+        return ERR_MEM_ALLOC;
+    }
+
+    htable_t old = *ht;
+    ht->table_size = size;
+    ht->ctrl = ctrl;
+    ht->slots = slots;
+    ht->deleted_count = 0;
+    ht->pool = pool;
+    ht->pool_len = 0;
+    ht->pool_cap = pool_cap;
+    ht->pool_dead = 0;
+    for (int i = 0; i < old.table_size; i++) {
+        if (old.ctrl[i] & HCTRL_EMPTY)
+            continue;
+
+        hslot_t *s = &old.slots[i];
+        int j = _free_slot(ht, s->hash);
+        ht->ctrl[j] = old.ctrl[i];
+        ht->slots[j] = *s;
+        ht->slots[j].key = ht->pool_len;
+        memcpy(ht->pool + ht->pool_len, old.pool + s->key, s->len);
+        ht->pool_len += s->len;
     }
 
-    return hash % ht->table_size;
+    free(old.ctrl);
+    free(old.slots);
+    free(old.pool);
+    return 0;
 }
 
 htable_t *htable_new() {
@@ -46,14 +257,12 @@ htable_t *htable_new() {
     if (res == NULL)
         return NULL;
 
-    res->table = calloc(sizeof(hnode_t *), HTABLE_INIT_SIZE);
-    res->table_size = HTABLE_INIT_SIZE;
-
-    if (res->table == NULL) {
+    if (_alloc_slots(HTABLE_INIT_SIZE, &res->ctrl, &res->slots) < 0) {
         free(res);
         return NULL;
     }
 
+    res->table_size = HTABLE_INIT_SIZE;
     return res;
 }
 
@@ -71,39 +280,40 @@ int htable_insert(htable_t *ht, char *key, int value) {
     if (ht == NULL)
         return ERR_INP;
 
-    int ind = htable_hash(ht, key);
-    hnode_t **hnode_p = ht->table + ind;
-    while (*hnode_p != NULL) {
-        /* Overwrite old value on collision */
-        if (strncmp((*hnode_p)->key, key, HTABLE_MAX_KEY_LEN) == 0) {
-            (*hnode_p)->value = value;
-            return 0;
-        }
-
-        hnode_p = &(*hnode_p)->next;
+    uint32_t len = _key_len(key);
+    uint32_t hash = _hash(key, len);
+    int i;
+    if ((i = _find(ht, key, len, hash)) >= 0) {
+        ht->slots[i].value = value;
+        return 0;
     }
 
-    /* Key wasn't found, so allocate a fresh node */
-    *hnode_p = malloc(sizeof(hnode_t));
-    if (*hnode_p == NULL)
-        return ERR_MEM_ALLOC;
-
-    size_t nlen;
-    MIN(nlen, strlen(key), HTABLE_MAX_KEY_LEN);
-    if (((*hnode_p)->key = malloc(nlen + 1)) == NULL)
-        goto cleanup_hnode;
-
-    strncpy((*hnode_p)->key, key, nlen + 1);
-    (*hnode_p)->key[nlen] = '\0';
-
-    (*hnode_p)->value = value;
-    (*hnode_p)->next = NULL;
-
+    /* Grow when too full, & clear out deleted slots & keys when they take
+     * up too much */
+    int res;
+    if ((ht->elem_count + ht->deleted_count + 1 >
+                ht->table_size / 8 * HTABLE_LOAD_FACTOR ||
+                ht->pool_dead > ht->pool_cap / 2) &&
+            (res = _rehash(ht)) < 0)
+        return res;
+
+    if ((res = _pool_reserve(ht, len)) < 0)
+        return res;
+
+    i = _free_slot(ht, hash);
+    if (ht->ctrl[i] == HCTRL_DELETED)
+        ht->deleted_count--;
+
+    ht->ctrl[i] = hash & 0x7F;
+    hslot_t *s = &ht->slots[i];
+    s->hash = hash;
+    s->key = ht->pool_len;
+    s->len = len;
+    s->value = value;
+    memcpy(ht->pool + ht->pool_len, key, len);
+    ht->pool_len += len;
+    ht->elem_count++;
     return 0;
-
-cleanup_hnode:
-    free(*hnode_p);
-    return ERR_MEM_ALLOC;
 }
 
 /**
@@ -119,19 +329,15 @@ int htable_lookup(htable_t *ht, char *key, int *value) {
     if (ht == NULL)
         return ERR_INP;
 
-    int ind = htable_hash(ht, key);
-    hnode_t **hnode_p = ht->table + ind;
-    while (*hnode_p != NULL) {
-        if (strncmp((*hnode_p)->key, key, HTABLE_MAX_KEY_LEN) == 0) {
-            if (value != NULL)
-                *value = (*hnode_p)->value;
-            return 0;
-        }
+    uint32_t len = _key_len(key);
+    int i;
+    if ((i = _find(ht, key, len, _hash(key, len))) < 0)
+        return -1;
 
-        hnode_p = &(*hnode_p)->next;
-    }
+    if (value != NULL)
+        *value = ht->slots[i].value;
 
-    return -1;
+    return 0;
 }
 
 /**
@@ -147,24 +353,27 @@ int htable_delete(htable_t *ht, char *key, int *value) {
     if (ht == NULL)
         return ERR_INP;
 
-    int ind = htable_hash(ht, key);
-    hnode_t **hnode_p = ht->table + ind;
-    while (*hnode_p != NULL) {
-        if (strncmp((*hnode_p)->key, key, HTABLE_MAX_KEY_LEN) == 0) {
-            if (value != NULL)
-                *value = (*hnode_p)->value;
-
-            hnode_t *next = (*hnode_p)->next;
-            free((*hnode_p)->key);
-            free(*hnode_p);
-            *hnode_p = next;
-            return 0;
-        }
-
-        hnode_p = &(*hnode_p)->next;
+    uint32_t len = _key_len(key);
+    int i;
+    if ((i = _find(ht, key, len, _hash(key, len))) < 0)
+        return -1;
+
+    if (value != NULL)
+        *value = ht->slots[i].value;
+
+    /* No probe ever went past a group with an empty slot, so the slot can
+     * be emptied outright. Otherwise probes must still be sent on past it */
+    const uint8_t *ctrl = ht->ctrl + i / HTABLE_GROUP * HTABLE_GROUP;
+    if (_group_match(ctrl, HCTRL_EMPTY) != 0) {
+        ht->ctrl[i] = HCTRL_EMPTY;
+    } else {
+        ht->ctrl[i] = HCTRL_DELETED;
+        ht->deleted_count++;
     }
 
-    return -1;
+    ht->pool_dead += ht->slots[i].len;
+    ht->elem_count--;
+    return 0;
 }
 
 
@@ -176,21 +385,18 @@ int htable_delete(htable_t *ht, char *key, int *value) {
  *
  */
 void htable_free(htable_t *ht, void (*free_val)(int)) {
-    int i;
-    for (i = 0; i < ht->table_size; i++) {
-        hnode_t *hnode_p = ht->table[i];
-        while (hnode_p != NULL) {
-            hnode_t *next = hnode_p->next;
-            free(hnode_p->key);
-            if (free_val != NULL)
-                (*free_val)(hnode_p->value);
-
-            free(hnode_p);
-            hnode_p = next;
+    if (ht == NULL)
+        return;
+
+    if (free_val != NULL) {
+        for (int i = 0; i < ht->table_size; i++) {
+            if (!(ht->ctrl[i] & HCTRL_EMPTY))
+                (*free_val)(ht->slots[i].value);
         }
     }
 
-    free(ht->table);
+    free(ht->ctrl);
+    free(ht->slots);
+    free(ht->pool);
     free(ht);
 }
-
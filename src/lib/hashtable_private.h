@@ -3,42 +3,62 @@
  *
  * @brief Hash table data structure internals
  *
- * @author Lars Wander 
+ * @author Lars Wander
  */
 
 #ifndef _HASH_TABLE_PRIVATE_H_
 #define _HASH_TABLE_PRIVATE_H_
 
-/* Minimum table size : element count ratio */
-#define HTABLE_LOAD_FACTOR (4)
+#include <stdint.h>
 
-/* Starting table size */
+/* The table grows once more than LOAD_FACTOR / 8 of its slots are taken,
+ * counting deleted ones */
+#define HTABLE_LOAD_FACTOR (7)
+
+/* Starting table size, a power of 2 multiple of HTABLE_GROUP */
 #define HTABLE_INIT_SIZE (16)
 
-/* Linear hash constants to compute hash = HASH_LINEAR * key + HASH_OFFSET
- * Taken from CMU 15-122 (S12) HW6 hashmap code */
-#define HASH_LINEAR 1664525
-#define HASH_OFFSET 1013904223
+/* Slots whose control bytes are probed at once */
+#define HTABLE_GROUP (16)
+
+/* Starting size of the key pool */
+#define HTABLE_INIT_POOL (0x100)
+
+/* Control byte of a slot that was never used, & of one whose element was
+ * deleted. A used slot's control byte is the low 7 bits of its hash */
+#define HCTRL_EMPTY (0x80)
+#define HCTRL_DELETED (0xFE)
 
 #define HTABLE_MAX_KEY_LEN (128)
 
 /**
- * @brief Node containing hash data & key pair
+ * @brief Slot holding a key & its value, the key lives in the table's pool
  */
-typedef struct hnode {
-    char *key;
+typedef struct hslot {
+    /* Low bits of the key's hash, to rule out most keys unread */
+    uint32_t hash;
+    /* Offset & length of the key in the pool */
+    uint32_t key;
+    uint32_t len;
     int value;
-    /* Pointer to next hnode in hashmap list */
-    struct hnode *next;
-} hnode_t;
+} hslot_t;
 
 typedef struct htable {
-    /* Size of underlying array */
+    /* Number of slots, a power of 2 multiple of HTABLE_GROUP */
     int table_size;
     /* # of elements contained in the table */
     int elem_count;
-    /* Array of pointers to hnodes */
-    hnode_t **table;
+    /* # of slots marked HCTRL_DELETED */
+    int deleted_count;
+    /* One control byte per slot */
+    uint8_t *ctrl;
+    hslot_t *slots;
+    /* Keys of every element, back to back */
+    char *pool;
+    uint32_t pool_len;
+    uint32_t pool_cap;
+    /* Bytes of the pool held by keys since deleted */
+    uint32_t pool_dead;
 } htable_t;
 
 #endif /* _HASH_TABLE_PRIVATE_H_ */
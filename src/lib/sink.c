@@ -0,0 +1,142 @@
+/**
+ * @file sink.c
+ *
+ * @brief Byte sink implementation
+ *
+ * Errors are sticky: the first one is recorded in the sink & every later
+ * write becomes a no-op returning it, so callers can write a whole
+ * document & check once at the end.
+ *
+ * @author Lars Wander
+ */
+
+#include <lib/sink.h>
+#include <err.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Set up an empty sink, writing to `fp` if it isn't NULL
+ */
+void sink_init(sink_t *sink, FILE *fp) {
+    sink->buf = NULL;
+    sink->len = 0;
+    sink->cap = 0;
+    sink->fp = fp;
+    sink->err = 0;
+}
+
+/**
+ * @brief Hand everything buffered to the file
+ */
+static int _sink_drain(sink_t *sink) {
+    if (sink->len > 0 &&
+            fwrite(sink->buf, 1, sink->len, sink->fp) != sink->len)
+        return sink->err = ERR_FILE_ACTION;
+
+    sink->len = 0;
+    return 0;
+}
+
+/**
+ * @brief Make room for `len` more bytes, draining a file backed sink first
+ *        if it has buffered enough
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int sink_reserve(sink_t *sink, size_t len) {
+    if (sink->err < 0)
+        return sink->err;
+
+    if (sink->cap - sink->len >= len)
+        return 0;
+
+    if (sink->fp != NULL && sink->len >= SINK_FILE_CHUNK &&
+            _sink_drain(sink) < 0)
+        return sink->err;
+
+    size_t cap = sink->cap == 0 ? SINK_INIT_SIZE : sink->cap;
+    while (cap - sink->len < len)
+        cap *= 2;
+
+    if (cap == sink->cap)
+        return 0;
+
+    char *buf;
+    if ((buf = realloc(sink->buf, cap)) == NULL)
+        return sink->err = ERR_MEM_ALLOC;
+
+    sink->buf = buf;
+    sink->cap = cap;
+    return 0;
+}
+
+/**
+ * @return 0 on success, ERR_* otherwise
+ */
+int sink_write(sink_t *sink, const char *data, size_t len) {
+    if (sink_reserve(sink, len) < 0)
+        return sink->err;
+
+    memcpy(sink->buf + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+/**
+ * @return 0 on success, ERR_* otherwise
+ */
+int sink_puts(sink_t *sink, const char *str) {
+    return sink_write(sink, str, strlen(str));
+}
+
+/**
+ * @brief Append `val` in decimal
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int sink_putu(sink_t *sink, unsigned long val) {
+    char digits[3 * sizeof(unsigned long)];
+    size_t i = sizeof(digits);
+    do {
+        digits[--i] = '0' + val % 10;
+        val /= 10;
+    } while (val > 0);
+
+    return sink_write(sink, digits + i, sizeof(digits) - i);
+}
+
+/**
+ * @brief Write out whatever a file backed sink still buffers
+ *
+ * @return 0 on success, the first ERR_* the sink hit otherwise
+ */
+int sink_flush(sink_t *sink) {
+    if (sink->err < 0 || sink->fp == NULL)
+        return sink->err;
+
+    return _sink_drain(sink);
+}
+
+/**
+ * @brief Contents of the sink as a string. The terminator isn't counted in
+ *        `len`, so writing can carry on afterwards
+ *
+ * @return The string, NULL if there was no room for the terminator
+ */
+const char *sink_str(sink_t *sink) {
+    if (sink_reserve(sink, 1) < 0)
+        return NULL;
+
+    sink->buf[sink->len] = '\0';
+    return sink->buf;
+}
+
+/**
+ * @brief Drop the buffer, without flushing it
+ */
+void sink_free(sink_t *sink) {
+    free(sink->buf);
+    sink_init(sink, sink->fp);
+}
@@ -0,0 +1,514 @@
+/**
+ * @file machine.c
+ *
+ * @brief Krivine, lazy Krivine & CEK machine implementation
+ *
+ * Both machines share one value representation. A closure pairs a term
+ * with the environment its free variables are looked up in; a neutral is a
+ * variable without a value (introduced when reading back under a lambda)
+ * applied to a spine of arguments. Environments, stacks & spines are all
+ * chains of the same cons cell.
+ *
+ * The Krivine machine pushes arguments unevaluated & only ever enters the
+ * head of the term, reaching weak head normal form. The CEK machine
+ * evaluates arguments to values before entering a function, keeping the
+ * pending work in an explicit continuation. The lazy Krivine machine shares
+ * each argument closure between all of its occurrences: entering an
+ * unevaluated one records an update frame, & once the machine reaches a
+ * weak head normal form the closure is overwritten with it. Strong normal
+ * forms are read back by applying lambda values to fresh neutrals, with the
+ * values still to be read back kept on a work stack.
+ *
+ * All machine state lives in one arena that is dropped in bulk once the
+ * normal form has been read back.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <err.h>
+#include <lib/arena.h>
+
+#include "machine.h"
+#include "work.h"
+
+typedef struct _cell cell_t;
+
+/**
+ * @brief A closure (`term` != NULL) or a neutral (`term` == NULL)
+ */
+typedef struct _clos {
+    expr_t *term;
+    cell_t *env;
+
+    /* Neutral: depth of the lambda which introduced the variable */
+    unsigned int level;
+
+    /* Neutral: arguments, most recently applied first */
+    cell_t *spine;
+} clos_t;
+
+/**
+ * @brief Link of an environment (innermost binding first), argument stack
+ *        or spine
+ */
+struct _cell {
+    clos_t *clos;
+    cell_t *next;
+};
+
+/**
+ * @brief Pending CEK work: evaluate an argument, or apply a function to the
+ *        value being returned
+ */
+typedef struct _frame {
+    enum { F_ARG, F_FUN } kind;
+
+    /* F_ARG */
+    expr_t *term;
+    cell_t *env;
+
+    /* F_FUN */
+    clos_t *fun;
+
+    struct _frame *next;
+} frame_t;
+
+/**
+ * @brief Pending update of a call-by-need thunk, performed once the stack
+ *        is back to the one the thunk was entered with
+ */
+typedef struct _update {
+    clos_t *thunk;
+    cell_t *stack;
+    struct _update *next;
+} update_t;
+
+typedef struct _mach {
+    machine_e kind;
+    arena_t *arena;
+} mach_t;
+
+/* Beta reductions performed by the last evaluation */
+static unsigned long _machine_steps = 0;
+
+static clos_t *_clos(mach_t *m, expr_t *term, cell_t *env) {
+    clos_t *res;
+    if ((res = arena_alloc(m->arena, sizeof(clos_t))) == NULL)
+        return NULL;
+
+    res->term = term;
+    res->env = env;
+    res->level = 0;
+    res->spine = NULL;
+    return res;
+}
+
+static clos_t *_neutral(mach_t *m, unsigned int level, cell_t *spine) {
+    clos_t *res;
+    if ((res = _clos(m, NULL, NULL)) == NULL)
+        return NULL;
+
+    res->level = level;
+    res->spine = spine;
+    return res;
+}
+
+static cell_t *_cons(mach_t *m, clos_t *clos, cell_t *next) {
+    cell_t *res;
+    if (clos == NULL || (res = arena_alloc(m->arena, sizeof(cell_t))) == NULL)
+        return NULL;
+
+    res->clos = clos;
+    res->next = next;
+    return res;
+}
+
+/**
+ * @brief Value bound to de Bruijn index `index`
+ */
+static inline clos_t *_env_at(cell_t *env, unsigned int index) {
+    while (index-- > 0)
+        env = env->next;
+
+    return env->clos;
+}
+
+/**
+ * @brief Apply a neutral to the arguments on a Krivine stack
+ */
+static clos_t *_neutral_apply(mach_t *m, clos_t *neutral, cell_t *stack) {
+    cell_t *spine = neutral->spine;
+    for (; stack != NULL; stack = stack->next)
+        if ((spine = _cons(m, stack->clos, spine)) == NULL)
+            return NULL;
+
+    return _neutral(m, neutral->level, spine);
+}
+
+/**
+ * @brief Run the Krivine machine to weak head normal form
+ *
+ * @return Lambda closure or neutral on success, NULL otherwise
+ */
+static clos_t *_krivine_whnf(mach_t *m, expr_t *term, cell_t *env) {
+    cell_t *stack = NULL;
+    cell_t *top;
+    clos_t *clos;
+    for (;;) {
+        switch (term->type) {
+            case (VAR):
+                clos = _env_at(env, term->var.index);
+                if (clos->term == NULL)
+                    return _neutral_apply(m, clos, stack);
+
+                term = clos->term;
+                env = clos->env;
+                break;
+            case (APPL):
+                if ((stack = _cons(m, _clos(m, term->appl.x, env),
+                        stack)) == NULL)
+                    return NULL;
+
+                term = term->appl.f;
+                break;
+            case (LAMBDA):
+                if (stack == NULL)
+                    return _clos(m, term, env);
+
+                /* The argument's stack cell becomes its environment cell */
+                top = stack;
+                stack = stack->next;
+                top->next = env;
+                env = top;
+                term = term->lam.body;
+                _machine_steps++;
+                break;
+            default:
+                return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Is `clos` a value (lambda closure or neutral) rather than a thunk
+ */
+static inline int _is_value(clos_t *clos) {
+    return clos->term == NULL || clos->term->type == LAMBDA;
+}
+
+/**
+ * @brief Overwrite the thunks of all update frames entered with `stack`.
+ *        `val` is the value reached, `base` the neutral it is headed by
+ *        (in which case `val` is NULL)
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _need_update(mach_t *m, update_t **updates, cell_t *stack,
+        clos_t *val, clos_t *base) {
+    while (*updates != NULL) {
+        update_t *update = *updates;
+        clos_t *res = val;
+
+        /* A neutral thunk is applied to the arguments pushed since */
+        if (val == NULL) {
+            cell_t *spine = base->spine;
+            for (cell_t *arg = stack; arg != update->stack; arg = arg->next)
+                if ((spine = _cons(m, arg->clos, spine)) == NULL)
+                    return ERR_MEM_ALLOC;
+
+            if ((res = _neutral(m, base->level, spine)) == NULL)
+                return ERR_MEM_ALLOC;
+        } else if (update->stack != stack) {
+            break;
+        }
+
+        *update->thunk = *res;
+        *updates = update->next;
+        arena_release(m->arena, update, sizeof(update_t));
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Run the lazy Krivine machine to weak head normal form
+ *
+ * @param thunk If not NULL, the thunk `term` & `env` were taken from; it is
+ *        updated with the result
+ *
+ * @return Lambda closure or neutral on success, NULL otherwise
+ */
+static clos_t *_need_whnf(mach_t *m, expr_t *term, cell_t *env,
+        clos_t *thunk) {
+    cell_t *stack = NULL;
+    update_t *updates = NULL;
+    update_t *update;
+    cell_t *top;
+    clos_t *clos;
+
+    if (thunk != NULL) {
+        if ((updates = arena_alloc(m->arena, sizeof(update_t))) == NULL)
+            return NULL;
+
+        updates->thunk = thunk;
+        updates->stack = NULL;
+        updates->next = NULL;
+    }
+
+    for (;;) {
+        switch (term->type) {
+            case (VAR):
+                clos = _env_at(env, term->var.index);
+                if (clos->term == NULL) {
+                    if (_need_update(m, &updates, stack, NULL, clos) < 0)
+                        return NULL;
+
+                    return _neutral_apply(m, clos, stack);
+                }
+
+                /* Evaluate a shared argument once, in its own context */
+                if (!_is_value(clos)) {
+                    if ((update = arena_alloc(m->arena,
+                            sizeof(update_t))) == NULL)
+                        return NULL;
+
+                    update->thunk = clos;
+                    update->stack = stack;
+                    update->next = updates;
+                    updates = update;
+                }
+
+                term = clos->term;
+                env = clos->env;
+                break;
+            case (APPL):
+                if ((stack = _cons(m, _clos(m, term->appl.x, env),
+                        stack)) == NULL)
+                    return NULL;
+
+                term = term->appl.f;
+                break;
+            case (LAMBDA):
+                if (updates != NULL && updates->stack == stack) {
+                    if ((clos = _clos(m, term, env)) == NULL ||
+                            _need_update(m, &updates, stack, clos, NULL) < 0)
+                        return NULL;
+                }
+
+                if (stack == NULL)
+                    return _clos(m, term, env);
+
+                /* The argument's stack cell becomes its environment cell */
+                top = stack;
+                stack = stack->next;
+                top->next = env;
+                env = top;
+                term = term->lam.body;
+                _machine_steps++;
+                break;
+            default:
+                return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Run the CEK machine to a value
+ *
+ * @return Lambda closure or neutral on success, NULL otherwise
+ */
+static clos_t *_cek_eval(mach_t *m, expr_t *term, cell_t *env) {
+    frame_t *k = NULL;
+    frame_t *frame;
+    clos_t *val, *fun;
+    for (;;) {
+        /* Evaluate `term` in `env` until a value is produced */
+        switch (term->type) {
+            case (VAR):
+                val = _env_at(env, term->var.index);
+                break;
+            case (LAMBDA):
+                if ((val = _clos(m, term, env)) == NULL)
+                    return NULL;
+                break;
+            case (APPL):
+                if ((frame = arena_alloc(m->arena, sizeof(frame_t))) == NULL)
+                    return NULL;
+
+                frame->kind = F_ARG;
+                frame->term = term->appl.x;
+                frame->env = env;
+                frame->next = k;
+                k = frame;
+                term = term->appl.f;
+                continue;
+            default:
+                return NULL;
+        }
+
+        /* Return `val` to the continuation until more evaluation is needed */
+        for (;;) {
+            if (k == NULL)
+                return val;
+
+            if (k->kind == F_ARG) {
+                k->kind = F_FUN;
+                k->fun = val;
+                term = k->term;
+                env = k->env;
+                break;
+            }
+
+            frame = k;
+            fun = k->fun;
+            k = k->next;
+            arena_release(m->arena, frame, sizeof(frame_t));
+
+            if (fun->term != NULL) {
+                if ((env = _cons(m, val, fun->env)) == NULL)
+                    return NULL;
+
+                term = fun->term->lam.body;
+                _machine_steps++;
+                break;
+            }
+
+            cell_t *spine;
+            if ((spine = _cons(m, val, fun->spine)) == NULL ||
+                    (val = _neutral(m, fun->level, spine)) == NULL)
+                return NULL;
+        }
+    }
+}
+
+/**
+ * @brief Evaluate `term` in `env` with the selected machine
+ */
+static clos_t *_eval(mach_t *m, expr_t *term, cell_t *env) {
+    switch (m->kind) {
+        case (MACHINE_CEK):
+            return _cek_eval(m, term, env);
+        case (MACHINE_NEED):
+            return _need_whnf(m, term, env, NULL);
+        default:
+            return _krivine_whnf(m, term, env);
+    }
+}
+
+/**
+ * @brief Read back the normal form of `clos` under `depth` lambdas. The tree
+ *        is built top down, each value filling in the slot its parent left
+ *        for it, & the values still to be read back are kept on a work
+ *        stack
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _readback(mach_t *m, clos_t *clos, unsigned int depth,
+        expr_t **out) {
+    work_t w;
+    work_init(&w);
+
+    *out = NULL;
+    int res;
+    if ((res = work_push_node(&w, clos, out, depth, 0)) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        clos = frame.node;
+        depth = frame.depth;
+
+        /* Krivine arguments are unevaluated thunks, which are updated with
+         * their value under call-by-need */
+        if (!_is_value(clos)) {
+            if (m->kind == MACHINE_NEED)
+                clos = _need_whnf(m, clos->term, clos->env, clos);
+            else
+                clos = _eval(m, clos->term, clos->env);
+
+            if (clos == NULL)
+                goto oom;
+        }
+
+        if (clos->term == NULL) {
+            /* A neutral's head applied to its spine. The arguments are
+             * pushed outermost first so they are read back left to right */
+            expr_t **slot = frame.slot;
+            for (cell_t *spine = clos->spine; spine != NULL;
+                    spine = spine->next) {
+                if ((*slot = new_appl(NULL, NULL)) == NULL ||
+                        work_push_node(&w, spine->clos, &(*slot)->appl.x,
+                            depth, 0) < 0)
+                    goto oom;
+
+                slot = &(*slot)->appl.f;
+            }
+
+            if ((*slot = new_var(depth - 1 - clos->level, 0)) == NULL)
+                goto oom;
+
+            continue;
+        }
+
+        /* Go under the lambda with its variable left free */
+        cell_t *env;
+        clos_t *body;
+        if ((env = _cons(m, _neutral(m, depth, NULL), clos->env)) == NULL ||
+                (body = _eval(m, clos->term->lam.body, env)) == NULL ||
+                (*frame.slot = new_lam(clos->term->lam.sym, NULL)) == NULL ||
+                work_push_node(&w, body, &(*frame.slot)->lam.body,
+                    depth + 1, 0) < 0)
+            goto oom;
+    }
+
+    goto cleanup;
+
+oom:
+    res = ERR_MEM_ALLOC;
+    free_expr(*out);
+    *out = NULL;
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Reduce `expr` to normal form on an abstract machine. `expr` is
+ *        shared with the machine but never modified
+ *
+ * @param expr Closed term being evaluated
+ * @param kind See `_machine_e`
+ * @param out Freshly allocated normal form on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int machine_eval(expr_t *expr, machine_e kind, expr_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    mach_t m;
+    m.kind = kind;
+    if ((m.arena = arena_new(MACHINE_ARENA_CHUNK)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    _machine_steps = 0;
+
+    int res = 0;
+    clos_t *clos;
+    if ((clos = _eval(&m, expr, NULL)) == NULL)
+        res = ERR_MEM_ALLOC;
+    else
+        res = _readback(&m, clos, 0, out);
+
+    arena_free(m.arena);
+    return res;
+}
+
+/**
+ * @brief Number of beta reductions performed by the last `machine_eval`
+ */
+unsigned long machine_steps() {
+    return _machine_steps;
+}
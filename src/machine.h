@@ -0,0 +1,41 @@
+/**
+ * @file machine.h
+ *
+ * @brief Environment based abstract machines
+ *
+ * Terms are evaluated with closures & environments instead of substitution,
+ * so the program is never copied or modified. Under call-by-need, every
+ * argument is a single shared thunk that is overwritten with its value the
+ * first time it is needed, so it is reduced at most once. Normal forms are
+ * read back into a fresh expr_t by evaluating under lambdas with free
+ * variables.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _MACHINE_H_
+#define _MACHINE_H_
+
+#include "ast.h"
+
+/* Machine state is small & short lived, so use modest chunks */
+#define MACHINE_ARENA_CHUNK (0x10000)
+
+/**
+ * @brief Supported machines
+ */
+typedef enum _machine_e {
+    /* Krivine machine, call-by-name */
+    MACHINE_KRIVINE,
+
+    /* CEK machine, call-by-value */
+    MACHINE_CEK,
+
+    /* Lazy Krivine machine, call-by-need */
+    MACHINE_NEED
+} machine_e;
+
+int machine_eval(expr_t *expr, machine_e kind, expr_t **out);
+unsigned long machine_steps();
+
+#endif /* _MACHINE_H_ */
@@ -10,21 +10,283 @@
 #include <string.h>
 #include <stdlib.h>
 
-#include <lib/dyn_buf.h>
 #include <err.h>
 #include "parser.h"
 #include "lexer.h"
 #include "ast.h"
 #include "interpreter.h"
+#include "hcons.h"
+#include "machine.h"
+#include "nbe.h"
+#include "inet.h"
+#include "bytecode.h"
+#include "image.h"
+#include "vm.h"
+#include "cgen.h"
+#include "jit.h"
+
+/* Exit status of a run stopped by one of its --max-* limits */
+#define EXIT_BUDGET (3)
 
 const char *help = "Usage: lcc [options] [file]...\n"
 "Options:\n"
 "  -h         Display this message\n"
-"  -i         Launch the interpreter\n";
+"  -i         Launch the interpreter\n"
+"  -H         Evaluate on a hash-consed DAG (same as --engine=hcons)\n"
+"  --engine=E Evaluate with engine E, one of:\n"
+"               step     rewrite the term in place, printing every step\n"
+"               hcons    rewrite a hash-consed DAG with maximal sharing\n"
+"               krivine  call-by-name Krivine machine, prints normal form\n"
+"               cek      call-by-value CEK machine, prints normal form\n"
+"               need     call-by-need graph reduction, each argument is\n"
+"                        reduced at most once, prints normal form\n"
+"               nbe      normalization by evaluation, the fastest way to\n"
+"                        the normal form, prints normal form\n"
+"               inet     optimal reduction of an interaction net, shares\n"
+"                        work under lambdas, prints normal form\n"
+"               vm       compile to bytecode & run it call-by-value,\n"
+"                        prints normal form\n"
+"               jit      compile to x86-64 machine code & run it in\n"
+"                        process (lcc64 only, otherwise as vm), prints\n"
+"                        normal form\n"
+"  --strategy=S Reduce with strategy S on the step engine, one of:\n"
+"               normal       leftmost outermost to normal form (default)\n"
+"               applicative  leftmost innermost to normal form\n"
+"               cbv          call-by-value, stops at a weak normal form\n"
+"               cbn          call-by-name, stops at a weak normal form\n"
+"               whnf         stops at a weak head normal form\n"
+"               hnf          stops at a head normal form\n"
+"  --quiet    Print only the final term (step & hcons engines)\n"
+"  --trace-every=N Print the first term, every Nth step & the final term\n"
+"             (step & hcons engines)\n"
+"  --trace-last=N Print only the final N terms (step & hcons engines)\n"
+"  --max-steps=N Stop after N beta steps (step & hcons engines) or N\n"
+"             rewrites (inet engine)\n"
+"  --max-nodes=N Stop once more than N term nodes are live (step, hcons\n"
+"             & inet engines)\n"
+"  --max-time=MS Stop after MS milliseconds of wall time (step, hcons &\n"
+"             inet engines)\n"
+"             A run that is stopped prints its partial result last, save on\n"
+"             inet, & exits with status 3\n"
+"  --emit-bc=F Compile the file to bytecode in F instead of running it,\n"
+"             bytecode files are run on the VM when given as the file\n"
+"  --emit-bin=F Write the parsed term to the image F instead of running\n"
+"             it, images are loaded without parsing when given as the file\n"
+"  -c         Compile the file to a standalone C program instead of\n"
+"             running it, build it with `gcc -O2`\n"
+"  -o F       Write the output of -c to F rather than stdout\n"
+"  -s         Report AST & symbol pool statistics on exit\n";
+
+/**
+ * @brief Print AST arena & symbol pool counters to stderr so arenas can be
+ *        sized
+ */
+void _report_stats() {
+    arena_stats_t stats;
+    ast_stats(&stats);
+    fprintf(stderr, "ast allocs: %lu (recycled %lu, released %lu)\n",
+            stats.allocs, stats.recycled, stats.releases);
+    fprintf(stderr, "ast bytes: %zu live, %zu high water, %zu reserved in "
+            "%d chunks\n", stats.live_bytes, stats.high_water,
+            stats.reserved_bytes, stats.chunks);
+    fprintf(stderr, "symbols: %d interned, %zu pool bytes\n", sym_count(),
+            sym_pool_bytes());
+
+    if (normalize_steps() > 0)
+        fprintf(stderr, "step beta steps: %lu\n", normalize_steps());
+
+    if (machine_steps() > 0)
+        fprintf(stderr, "machine beta steps: %lu\n", machine_steps());
+
+    if (nbe_steps() > 0)
+        fprintf(stderr, "nbe beta steps: %lu\n", nbe_steps());
+
+    if (inet_rewrites() > 0)
+        fprintf(stderr, "inet rewrites: %lu\n", inet_rewrites());
+
+    if (vm_steps() > 0)
+        fprintf(stderr, "vm closures entered: %lu\n", vm_steps());
+
+    if (jit_code_bytes() > 0)
+        fprintf(stderr, "jit code bytes: %lu\n", jit_code_bytes());
+
+    hc_stats_t hstats;
+    hc_stats(&hstats);
+    if (hstats.lookups > 0)
+        fprintf(stderr, "hash-consed nodes: %lu live, %lu high water, %lu of "
+                "%lu constructions shared\n", hstats.live, hstats.high_water,
+                hstats.hits, hstats.lookups);
+}
+
+/**
+ * @brief Compile `ast` to bytecode & write it to `path`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _emit_bc(expr_t *ast, const char *path) {
+    int res;
+    bc_t *bc;
+    FILE *fp;
+    if (ast == NULL)
+        return 0;
+
+    if ((res = bc_compile(ast, &bc)) < 0)
+        goto cleanup_ast;
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        err_report("Failed to open %s", ERR_FILE_ACTION, path);
+        res = ERR_FILE_ACTION;
+        goto cleanup_bc;
+    }
+
+    res = bc_write(bc, fp);
+    if (fclose(fp) != 0 && res == 0)
+        res = ERR_FILE_ACTION;
+
+cleanup_bc:
+    bc_free(bc);
+
+cleanup_ast:
+    ast_release_all();
+    return res;
+}
+
+/**
+ * @brief Write `ast` to the term image at `path`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _emit_bin(expr_t *ast, const char *path) {
+    int res;
+    FILE *fp;
+    if (ast == NULL)
+        return 0;
+
+    if ((fp = fopen(path, "wb")) == NULL) {
+        err_report("Failed to open %s", ERR_FILE_ACTION, path);
+        res = ERR_FILE_ACTION;
+        goto cleanup_ast;
+    }
+
+    res = img_write(ast, fp);
+    if (fclose(fp) != 0 && res == 0)
+        res = ERR_FILE_ACTION;
+
+cleanup_ast:
+    ast_release_all();
+    return res;
+}
+
+/**
+ * @brief Compile `ast` to C & write it to `path`, stdout if NULL
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _emit_c(expr_t *ast, const char *path) {
+    int res;
+    FILE *fp = stdout;
+    if (ast == NULL)
+        return 0;
+
+    if (path != NULL && (fp = fopen(path, "w")) == NULL) {
+        err_report("Failed to open %s", ERR_FILE_ACTION, path);
+        res = ERR_FILE_ACTION;
+        goto cleanup_ast;
+    }
+
+    res = cgen_emit(ast, fp);
+    if (fp != stdout && fclose(fp) != 0 && res == 0)
+        res = ERR_FILE_ACTION;
+
+cleanup_ast:
+    ast_release_all();
+    return res;
+}
+
+/**
+ * @brief Load a bytecode file & run it on the VM
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _run_bc(FILE *fp, const char *fname) {
+    int res;
+    bc_t *bc;
+    if ((res = bc_read(fp, &bc)) < 0) {
+        err_report("Failed to load bytecode from %s", res, fname);
+        return res;
+    }
+
+    res = eval_bc(bc);
+    bc_free(bc);
+    return res;
+}
+
+/**
+ * @brief Lex & parse the source file behind `fp`
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int _parse_file(FILE *fp, expr_t **ast) {
+    int res;
+    lexer_t lx;
+    if ((res = lexer_init(&lx, fp, EOF)) < 0)
+        return res;
+
+    res = parse(&lx, ast);
+#ifdef _DEBUG_
+    /*
+    if (res == 0)
+        format_ast(*ast); */
+#endif /* _DEBUG_ */
+
+    lexer_free(&lx);
+    return res;
+}
+
+/**
+ * @brief Parse the value of a --max-* option
+ *
+ * @return 0 on success, ERR_INP if `arg` isn't a number
+ */
+int _parse_limit(const char *arg, unsigned long *out) {
+    char *end;
+    *out = strtoul(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0') {
+        err_report("Expected a number, got %s", ERR_INP, arg);
+        return ERR_INP;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Parse the value of a --trace-* option, which must be positive
+ *
+ * @return 0 on success, ERR_INP otherwise
+ */
+int _parse_count(const char *arg, unsigned long *out) {
+    if (_parse_limit(arg, out) < 0)
+        return ERR_INP;
+
+    if (*out == 0) {
+        err_report("Count must be positive", ERR_INP);
+        return ERR_INP;
+    }
+
+    return 0;
+}
 
 int main(int argc, char **argv) {
     int interp = 0;
+    int stats = 0;
+    eval_opts_t opts = {
+        ENGINE_STEP, STRATEGY_NORMAL, { 0, 0, 0 }, TRACE_ALL, 0
+    };
     char *fname = NULL;
+    char *emit_bc = NULL;
+    char *emit_bin = NULL;
+    char *out = NULL;
+    int emit_c = 0;
 
     if (argc == 1) {
         printf("%s", help);
@@ -35,51 +297,116 @@ int main(int argc, char **argv) {
     for (i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-i") == 0) {
             interp = 1;
+        } else if (strcmp(argv[i], "-H") == 0) {
+            opts.engine = ENGINE_HCONS;
+        } else if (strncmp(argv[i], "--engine=", 9) == 0) {
+            if (engine_from_name(argv[i] + 9, &opts.engine) < 0) {
+                err_report("Unknown engine %s", ERR_INP, argv[i] + 9);
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--strategy=", 11) == 0) {
+            if (strategy_from_name(argv[i] + 11, &opts.strategy) < 0) {
+                err_report("Unknown strategy %s", ERR_INP, argv[i] + 11);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            opts.trace = TRACE_QUIET;
+        } else if (strncmp(argv[i], "--trace-every=", 14) == 0) {
+            opts.trace = TRACE_EVERY;
+            if (_parse_count(argv[i] + 14, &opts.trace_n) < 0)
+                return -1;
+        } else if (strncmp(argv[i], "--trace-last=", 13) == 0) {
+            opts.trace = TRACE_LAST;
+            if (_parse_count(argv[i] + 13, &opts.trace_n) < 0)
+                return -1;
+        } else if (strncmp(argv[i], "--max-steps=", 12) == 0) {
+            if (_parse_limit(argv[i] + 12, &opts.budget.steps) < 0)
+                return -1;
+        } else if (strncmp(argv[i], "--max-nodes=", 12) == 0) {
+            if (_parse_limit(argv[i] + 12, &opts.budget.nodes) < 0)
+                return -1;
+        } else if (strncmp(argv[i], "--max-time=", 11) == 0) {
+            if (_parse_limit(argv[i] + 11, &opts.budget.millis) < 0)
+                return -1;
+        } else if (strncmp(argv[i], "--emit-bc=", 10) == 0) {
+            emit_bc = argv[i] + 10;
+        } else if (strncmp(argv[i], "--emit-bin=", 11) == 0) {
+            emit_bin = argv[i] + 11;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            emit_c = 1;
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out = argv[++i];
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
         } else {
             fname = argv[i];
         }
     }
 
+    if (opts.strategy != STRATEGY_NORMAL && opts.engine != ENGINE_STEP) {
+        err_report("--strategy needs the step engine", ERR_INP);
+        return -1;
+    }
+
+    budget_t *b = &opts.budget;
+    if ((b->steps > 0 || b->nodes > 0 || b->millis > 0) &&
+            opts.engine != ENGINE_STEP && opts.engine != ENGINE_HCONS &&
+            opts.engine != ENGINE_INET) {
+        err_report("--max-* limits need the step, hcons or inet engine",
+                ERR_INP);
+        return -1;
+    }
+
     int res = 0;
     if (fname != NULL) {
         FILE *fp = NULL;
-        if ((fp = fopen(fname, "r")) == NULL) {
+        if ((fp = fopen(fname, "rb")) == NULL) {
             err_report("Failed to open %s", ERR_FILE_ACTION, fname);
             return -1;
         }
 
-        dyn_buf_t *tokens;
-        expr_t *ast;
-        if ((res = lex(fp, &tokens, EOF)) < 0) {
+        if (bc_is_bytecode(fp)) {
+            res = _run_bc(fp, fname);
             goto cleanup_fp;
-        } else if ((res = parse(tokens, &ast)) < 0) {
-            goto cleanup_tokens;
-        } else {
-#ifdef _DEBUG_
-            /*
-            format_tokens(tokens);
-            format_ast(ast); */
-#endif /* _DEBUG_ */
         }
 
-        do {
-            printf("\x1B[34m-\033[0m ");
-            format_ast(ast);
-        } while (step_expr(ast) == 0);
-
-        free_expr(ast);
+        expr_t *ast;
+        if (img_is_image(fp)) {
+            if ((res = img_load(fp, &ast)) < 0) {
+                err_report("Failed to load term image from %s", res, fname);
+                goto cleanup_fp;
+            }
+        } else if ((res = _parse_file(fp, &ast)) < 0) {
+            goto cleanup_fp;
+        }
 
-cleanup_tokens:
-        dyn_buf_free(tokens, GET_VOID_FREE(free_token));
+        if (emit_c)
+            res = _emit_c(ast, out);
+        else if (emit_bc != NULL)
+            res = _emit_bc(ast, emit_bc);
+        else if (emit_bin != NULL)
+            res = _emit_bin(ast, emit_bin);
+        else
+            res = eval_ast(ast, &opts);
 
 cleanup_fp:
         fclose(fp);
     }
 
     if (interp) {
-        while ((res = run_interp()) != 1) { }
+        /* Each line reports its own errors, the session ends at EOF */
+        while ((res = run_interp(&opts)) != 1) { }
+        res = 0;
     }
 
+    if (stats)
+        _report_stats();
+
+    format_free_all();
+    sym_free_all();
+
+    if (res == ERR_BUDGET)
+        return EXIT_BUDGET;
 
     return res;
 }
@@ -0,0 +1,320 @@
+/**
+ * @file nbe.c
+ *
+ * @brief Normalization by evaluation implementation
+ *
+ * A value is either a closure (a lambda & its environment), a neutral (a
+ * variable introduced while quoting, applied to a spine of values) or a
+ * thunk (an unevaluated argument & its environment). Arguments are passed
+ * as thunks that are overwritten with their value when first forced, so
+ * evaluation is call-by-need & never diverges on an unused argument.
+ * Arguments that are already values (variables & lambdas) are passed
+ * without allocating a thunk.
+ *
+ * Evaluation is a loop that keeps its pending work on an explicit stack:
+ * the arguments waiting for their function to be evaluated & the thunks
+ * waiting to be overwritten with their value. Quoting keeps the values
+ * still to be read back on a work stack as well, so neither depends on the
+ * C stack. All values live in one arena that is dropped once the normal
+ * form has been quoted.
+ *
+ * @author Lars Wander
+ */
+
+#include <err.h>
+#include <lib/arena.h>
+
+#include "nbe.h"
+#include "work.h"
+
+typedef enum _val_e {
+    V_THUNK,
+    V_CLOS,
+    V_NEUTRAL
+} val_e;
+
+/**
+ * @brief Pending work of `_eval`
+ */
+typedef enum _kont_e {
+    /* Apply the value being returned to the argument in the frame */
+    K_ARG,
+
+    /* Overwrite the thunk in the frame with the value being returned */
+    K_UPDATE
+} kont_e;
+
+typedef struct _env env_t;
+
+typedef struct _val {
+    val_e kind;
+
+    /* Neutral: depth of the lambda which introduced the variable */
+    unsigned int level;
+
+    /* Thunk: any term, closure: a lambda */
+    expr_t *term;
+
+    /* Thunk & closure: bindings of the free variables of `term`, neutral:
+     * arguments, most recently applied first */
+    env_t *env;
+} val_t;
+
+/**
+ * @brief Link of an environment or neutral spine
+ */
+struct _env {
+    val_t *val;
+    env_t *next;
+};
+
+/* Holds every value of the current normalization */
+static arena_t *_nbe_arena = NULL;
+
+/* Beta reductions performed by the last normalization */
+static unsigned long _nbe_steps = 0;
+
+static val_t *_val(val_e kind, expr_t *term, env_t *env) {
+    val_t *res;
+    if ((res = arena_alloc(_nbe_arena, sizeof(val_t))) == NULL)
+        return NULL;
+
+    res->kind = kind;
+    res->level = 0;
+    res->term = term;
+    res->env = env;
+    return res;
+}
+
+static env_t *_cons(val_t *val, env_t *next) {
+    env_t *res;
+    if (val == NULL || (res = arena_alloc(_nbe_arena, sizeof(env_t))) == NULL)
+        return NULL;
+
+    res->val = val;
+    res->next = next;
+    return res;
+}
+
+static inline val_t *_env_at(env_t *env, unsigned int index) {
+    while (index-- > 0)
+        env = env->next;
+
+    return env->val;
+}
+
+static val_t *_eval(expr_t *term, env_t *env);
+
+/**
+ * @brief Evaluate a thunk, overwriting it with its value
+ */
+static val_t *_force(val_t *val) {
+    if (val->kind != V_THUNK)
+        return val;
+
+    val_t *res;
+    if ((res = _eval(val->term, val->env)) == NULL)
+        return NULL;
+
+    *val = *res;
+    return val;
+}
+
+/**
+ * @brief Suspend `term` for use as an argument
+ */
+static val_t *_delay(expr_t *term, env_t *env) {
+    switch (term->type) {
+        case (VAR):
+            return _env_at(env, term->var.index);
+        case (LAMBDA):
+            return _val(V_CLOS, term, env);
+        default:
+            return _val(V_THUNK, term, env);
+    }
+}
+
+/**
+ * @brief Evaluate `term` in `env` to a closure or neutral
+ */
+static val_t *_eval(expr_t *term, env_t *env) {
+    work_t k;
+    work_init(&k);
+
+    val_t *val, *x;
+    for (;;) {
+        /* Evaluate `term` in `env` until a value is produced */
+        switch (term->type) {
+            case (VAR):
+                val = _env_at(env, term->var.index);
+                if (val->kind != V_THUNK)
+                    break;
+
+                /* Force the thunk, then update it */
+                if (work_push_node(&k, val, NULL, 0, K_UPDATE) < 0)
+                    goto oom;
+
+                term = val->term;
+                env = val->env;
+                continue;
+            case (LAMBDA):
+                if ((val = _val(V_CLOS, term, env)) == NULL)
+                    goto oom;
+                break;
+            case (APPL):
+                if ((x = _delay(term->appl.x, env)) == NULL ||
+                        work_push_node(&k, x, NULL, 0, K_ARG) < 0)
+                    goto oom;
+
+                term = term->appl.f;
+                continue;
+            default:
+                goto oom;
+        }
+
+        /* Return `val` to the pending work until more evaluation is
+         * needed */
+        for (;;) {
+            if (work_empty(&k))
+                goto cleanup;
+
+            work_frame_t frame = work_pop(&k);
+            if (frame.state == K_UPDATE) {
+                *(val_t *)frame.node = *val;
+                val = frame.node;
+                continue;
+            }
+
+            x = frame.node;
+            if (val->kind == V_NEUTRAL) {
+                val_t *res;
+                if ((res = _val(V_NEUTRAL, NULL, _cons(x, val->env))) == NULL
+                        || res->env == NULL)
+                    goto oom;
+
+                res->level = val->level;
+                val = res;
+                continue;
+            }
+
+            /* Enter the function body */
+            if ((env = _cons(x, val->env)) == NULL)
+                goto oom;
+
+            term = val->term->lam.body;
+            _nbe_steps++;
+            break;
+        }
+    }
+
+oom:
+    val = NULL;
+cleanup:
+    work_free(&k);
+    return val;
+}
+
+/**
+ * @brief Read back the normal form of `val` under `depth` lambdas. The tree
+ *        is built top down, each value filling in the slot its parent left
+ *        for it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _quote(val_t *val, unsigned int depth, expr_t **out) {
+    work_t w;
+    work_init(&w);
+
+    *out = NULL;
+    int res;
+    if ((res = work_push_node(&w, val, out, depth, 0)) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        depth = frame.depth;
+        if ((val = _force(frame.node)) == NULL)
+            goto oom;
+
+        if (val->kind == V_NEUTRAL) {
+            /* The head applied to the spine, arguments are pushed outermost
+             * first so they are quoted left to right */
+            expr_t **slot = frame.slot;
+            for (env_t *spine = val->env; spine != NULL;
+                    spine = spine->next) {
+                if ((*slot = new_appl(NULL, NULL)) == NULL ||
+                        work_push_node(&w, spine->val, &(*slot)->appl.x,
+                            depth, 0) < 0)
+                    goto oom;
+
+                slot = &(*slot)->appl.f;
+            }
+
+            if ((*slot = new_var(depth - 1 - val->level, 0)) == NULL)
+                goto oom;
+
+            continue;
+        }
+
+        /* Apply the closure to a fresh variable & quote the body */
+        val_t *var, *body;
+        if ((var = _val(V_NEUTRAL, NULL, NULL)) == NULL)
+            goto oom;
+
+        var->level = depth;
+
+        env_t *env;
+        if ((env = _cons(var, val->env)) == NULL ||
+                (body = _eval(val->term->lam.body, env)) == NULL ||
+                (*frame.slot = new_lam(val->term->lam.sym, NULL)) == NULL ||
+                work_push_node(&w, body, &(*frame.slot)->lam.body,
+                    depth + 1, 0) < 0)
+            goto oom;
+    }
+
+    goto cleanup;
+
+oom:
+    res = ERR_MEM_ALLOC;
+    free_expr(*out);
+    *out = NULL;
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Compute the normal form of `expr`, which is left untouched
+ *
+ * @param expr Closed term being normalized
+ * @param out Freshly allocated normal form on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int nbe_normalize(expr_t *expr, expr_t **out) {
+    if (expr == NULL || out == NULL)
+        return ERR_INP;
+
+    if ((_nbe_arena = arena_new(NBE_ARENA_CHUNK)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    _nbe_steps = 0;
+
+    int res = 0;
+    val_t *val;
+    if ((val = _eval(expr, NULL)) == NULL)
+        res = ERR_MEM_ALLOC;
+    else
+        res = _quote(val, 0, out);
+
+    arena_free(_nbe_arena);
+    _nbe_arena = NULL;
+    return res;
+}
+
+/**
+ * @brief Number of beta reductions performed by the last `nbe_normalize`
+ */
+unsigned long nbe_steps() {
+    return _nbe_steps;
+}
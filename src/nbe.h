@@ -0,0 +1,25 @@
+/**
+ * @file nbe.h
+ *
+ * @brief Normalization by evaluation
+ *
+ * Terms are evaluated into a semantic domain of closures & neutral terms,
+ * & the normal form is read back (quoted) from the resulting value. There
+ * is no intermediate term, which makes this the fastest way to the final
+ * normal form.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _NBE_H_
+#define _NBE_H_
+
+#include "ast.h"
+
+/* Values are small & short lived, so use modest chunks */
+#define NBE_ARENA_CHUNK (0x10000)
+
+int nbe_normalize(expr_t *expr, expr_t **out);
+unsigned long nbe_steps();
+
+#endif /* _NBE_H_ */
@@ -1,336 +1,286 @@
 /**
  * @file parser.c
  *
- * @brief Parser implementation by recursive descent. For BNF see README.md
+ * @brief Predictive parser implementation. For BNF see README.md
  *
- * The pointer to the current token being parsed follows the following
- * semantics: On input, it points to the index of the token starting the
- * construct being parsed. On an unsuccessful return, it is unchanged. On
- * a successful return, it points to the next token to be parsed.
+ * Every production is picked by looking at one token at a time: a
+ * variable starts with T_VAR, a lambda with `(\` & an application with `(`
+ * followed by anything else. Nothing is ever retried, so each token is
+ * pulled from the lexer & verified exactly once, & never needs to be kept
+ * around. The pending work lives on an explicit stack rather than the C
+ * stack, so arbitrarily deep terms parse in time linear in their length &
+ * in space linear in the term built.
  *
  * @author Lars Wander
  */
 
 #include "parser.h"
 #include "lexer.h"
+#include "scope.h"
+#include "work.h"
 
 #include <err.h>
-#include <lib/dyn_buf.h>
-#include <lib/hashtable.h>
 
-#include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 
-int _parse_expr(dyn_buf_t *tokens, int *cur, htable_t *vars, expr_t **out);
+/**
+ * @brief What a frame on the parse stack still has to do
+ */
+typedef enum _parse_e {
+    /* Parse an <expression> into `slot` */
+    P_EXPR,
+
+    /* Match the ) closing a lambda or application */
+    P_RPAREN,
+
+    /* Leave the scope of the innermost lambda */
+    P_UNBIND
+} parse_e;
 
 /**
- * @brief shorthand for checking that the current token matches expectation
+ * @brief shorthand for taking the next token if it matches expectation
  *
- * @param tokens Token buffer being parsed
- * @param cur Pointer to token being verified
+ * @param lx Lexer the tokens are pulled from
  * @param expected The token type we want to see
- * @param out If non-null and token type matches, a pointer to the token is
+ * @param sym If non-null and token type matches, the token's symbol is
  *        placed here
  *
  * @return 0 on match, ERR_* in case of error, ERR_BAD_PARSE on non-match
  */
-int _parse_verify_token(dyn_buf_t *tokens, int *cur, token_e expected,
-        token_t *out) {
+int _parse_verify_token(lexer_t *lx, token_e expected, sym_t *sym) {
+    token_e kind;
     int res;
-    token_t *read;
-    if ((res = dyn_buf_at(tokens, *cur, (void **)&read)) < 0)
+    if ((res = lexer_peek(lx, &kind, NULL)) < 0)
         return res;
 
-    if (read->type != expected)
+    if (kind != expected)
         return ERR_BAD_PARSE;
 
-    (*cur)++;
-    if (out != NULL)
-        memcpy(out, read, sizeof(token_t));
-
-    return 0;
+    return lexer_next(lx, NULL, sym);
 }
 
 /**
  * @brief Attempt to parse a variable token
  *        <var> ::= [a-zA-Z0-9]*
  *
- * @param tokens The current token buffer being parsed
- * @param cur Location of the var token
- * @param vars Variable context (existing variables)
+ * @param lx Lexer the var token is pulled from
+ * @param scope Binders in scope, the variable's depth is theirs
  * @param decl Is this a new variable being declared?
  * @param out Pointer to where the result should be stored (cannot be NULL)
  *
- * @return ERR_* on failure, 0 if no variable is being overwritten, otherwise
- *         a positive integer corresponding to the overrwritten variables ID
+ * @return 0 on success, ERR_* otherwise
  */
-int _parse_var(dyn_buf_t *tokens, int *cur, htable_t *vars,
-        int decl, var_t **out) {
-    int _cur = *cur;
+int _parse_var(lexer_t *lx, scope_t *scope, int decl, var_t *out) {
     if (out == NULL)
         return ERR_INP;
 
-    token_t read;
+    sym_t sym;
     int res;
-    if ((res = _parse_verify_token(tokens, &_cur, T_VAR, &read)) < 0)
+    if ((res = _parse_verify_token(lx, T_VAR, &sym)) < 0)
         return res;
 
-    int id = 0;
-    bool var_exists = (htable_lookup(vars, read.ident, &id) == 0);
+    /* A binding site shadows any outer binder of the same name until its
+     * lambda is left */
+    out->sym = sym;
+    out->index = 0;
+    if (decl)
+        return scope_push(scope, sym);
 
     /* If a variable is not being bound anywhere, it is globally free and
      * we can't evaluate the program */
-    if (!decl && !var_exists) {
+    unsigned int level;
+    if ((level = scope_lookup(scope, sym)) == 0) {
         res = ERR_UNBOUND_VAR;
-        err_report("Variable %s not bound", res, read.ident);
+        err_report("Variable %s not bound", res, sym_name(sym));
         return res;
     }
 
-    /* Generate a fresh "id" for the variable if this is the variable's
-     * binding site, otherwise it refers to its previous binding site */
-    int new_id = id;
-    if (decl)
-        new_id = new_var_id();
-
-    if ((*out = new_var(new_id, read.ident)) == NULL)
-        return ERR_MEM_ALLOC;
-
-    if ((res = htable_insert(vars, read.ident, new_id)) < 0)
-        goto cleanup_var;
-
-    /* This binding site shadows a previous one, so store the id of
-     * the previous binding site be restored when we leave this context */
-    res = 0;
-    if (decl && var_exists) {
-        res = id;
-        assert(id > 0);
-    }
-
-    /* Since we have successfully parsed the variable token, we update the
-     * pointer to the token being parsed */
-    *cur = _cur;
-
-    return res;
-
-cleanup_var:
-    free_var(*out);
-
-    return res;
+    /* The variable's de Bruijn index is its distance from the level
+     * (1 + enclosing lambdas) of its binding site */
+    out->index = scope_depth(scope) - level;
+    return 0;
 }
 
 /**
- * @brief Parse a lambda function construct
+ * @brief Parse the head of a lambda, having seen its (\, & push its body
  *        <lambda> ::= (\<var>.<expression>)
  *
- * @param tokens Buffer of tokens being parsed
- * @param cur Index of token we expect lambda to start at
- * @param vars Variable context
- * @param out Pointer to output lambda must point to valid memory
+ * @param lx Lexer the tokens after the \ are pulled from
+ * @param scope Binders in scope
+ * @param w Parse stack the body & closing ) are pushed to
+ * @param slot Where the lambda is stored, body left NULL until parsed
  *
  * @return 0 on success, ERR_* otherwise
  */
-int _parse_lambda(dyn_buf_t *tokens, int *cur, htable_t *vars, lam_t **out) {
-    int _cur = *cur;
+int _parse_lambda(lexer_t *lx, scope_t *scope, work_t *w, expr_t **slot) {
     int res;
-    /* ( */
-    if ((res = _parse_verify_token(tokens, &_cur, T_LPAREN, NULL)) < 0)
-        return res;
-
-    /* \ */
-    if ((res = _parse_verify_token(tokens, &_cur, T_BSLASH, NULL)) < 0)
-        return res;
 
     /* <var> */
-    var_t *var;
-    if ((res = _parse_var(tokens, &_cur, vars, 1, &var)) < 0)
+    var_t var;
+    if ((res = _parse_var(lx, scope, 1, &var)) < 0)
         return res;
 
-    int old_var_id = res;
-
     /* . */
-    if ((res = _parse_verify_token(tokens, &_cur, T_DOT, NULL)) < 0)
-        goto cleanup_var;
-
-    /* <expr> */
-    expr_t *expr;
-    if ((res = _parse_expr(tokens, &_cur, vars, &expr)) < 0)
-        goto cleanup_var;
-
-    /* ) */
-    if ((res = _parse_verify_token(tokens, &_cur, T_RPAREN, NULL)) < 0)
-        goto cleanup_expr;
-
-    if ((*out = new_lam(var, expr)) == NULL) {
-        res = ERR_MEM_ALLOC;
-        goto cleanup_expr;
-    }
+    if ((res = _parse_verify_token(lx, T_DOT, NULL)) < 0)
+        return res;
 
-    *cur = _cur;
+    if ((*slot = new_lam(var.sym, NULL)) == NULL)
+        return ERR_MEM_ALLOC;
 
-    /* Reset previous binding */
-    if (old_var_id > 0) {
-        htable_insert(vars, var->name, old_var_id);
-    } else {
-        htable_delete(vars, var->name, NULL);
-    }
+    /* <expr> ) */
+    if (work_push(w, NULL, NULL, 0, P_UNBIND) < 0 ||
+            work_push(w, NULL, NULL, 0, P_RPAREN) < 0 ||
+            work_push(w, NULL, &(*slot)->lam.body, 0, P_EXPR) < 0)
+        return ERR_MEM_ALLOC;
 
     return 0;
-
-cleanup_expr:
-    free_expr(expr);
-
-cleanup_var:
-    /* Reset previous binding */
-    if (old_var_id > 0) {
-        htable_insert(vars, var->name, old_var_id);
-    } else {
-        htable_delete(vars, var->name, NULL);
-    }
-
-    free_var(var);
-
-    return res;
 }
 
 /**
- * @brief Parse function application
- *        (<expression> <expression>)
+ * @brief Parse the head of an application, having seen its (, & push both
+ *        of its sides
+ *        <application> ::= (<expression> <expression>)
  *
- * @param tokens Token buffer being parsed
- * @param cur Location of the start of the application token
- * @param vars Variable context
- * @param out Pointer to output application, must be valid memory
+ * @param w Parse stack the sides & closing ) are pushed to
+ * @param slot Where the application is stored, sides left NULL until parsed
  *
  * @return 0 on success, ERR_* otherwise
  */
-int _parse_appl(dyn_buf_t *tokens, int *cur, htable_t *vars, appl_t **out) {
-    int _cur = *cur;
-    int res;
-
-    /* ( */
-    if ((res = _parse_verify_token(tokens, &_cur, T_LPAREN, NULL)) < 0)
-        return res;
-
-    /* <expression> */
-    expr_t *lexpr;
-    if ((res = _parse_expr(tokens, &_cur, vars, &lexpr)) < 0)
-        return res;
-
-    /* <expression> */
-    expr_t *rexpr;
-    if ((res = _parse_expr(tokens, &_cur, vars, &rexpr)) < 0)
-        goto cleanup_lexpr;
-
-    /* ) */
-    if ((res = _parse_verify_token(tokens, &_cur, T_RPAREN, NULL)) < 0)
-        goto cleanup_rexpr;
+int _parse_appl(work_t *w, expr_t **slot) {
+    if ((*slot = new_appl(NULL, NULL)) == NULL)
+        return ERR_MEM_ALLOC;
 
-    if ((*out = new_appl(lexpr, rexpr)) == NULL) {
-        res = ERR_MEM_ALLOC;
-        goto cleanup_rexpr;
-    }
+    /* <expression> <expression> ) */
+    if (work_push(w, NULL, NULL, 0, P_RPAREN) < 0 ||
+            work_push(w, NULL, &(*slot)->appl.x, 0, P_EXPR) < 0 ||
+            work_push(w, NULL, &(*slot)->appl.f, 0, P_EXPR) < 0)
+        return ERR_MEM_ALLOC;
 
-    *cur = _cur;
     return 0;
-
-cleanup_rexpr:
-    free_expr(rexpr);
-
-cleanup_lexpr:
-    free_expr(lexpr);
-    return res;
 }
 
 /**
- * @brief Parse expression
+ * @brief Parse expression, choosing its production from the next tokens
  *        <expression> ::= <var> | <lambda> | <application>
  *
- * @param tokens Token buffer being parsed
- * @param cur Location of the start of the expression token
- * @param vars Variable context
- * @param out Pointer to output expression, must be valid memory
+ * @param lx Lexer the tokens are pulled from
+ * @param scope Binders in scope
+ * @param w Parse stack any unfinished sub-expressions are pushed to
+ * @param slot Where the expression is stored
  *
  * @return 0 on success, ERR_* otherwise
  */
-int _parse_expr(dyn_buf_t *tokens, int *cur, htable_t *vars, expr_t **out) {
-    int _cur = *cur;
+int _parse_expr(lexer_t *lx, scope_t *scope, work_t *w, expr_t **slot) {
+    token_e kind;
     int res;
-
-    /* Try to parse our 3 possibile expression types */
-    var_t *var;
-    if ((res = _parse_var(tokens, &_cur, vars, 0, &var)) == 0) {
-        if ((*out = new_expr(VAR, (void *)var)) == NULL) {
-            free_var(var);
-            return ERR_MEM_ALLOC;
-        } else {
-            goto success;
-        }
-    } else if (res != ERR_BAD_PARSE) {
+    if ((res = lexer_peek(lx, &kind, NULL)) < 0)
         return res;
-    }
 
-    lam_t *lam;
-    if ((res = _parse_lambda(tokens, &_cur, vars, &lam)) == 0) {
-        if ((*out = new_expr(LAMBDA, (void *)lam)) == NULL) {
-            free_lam(lam);
-            return ERR_MEM_ALLOC;
-        } else {
-            goto success;
-        }
-    } else if (res != ERR_BAD_PARSE) {
-        return res;
-    }
+    switch (kind) {
+        case (T_VAR): {
+            var_t var;
+            if ((res = _parse_var(lx, scope, 0, &var)) < 0)
+                return res;
 
-    appl_t *appl;
-    if ((res = _parse_appl(tokens, &_cur, vars, &appl)) == 0) {
-        if ((*out = new_expr(APPL, (void *)appl)) == NULL) {
-            free_appl(appl);
-            return ERR_MEM_ALLOC;
+            if ((*slot = new_var(var.index, var.sym)) == NULL)
+                return ERR_MEM_ALLOC;
+
+            return 0;
         }
-    } else {
-        return res;
-    }
+        case (T_LPAREN):
+            if ((res = lexer_next(lx, NULL, NULL)) < 0 ||
+                    (res = lexer_peek(lx, &kind, NULL)) < 0)
+                return res;
 
-success:
-    *cur = _cur;
-    return 0;
+            if (kind == T_BSLASH) {
+                if ((res = lexer_next(lx, NULL, NULL)) < 0)
+                    return res;
+
+                return _parse_lambda(lx, scope, w, slot);
+            }
+
+            return _parse_appl(w, slot);
+        default:
+            return ERR_BAD_PARSE;
+    }
 }
 
 /**
- * @brief Parse LC file at path
+ * @brief Parse all of the tokens of a lexer
  *
- * @param path LC file
- * @param pointer to where AST will be stored, cannot be NULL
+ * @param lx Lexer the tokens are pulled from
+ * @param pointer to where AST will be stored, cannot be NULL. NULL if
+ *        there are no tokens at all
  *
  * @return 0 on success, ERR_* otherwise
  */
-int parse(dyn_buf_t *tokens, expr_t **ast) {
-    if (dyn_buf_len(tokens) == 0)
+int parse(lexer_t *lx, expr_t **ast) {
+    int res;
+    *ast = NULL;
+    if ((res = lexer_peek(lx, NULL, NULL)) == ERR_OOB)
         return 0;
+    else if (res < 0)
+        return res;
 
-    int res;
+    scope_t scope;
+    scope_init(&scope);
 
-    htable_t *vars;
-    if ((vars = htable_new()) == NULL)
-        return ERR_MEM_ALLOC;
+    work_t w;
+    work_init(&w);
+
+    expr_t *root = NULL;
+    if (work_push(&w, NULL, &root, 0, P_EXPR) < 0) {
+        res = ERR_MEM_ALLOC;
+        goto cleanup_work;
+    }
+
+    work_frame_t f;
+    while (!work_empty(&w)) {
+        f = work_pop(&w);
+        switch ((parse_e)f.state) {
+            case (P_EXPR):
+                res = _parse_expr(lx, &scope, &w, f.slot);
+                break;
+            case (P_RPAREN):
+                res = _parse_verify_token(lx, T_RPAREN, NULL);
+                break;
+            case (P_UNBIND):
+                scope_pop(&scope);
+                res = 0;
+                break;
+        }
+
+        if (res < 0)
+            goto cleanup_root;
+    }
 
-    int cur = 0;
-    if ((res = _parse_expr(tokens, &cur, vars, ast)) < 0)
-        goto cleanup_vars;
+    /* Lex what is left only to report how much of it there is */
+    if ((res = lexer_peek(lx, NULL, NULL)) != ERR_OOB) {
+        int first = lx->count;
+        while (res == 0)
+            res = lexer_next(lx, NULL, NULL);
+
+        if (res != ERR_OOB)
+            goto cleanup_root;
 
-    if (cur != dyn_buf_len(tokens)) {
         res = ERR_BAD_PARSE;
-        err_report("Trailing tokens from %d to %d", res, cur,
-                dyn_buf_len(tokens));
-        goto cleanup_vars;
+        err_report("Trailing tokens from %d to %d", res, first, lx->count);
+        goto cleanup_root;
     }
 
+    *ast = root;
     res = 0;
+    goto cleanup_work;
+
+cleanup_root:
+    /* Unparsed sub-expressions are still NULL, which `free_expr` skips */
+    free_expr(root);
 
-cleanup_vars:
-    htable_free(vars, NULL);
+cleanup_work:
+    work_free(&w);
+    scope_free(&scope);
 
     return res;
 }
@@ -9,10 +9,9 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
-#include <lib/dyn_buf.h>
-
 #include "ast.h"
+#include "lexer.h"
 
-int parse(dyn_buf_t *buf, expr_t **ast);
+int parse(lexer_t *lx, expr_t **ast);
 
 #endif /* _PARSER_H_ */
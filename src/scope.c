@@ -0,0 +1,81 @@
+/**
+ * @file scope.c
+ *
+ * @brief Scope stack implementation
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <err.h>
+
+#include "scope.h"
+
+void scope_init(scope_t *scope) {
+    memset(scope, 0, sizeof(scope_t));
+}
+
+/**
+ * @brief Make `sym` a valid index into the binder levels, symbols are
+ *        interned as the source is read so more keep turning up
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _scope_cover(scope_t *scope, sym_t sym) {
+    unsigned int n = scope->nsyms == 0 ? 0x100 : scope->nsyms;
+    while (n <= sym)
+        n *= 2;
+
+    unsigned int *levels;
+    if ((levels = realloc(scope->levels, n * sizeof(unsigned int))) == NULL)
+        return ERR_MEM_ALLOC;
+
+    memset(levels + scope->nsyms, 0,
+            (n - scope->nsyms) * sizeof(unsigned int));
+    scope->levels = levels;
+    scope->nsyms = n;
+    return 0;
+}
+
+/**
+ * @brief Bind `sym` one level deeper than every binder in scope
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int scope_push(scope_t *scope, sym_t sym) {
+    if (sym >= scope->nsyms && _scope_cover(scope, sym) < 0)
+        return ERR_MEM_ALLOC;
+
+    if (scope->depth == scope->cap) {
+        unsigned int cap = scope->cap == 0 ? SCOPE_INIT_DEPTH : scope->cap * 2;
+        binder_t *binders;
+        if ((binders = realloc(scope->binders, cap * sizeof(binder_t)))
+                == NULL)
+            return ERR_MEM_ALLOC;
+
+        scope->binders = binders;
+        scope->cap = cap;
+    }
+
+    binder_t *b = &scope->binders[scope->depth++];
+    b->sym = sym;
+    b->shadowed = scope->levels[sym];
+    scope->levels[sym] = scope->depth;
+    return 0;
+}
+
+/**
+ * @brief Unbind the innermost binder, bringing back the one it shadowed
+ */
+void scope_pop(scope_t *scope) {
+    binder_t *b = &scope->binders[--scope->depth];
+    scope->levels[b->sym] = b->shadowed;
+}
+
+void scope_free(scope_t *scope) {
+    free(scope->levels);
+    free(scope->binders);
+    scope_init(scope);
+}
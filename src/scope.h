@@ -0,0 +1,66 @@
+/**
+ * @file scope.h
+ *
+ * @brief Scope stack resolving variable names to their binders
+ *
+ * Names are interned, so the innermost binder of every name is kept in an
+ * array indexed by symbol. Entering a lambda pushes its binder, noting the
+ * binder it shadows, & leaving it pops the binder & puts the shadowed one
+ * back, so binding, resolving & unbinding are each a couple of array
+ * accesses. The binder stack's height is the number of enclosing lambdas.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _SCOPE_H_
+#define _SCOPE_H_
+
+#include "symbol.h"
+
+/* Initial binder stack height */
+#define SCOPE_INIT_DEPTH (0x40)
+
+/**
+ * @brief A binder on the stack
+ */
+typedef struct _binder {
+    sym_t sym;
+
+    /* Level of the binder of `sym` this one shadows, 0 if none */
+    unsigned int shadowed;
+} binder_t;
+
+/**
+ * @brief Public so that it can live on the stack
+ */
+typedef struct _scope {
+    /* Level (1 + enclosing lambdas) of the innermost binder of each
+     * symbol, 0 if it is unbound */
+    unsigned int *levels;
+    unsigned int nsyms;
+
+    binder_t *binders;
+    unsigned int depth;
+    unsigned int cap;
+} scope_t;
+
+void scope_init(scope_t *scope);
+int scope_push(scope_t *scope, sym_t sym);
+void scope_pop(scope_t *scope);
+void scope_free(scope_t *scope);
+
+/**
+ * @brief Level of the innermost binder of `sym`, 0 if it is unbound
+ */
+static inline unsigned int scope_lookup(scope_t *scope, sym_t sym) {
+    return sym < scope->nsyms ? scope->levels[sym] : 0;
+}
+
+/**
+ * @brief Number of binders in scope
+ */
+static inline unsigned int scope_depth(scope_t *scope) {
+    return scope->depth;
+}
+
+#endif /* _SCOPE_H_ */
@@ -0,0 +1,179 @@
+/**
+ * @file symbol.c
+ *
+ * @brief Symbol interning implementation
+ *
+ * Names are mapped to their symbol through a hash table, while the symbol
+ * indexes a buffer of pointers into an append-only string arena.
+ *
+ * @author Lars Wander
+ */
+
+#include <string.h>
+
+#include <err.h>
+#include <lib/arena.h>
+#include <lib/dyn_buf.h>
+#include <lib/hashtable.h>
+
+#include "symbol.h"
+#include "lexer.h"
+
+/* Names are short, there is no need for big chunks */
+#define SYM_POOL_CHUNK (0x1000)
+
+/* Maps a name to its symbol */
+static htable_t *_sym_table = NULL;
+
+/* Symbol -> name, each name lives in `_sym_pool` */
+static dyn_buf_t *_sym_names = NULL;
+
+static arena_t *_sym_pool = NULL;
+
+/**
+ * @brief Create the symbol table on first use
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _sym_init() {
+    if (_sym_table != NULL)
+        return 0;
+
+    if ((_sym_pool = arena_new(SYM_POOL_CHUNK)) == NULL)
+        goto cleanup_default;
+
+    if ((_sym_names = dyn_buf_new()) == NULL)
+        goto cleanup_pool;
+
+    if ((_sym_table = htable_new()) == NULL)
+        goto cleanup_names;
+
+    return 0;
+
+cleanup_names:
+    dyn_buf_free(_sym_names, NULL);
+    _sym_names = NULL;
+
+cleanup_pool:
+    arena_free(_sym_pool);
+    _sym_pool = NULL;
+
+cleanup_default:
+    return ERR_MEM_ALLOC;
+}
+
+/**
+ * @brief Look up the symbol for `name`, adding it to the pool if this is the
+ *        first time it's been seen
+ *
+ * @param name Variable name, truncated to MAX_VAR_LEN
+ * @param out Symbol is stored here on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int sym_intern(const char *name, sym_t *out) {
+    if (name == NULL)
+        return ERR_INP;
+
+    return sym_intern_n(name, strlen(name), out);
+}
+
+/**
+ * @brief As `sym_intern`, for a name that isn't NUL terminated, such as a
+ *        slice of the source
+ *
+ * @param len Length of `name`, truncated to MAX_VAR_LEN
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int sym_intern_n(const char *name, size_t len, sym_t *out) {
+    int res;
+    if (name == NULL || out == NULL)
+        return ERR_INP;
+
+    if ((res = _sym_init()) < 0)
+        return res;
+
+    /* Truncate before the lookup, as the truncated name is what is stored */
+    char key[MAX_VAR_LEN + 1];
+    if (len > MAX_VAR_LEN)
+        len = MAX_VAR_LEN;
+
+    memcpy(key, name, len);
+    key[len] = '\0';
+
+    int sym;
+    if (htable_lookup(_sym_table, key, &sym) == 0) {
+        *out = sym;
+        return 0;
+    }
+
+    char *copy;
+    if ((copy = arena_alloc(_sym_pool, len + 1)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    memcpy(copy, key, len + 1);
+
+    sym = dyn_buf_len(_sym_names);
+    if ((res = dyn_buf_push(_sym_names, copy)) < 0)
+        goto cleanup_copy;
+
+    if ((res = htable_insert(_sym_table, copy, sym)) < 0)
+        goto cleanup_push;
+
+    *out = sym;
+    return 0;
+
+cleanup_push:
+    dyn_buf_pop(_sym_names, NULL);
+
+cleanup_copy:
+    arena_release(_sym_pool, copy, len + 1);
+    return res;
+}
+
+/**
+ * @brief Name for an interned symbol, "???" if it isn't known
+ */
+const char *sym_name(sym_t sym) {
+    char *name;
+    if (_sym_names == NULL ||
+            dyn_buf_at(_sym_names, (int)sym, (void **)&name) < 0)
+        return "???";
+
+    return name;
+}
+
+/**
+ * @brief Number of distinct names interned so far
+ */
+int sym_count() {
+    if (_sym_names == NULL)
+        return 0;
+
+    return dyn_buf_len(_sym_names);
+}
+
+/**
+ * @brief Bytes held by the string pool
+ */
+size_t sym_pool_bytes() {
+    arena_stats_t stats;
+    arena_stats(_sym_pool, &stats);
+    return stats.live_bytes;
+}
+
+/**
+ * @brief Drop every interned name. Outstanding symbols become invalid
+ */
+void sym_free_all() {
+    if (_sym_table == NULL)
+        return;
+
+    htable_free(_sym_table, NULL);
+    dyn_buf_free(_sym_names, NULL);
+    arena_free(_sym_pool);
+    _sym_table = NULL;
+    _sym_names = NULL;
+    _sym_pool = NULL;
+}
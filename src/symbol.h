@@ -0,0 +1,27 @@
+/**
+ * @file symbol.h
+ *
+ * @brief Interned variable names
+ *
+ * Every distinct variable name is stored once in a global string pool and
+ * referred to by a small integer, so copying a variable never touches the
+ * string & comparing names is an integer compare.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _SYMBOL_H_
+#define _SYMBOL_H_
+
+#include <stddef.h>
+
+typedef unsigned int sym_t;
+
+int sym_intern(const char *name, sym_t *out);
+int sym_intern_n(const char *name, size_t len, sym_t *out);
+const char *sym_name(sym_t sym);
+int sym_count();
+size_t sym_pool_bytes();
+void sym_free_all();
+
+#endif /* _SYMBOL_H_ */
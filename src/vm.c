@@ -0,0 +1,402 @@
+/**
+ * @file vm.c
+ *
+ * @brief Bytecode virtual machine implementation
+ *
+ * The machine state is the program counter, the current environment (a
+ * linked list of values, innermost binder first), a value stack & a stack
+ * of return frames. A value is either a closure (a body offset & its
+ * environment) or a neutral (a free variable introduced during read back,
+ * applied to a spine of values). Applying a neutral just extends its spine.
+ *
+ * Dispatch uses computed goto where the compiler supports it, with a switch
+ * otherwise. The read back re-enters the dispatch loop for every closure
+ * body, which is why `_run` stops at the frame depth it was started with.
+ * Every value lives in one arena that is dropped once the normal form has
+ * been read back.
+ *
+ * @author Lars Wander
+ */
+
+#include <stdlib.h>
+
+#include <err.h>
+#include <lib/arena.h>
+
+#include "vm.h"
+#include "work.h"
+
+#ifdef __GNUC__
+#define VM_COMPUTED_GOTO
+#endif
+
+typedef struct _vm_env vm_env_t;
+
+typedef struct _vm_val {
+    /* Set for neutrals */
+    unsigned int neutral;
+
+    /* Closure: offset of the body, neutral: depth of the binder */
+    unsigned int code;
+
+    /* Closures only, cosmetic */
+    sym_t sym;
+
+    /* Closure: bindings of the body's free variables, neutral: arguments,
+     * most recently applied first */
+    vm_env_t *env;
+} vm_val_t;
+
+struct _vm_env {
+    vm_val_t *val;
+    vm_env_t *next;
+};
+
+typedef struct _vm_frame {
+    unsigned int pc;
+    vm_env_t *env;
+} vm_frame_t;
+
+/* Holds every value & environment of the current run */
+static arena_t *_vm_arena = NULL;
+
+/* Program being run */
+static unsigned int *_code = NULL;
+
+static vm_val_t **_stack = NULL;
+static unsigned int _stack_len = 0;
+static unsigned int _stack_cap = 0;
+
+static vm_frame_t *_frames = NULL;
+static unsigned int _frames_len = 0;
+static unsigned int _frames_cap = 0;
+
+/* Closures entered by the last run */
+static unsigned long _vm_steps = 0;
+
+/* Set when a run stops early, ERR_* */
+static int _vm_err = 0;
+
+static vm_val_t *_val(unsigned int neutral, unsigned int code, sym_t sym,
+        vm_env_t *env) {
+    vm_val_t *res;
+    if ((res = arena_alloc(_vm_arena, sizeof(vm_val_t))) == NULL) {
+        _vm_err = ERR_MEM_ALLOC;
+        return NULL;
+    }
+
+    res->neutral = neutral;
+    res->code = code;
+    res->sym = sym;
+    res->env = env;
+    return res;
+}
+
+static vm_env_t *_cons(vm_val_t *val, vm_env_t *next) {
+    vm_env_t *res;
+    if ((res = arena_alloc(_vm_arena, sizeof(vm_env_t))) == NULL) {
+        _vm_err = ERR_MEM_ALLOC;
+        return NULL;
+    }
+
+    res->val = val;
+    res->next = next;
+    return res;
+}
+
+static inline vm_val_t *_env_at(vm_env_t *env, unsigned int index) {
+    while (env != NULL && index-- > 0)
+        env = env->next;
+
+    if (env == NULL) {
+        /* Only a hand-edited bytecode file can reach past the binders */
+        _vm_err = ERR_CORRUPT;
+        return NULL;
+    }
+
+    return env->val;
+}
+
+static int _push(vm_val_t *val) {
+    if (_stack_len == _stack_cap) {
+        unsigned int cap = _stack_cap == 0 ? 0x100 : _stack_cap * 2;
+        vm_val_t **stack;
+        if ((stack = realloc(_stack, cap * sizeof(vm_val_t *))) == NULL) {
+            _vm_err = ERR_MEM_ALLOC;
+            return ERR_MEM_ALLOC;
+        }
+
+        _stack = stack;
+        _stack_cap = cap;
+    }
+
+    _stack[_stack_len++] = val;
+    return 0;
+}
+
+static int _push_frame(unsigned int pc, vm_env_t *env) {
+    if (_frames_len == _frames_cap) {
+        unsigned int cap = _frames_cap == 0 ? 0x100 : _frames_cap * 2;
+        vm_frame_t *frames;
+        if ((frames = realloc(_frames, cap * sizeof(vm_frame_t))) == NULL) {
+            _vm_err = ERR_MEM_ALLOC;
+            return ERR_MEM_ALLOC;
+        }
+
+        _frames = frames;
+        _frames_cap = cap;
+    }
+
+    _frames[_frames_len].pc = pc;
+    _frames[_frames_len].env = env;
+    _frames_len++;
+    return 0;
+}
+
+#ifdef VM_COMPUTED_GOTO
+/* Label addresses & computed gotos are GNU extensions */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define OP(label, op) label:
+#define NEXT() goto *labels[_code[pc]]
+#else
+#define OP(label, op) case (op):
+#define NEXT() goto dispatch
+#endif
+
+/**
+ * @brief Run from `pc` in `env` until the code returns past the frame it
+ *        was started in, or halts
+ *
+ * @return The resulting value, NULL with `_vm_err` set on failure
+ */
+static vm_val_t *_run(unsigned int pc, vm_env_t *env) {
+    unsigned int sbase = _stack_len, fbase = _frames_len;
+    vm_val_t *f, *x, *v;
+    vm_env_t *e;
+
+#ifdef VM_COMPUTED_GOTO
+    /* Indexed by `_bc_op_e` */
+    static void *labels[BC_OP_COUNT] = {
+        &&op_access,
+        &&op_closure,
+        &&op_apply,
+        &&op_tailapply,
+        &&op_return,
+        &&op_halt
+    };
+
+    NEXT();
+#else
+dispatch:
+    switch (_code[pc]) {
+#endif
+    OP(op_access, BC_ACCESS)
+        if ((v = _env_at(env, _code[pc + 1])) == NULL || _push(v) < 0)
+            return NULL;
+
+        pc += 2;
+        NEXT();
+    OP(op_closure, BC_CLOSURE)
+        if ((v = _val(0, _code[pc + 1], _code[pc + 2], env)) == NULL ||
+                _push(v) < 0)
+            return NULL;
+
+        pc += 3;
+        NEXT();
+    OP(op_apply, BC_APPLY)
+        if (_stack_len < sbase + 2)
+            goto corrupt;
+
+        f = _stack[--_stack_len];
+        x = _stack[--_stack_len];
+        if ((e = _cons(x, f->env)) == NULL)
+            return NULL;
+
+        if (f->neutral) {
+            if ((v = _val(1, f->code, 0, e)) == NULL || _push(v) < 0)
+                return NULL;
+
+            pc++;
+            NEXT();
+        }
+
+        if (_push_frame(pc + 1, env) < 0)
+            return NULL;
+
+        _vm_steps++;
+        env = e;
+        pc = f->code;
+        NEXT();
+    OP(op_tailapply, BC_TAILAPPLY)
+        if (_stack_len < sbase + 2)
+            goto corrupt;
+
+        f = _stack[--_stack_len];
+        x = _stack[--_stack_len];
+        if ((e = _cons(x, f->env)) == NULL)
+            return NULL;
+
+        if (f->neutral) {
+            if ((v = _val(1, f->code, 0, e)) == NULL)
+                return NULL;
+
+            goto ret;
+        }
+
+        /* The callee inherits our frame */
+        _vm_steps++;
+        env = e;
+        pc = f->code;
+        NEXT();
+    OP(op_return, BC_RETURN)
+        if (_stack_len < sbase + 1)
+            goto corrupt;
+
+        v = _stack[--_stack_len];
+ret:
+        if (_frames_len == fbase)
+            return v;
+
+        _frames_len--;
+        pc = _frames[_frames_len].pc;
+        env = _frames[_frames_len].env;
+        if (_push(v) < 0)
+            return NULL;
+
+        NEXT();
+    OP(op_halt, BC_HALT)
+        if (_stack_len < sbase + 1)
+            goto corrupt;
+
+        return _stack[--_stack_len];
+#ifndef VM_COMPUTED_GOTO
+        default:
+            goto corrupt;
+    }
+#endif
+
+corrupt:
+    _vm_err = ERR_CORRUPT;
+    return NULL;
+}
+
+#undef OP
+#undef NEXT
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+/**
+ * @brief Read back the normal form of `val` under `depth` lambdas. The tree
+ *        is built top down, each value filling in the slot its parent left
+ *        for it
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+static int _quote(vm_val_t *val, unsigned int depth, expr_t **out) {
+    work_t w;
+    work_init(&w);
+
+    *out = NULL;
+    int res;
+    if ((res = work_push_node(&w, val, out, depth, 0)) < 0)
+        goto cleanup;
+
+    while (!work_empty(&w)) {
+        work_frame_t frame = work_pop(&w);
+        val = frame.node;
+        depth = frame.depth;
+
+        if (val->neutral) {
+            /* The head applied to the spine, arguments are pushed outermost
+             * first so they are quoted left to right */
+            expr_t **slot = frame.slot;
+            for (vm_env_t *spine = val->env; spine != NULL;
+                    spine = spine->next) {
+                if ((*slot = new_appl(NULL, NULL)) == NULL ||
+                        work_push_node(&w, spine->val, &(*slot)->appl.x,
+                            depth, 0) < 0)
+                    goto oom;
+
+                slot = &(*slot)->appl.f;
+            }
+
+            if ((*slot = new_var(depth - 1 - val->code, 0)) == NULL)
+                goto oom;
+
+            continue;
+        }
+
+        /* Run the body against a fresh variable & quote the result */
+        vm_val_t *var, *body;
+        vm_env_t *env;
+        if ((var = _val(1, depth, 0, NULL)) == NULL ||
+                (env = _cons(var, val->env)) == NULL ||
+                (body = _run(val->code, env)) == NULL) {
+            res = _vm_err < 0 ? _vm_err : ERR_MEM_ALLOC;
+            goto fail;
+        }
+
+        if ((*frame.slot = new_lam(val->sym, NULL)) == NULL ||
+                work_push_node(&w, body, &(*frame.slot)->lam.body,
+                    depth + 1, 0) < 0)
+            goto oom;
+    }
+
+    goto cleanup;
+
+oom:
+    res = ERR_MEM_ALLOC;
+fail:
+    free_expr(*out);
+    *out = NULL;
+cleanup:
+    work_free(&w);
+    return res;
+}
+
+/**
+ * @brief Run a compiled program & read back its normal form
+ *
+ * @param bc Program, starting at offset 0
+ * @param out Freshly allocated normal form on success
+ *
+ * @return 0 on success, ERR_* otherwise
+ */
+int vm_run(bc_t *bc, expr_t **out) {
+    if (bc == NULL || bc->len == 0 || out == NULL)
+        return ERR_INP;
+
+    if ((_vm_arena = arena_new(VM_ARENA_CHUNK)) == NULL)
+        return ERR_MEM_ALLOC;
+
+    _code = bc->code;
+    _stack_len = _frames_len = 0;
+    _vm_steps = 0;
+    _vm_err = 0;
+
+    int res = 0;
+    vm_val_t *val;
+    if ((val = _run(0, NULL)) == NULL)
+        res = _vm_err < 0 ? _vm_err : ERR_MEM_ALLOC;
+    else
+        res = _quote(val, 0, out);
+
+    arena_free(_vm_arena);
+    free(_stack);
+    free(_frames);
+    _vm_arena = NULL;
+    _code = NULL;
+    _stack = NULL;
+    _frames = NULL;
+    _stack_cap = _frames_cap = 0;
+    return res;
+}
+
+/**
+ * @brief Number of closures entered by the last `vm_run`
+ */
+unsigned long vm_steps() {
+    return _vm_steps;
+}
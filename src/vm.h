@@ -0,0 +1,26 @@
+/**
+ * @file vm.h
+ *
+ * @brief Bytecode virtual machine
+ *
+ * Runs programs from `bc_compile` call-by-value, with environments of
+ * closures. Normal forms are read back by running closure bodies against
+ * free variables, so the result is the same normal form the other engines
+ * print.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _VM_H_
+#define _VM_H_
+
+#include "ast.h"
+#include "bytecode.h"
+
+/* Closures & environments are small & short lived, use modest chunks */
+#define VM_ARENA_CHUNK (0x10000)
+
+int vm_run(bc_t *bc, expr_t **out);
+unsigned long vm_steps();
+
+#endif /* _VM_H_ */
@@ -0,0 +1,133 @@
+/**
+ * @file work.h
+ *
+ * @brief Explicit work stacks for traversals that must not recurse
+ *
+ * Terms can be nested far deeper than the C stack allows, so traversals
+ * keep their pending work in one of these instead. The first
+ * WORK_INLINE_FRAMES frames live inside the stack itself, which sits in
+ * the caller's frame, so shallow terms never touch the heap.
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _WORK_H_
+#define _WORK_H_
+
+#include <stdlib.h>
+
+#include <err.h>
+
+#include "ast.h"
+
+#define WORK_INLINE_FRAMES (64)
+
+/**
+ * @brief One pending piece of work, fields are used as each traversal sees
+ *        fit
+ */
+typedef struct _work_frame {
+    union {
+        expr_t *expr;
+
+        /* Traversals of the engines' own term representations */
+        void *node;
+    };
+
+    expr_t **slot;
+    unsigned int depth;
+    unsigned int state;
+} work_frame_t;
+
+typedef struct _work {
+    work_frame_t *frames;
+    size_t len;
+    size_t cap;
+    work_frame_t inline_frames[WORK_INLINE_FRAMES];
+} work_t;
+
+static inline void work_init(work_t *w) {
+    w->frames = w->inline_frames;
+    w->len = 0;
+    w->cap = WORK_INLINE_FRAMES;
+}
+
+static inline int work_empty(work_t *w) {
+    return w->len == 0;
+}
+
+/**
+ * @brief Move to a heap array twice the size, see `work_push`
+ */
+static inline int work_grow(work_t *w) {
+    work_frame_t *frames;
+    if (w->frames == w->inline_frames) {
+        if ((frames = malloc(2 * w->cap * sizeof(work_frame_t))) == NULL)
+            return ERR_MEM_ALLOC;
+
+        for (size_t i = 0; i < w->len; i++)
+            frames[i] = w->frames[i];
+    } else if ((frames = realloc(w->frames,
+                    2 * w->cap * sizeof(work_frame_t))) == NULL) {
+        return ERR_MEM_ALLOC;
+    }
+
+    w->frames = frames;
+    w->cap *= 2;
+    return 0;
+}
+
+/**
+ * @return 0 on success, ERR_MEM_ALLOC otherwise
+ */
+static inline int work_push(work_t *w, expr_t *expr, expr_t **slot,
+        unsigned int depth, unsigned int state) {
+    if (w->len == w->cap && work_grow(w) < 0)
+        return ERR_MEM_ALLOC;
+
+    work_frame_t *f = &w->frames[w->len++];
+    f->expr = expr;
+    f->slot = slot;
+    f->depth = depth;
+    f->state = state;
+    return 0;
+}
+
+/**
+ * @brief `work_push` for a frame holding something other than an expr_t
+ *
+ * @return 0 on success, ERR_MEM_ALLOC otherwise
+ */
+static inline int work_push_node(work_t *w, void *node, expr_t **slot,
+        unsigned int depth, unsigned int state) {
+    if (work_push(w, NULL, slot, depth, state) < 0)
+        return ERR_MEM_ALLOC;
+
+    w->frames[w->len - 1].node = node;
+    return 0;
+}
+
+/**
+ * @brief Take the most recently pushed frame, the stack must not be empty
+ */
+static inline work_frame_t work_pop(work_t *w) {
+    return w->frames[--w->len];
+}
+
+/**
+ * @brief Most recently pushed frame, left in place so it can be updated
+ */
+static inline work_frame_t *work_top(work_t *w) {
+    return &w->frames[w->len - 1];
+}
+
+static inline void work_free(work_t *w) {
+    if (w->frames != w->inline_frames)
+        free(w->frames);
+
+    w->frames = w->inline_frames;
+    w->len = 0;
+    w->cap = WORK_INLINE_FRAMES;
+}
+
+#endif /* _WORK_H_ */
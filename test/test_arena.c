@@ -0,0 +1,88 @@
+/**
+ * @file test_arena.c
+ *
+ * @brief Unit tests for the region allocator
+ *
+ * @author Lars Wander
+ */
+
+#include "test_arena.h"
+#include <lib/arena.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EASY_SIZE 12
+
+int test_arena_easy() {
+    arena_t *arena = arena_new(0);
+    assert(arena != NULL);
+
+    char *a = arena_alloc(arena, EASY_SIZE);
+    char *b = arena_alloc(arena, EASY_SIZE);
+    assert(a != NULL && b != NULL && a != b);
+    memset(a, 'a', EASY_SIZE);
+    memset(b, 'b', EASY_SIZE);
+    assert(a[EASY_SIZE - 1] == 'a');
+
+    /* A released element of the same size class is handed out again */
+    arena_release(arena, a, EASY_SIZE);
+    assert(arena_alloc(arena, EASY_SIZE) == a);
+
+    arena_stats_t stats;
+    arena_stats(arena, &stats);
+    assert(stats.allocs == 3);
+    assert(stats.recycled == 1);
+    assert(stats.releases == 1);
+    assert(stats.live_bytes == stats.high_water);
+
+    arena_free(arena);
+    return 0;
+}
+
+#define HARD_ITERS 0x10000
+#define HARD_CHUNK 0x1000
+
+int test_arena_hard() {
+    arena_t *arena = arena_new(HARD_CHUNK);
+    void **elems = malloc(HARD_ITERS * sizeof(void *));
+    assert(elems != NULL);
+
+    /* Span many chunks, including oversized requests */
+    for (int i = 0; i < HARD_ITERS; i++) {
+        size_t size = (i % 64 == 0) ? HARD_CHUNK * 2 : (size_t)(i % 40) + 1;
+        assert((elems[i] = arena_alloc(arena, size)) != NULL);
+        memset(elems[i], i & 0xff, size);
+    }
+
+    arena_stats_t stats;
+    arena_stats(arena, &stats);
+    assert(stats.chunks > 1);
+    size_t high_water = stats.high_water;
+
+    /* Release & reallocate the small elements, which must not grow the
+     * footprint */
+    for (int i = 0; i < HARD_ITERS; i++)
+        if (i % 64 != 0)
+            arena_release(arena, elems[i], (size_t)(i % 40) + 1);
+
+    for (int i = 0; i < HARD_ITERS; i++)
+        if (i % 64 != 0)
+            assert(arena_alloc(arena, (size_t)(i % 40) + 1) != NULL);
+
+    arena_stats(arena, &stats);
+    assert(stats.high_water == high_water);
+    assert(stats.recycled == stats.releases);
+
+    /* Bulk release keeps a single chunk around */
+    arena_reset(arena);
+    arena_stats(arena, &stats);
+    assert(stats.live_bytes == 0);
+    assert(stats.chunks == 1);
+    assert(arena_alloc(arena, EASY_SIZE) != NULL);
+
+    free(elems);
+    arena_free(arena);
+    return 0;
+}
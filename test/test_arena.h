@@ -0,0 +1,15 @@
+/**
+ * @file test_arena.h
+ *
+ * @brief Unit test declarations for the arena allocator go here
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_ARENA_H_
+#define _TEST_ARENA_H_
+
+int test_arena_easy();
+int test_arena_hard();
+
+#endif /* _TEST_ARENA_H_ */
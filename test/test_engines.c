@@ -0,0 +1,350 @@
+/**
+ * @file test_engines.c
+ *
+ * @brief Unit tests checking every engine against the step engine
+ *
+ * @author Lars Wander
+ */
+
+/* strdup */
+#define _POSIX_C_SOURCE 200809L
+
+#include "test_engines.h"
+#include "test_term.h"
+#include "../src/interpreter.h"
+#include "../src/machine.h"
+#include "../src/nbe.h"
+#include "../src/bytecode.h"
+#include "../src/vm.h"
+#include "../src/jit.h"
+#include <err.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief An engine taking a closed term to its normal form
+ */
+typedef struct _engine {
+    const char *name;
+    int (*normalize)(expr_t *expr, expr_t **out);
+
+    /* Evaluates arguments first, so it may diverge where normal order
+     * doesn't */
+    int strict;
+} engine_t;
+
+static int _krivine(expr_t *expr, expr_t **out) {
+    return machine_eval(expr, MACHINE_KRIVINE, out);
+}
+
+static int _cek(expr_t *expr, expr_t **out) {
+    return machine_eval(expr, MACHINE_CEK, out);
+}
+
+static int _need(expr_t *expr, expr_t **out) {
+    return machine_eval(expr, MACHINE_NEED, out);
+}
+
+static int _vm(expr_t *expr, expr_t **out) {
+    int res;
+    bc_t *bc;
+    if ((res = bc_compile(expr, &bc)) < 0)
+        return res;
+
+    res = vm_run(bc, out);
+    bc_free(bc);
+    return res;
+}
+
+/**
+ * @brief Run on the VM after a trip through a bytecode file
+ */
+static int _vm_file(expr_t *expr, expr_t **out) {
+    int res;
+    bc_t *bc, *read;
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    if ((res = bc_compile(expr, &bc)) < 0)
+        goto cleanup;
+
+    res = bc_write(bc, fp);
+    bc_free(bc);
+    if (res < 0)
+        goto cleanup;
+
+    rewind(fp);
+    assert(bc_is_bytecode(fp));
+    if ((res = bc_read(fp, &read)) < 0)
+        goto cleanup;
+
+    res = vm_run(read, out);
+    bc_free(read);
+
+cleanup:
+    fclose(fp);
+    return res;
+}
+
+static const engine_t _engines[] = {
+    { "krivine", _krivine, 0 },
+    { "cek", _cek, 1 },
+    { "need", _need, 0 },
+    { "nbe", nbe_normalize, 0 },
+    { "vm", _vm, 1 },
+    { "vm file", _vm_file, 1 },
+
+    /* Elsewhere the JIT compiles nothing & the interpreter uses the VM */
+#if defined(__x86_64__) && defined(__linux__)
+    { "jit", jit_normalize, 1 }
+#endif
+};
+
+#define NENGINES (sizeof(_engines) / sizeof(_engines[0]))
+
+/* Terms every engine normalizes, whatever order it evaluates in */
+static const char *_terms[] = {
+    "(\\x. x)",
+    "(((\\x. (\\y. x)) (\\a. a)) (\\b. b))",
+
+    /* S K K */
+    "(((\\x. (\\y. (\\z. ((x z) (y z))))) (\\x. (\\y. x))) (\\x. (\\y. x)))",
+
+    /* The argument's free variable must not be captured */
+    "(\\y. ((\\x. (\\y. (x y))) y))",
+    "(\\y. (\\z. (((\\x. (\\y. (\\z. (x (y z))))) y) z)))",
+
+    /* Redexes under lambdas & past variables */
+    "(\\f. (f ((\\x. x) f)))",
+    "(\\a. ((\\x. x) (\\y. ((\\z. z) (y a)))))",
+
+    /* 2 + 2, 2 * 3 & 2 ^ 3 on Church numerals */
+    "(((\\m. (\\n. (\\f. (\\x. ((m f) ((n f) x)))))) "
+        "(\\f. (\\x. (f (f x))))) (\\f. (\\x. (f (f x)))))",
+    "(((\\m. (\\n. (\\f. (m (n f))))) (\\f. (\\x. (f (f x))))) "
+        "(\\f. (\\x. (f (f (f x))))))",
+    "((\\f. (\\x. (f (f (f x))))) (\\f. (\\x. (f (f x)))))",
+
+    /* The predecessor of 3 */
+    "((\\n. (\\f. (\\x. (((n (\\g. (\\h. (h (g f))))) (\\u. x)) "
+        "(\\u. u))))) (\\f. (\\x. (f (f (f x))))))"
+};
+
+/* Any term the step engine can't normalize within this is skipped */
+#define ENGINE_REF_STEPS (0x1000)
+#define ENGINE_REF_NODES (0x10000)
+
+/**
+ * @brief Normal form of `src` on the step engine, reducing in `strategy`
+ *
+ * @return The printed normal form to be freed by the caller, NULL if the
+ *         reduction didn't finish within budget
+ */
+static char *_reference(const char *src, strategy_e strategy) {
+    budget_t budget = { ENGINE_REF_STEPS, ENGINE_REF_NODES, 0 };
+    expr_t *expr = test_parse(src);
+    int res = normalize(expr, strategy, &budget, NULL);
+    if (res == ERR_BUDGET)
+        return NULL;
+
+    assert(res == 0);
+    char *nf = strdup(test_format(expr));
+    assert(nf != NULL);
+    return nf;
+}
+
+/**
+ * @brief Check every engine's normal form of `src` against `nf`
+ *
+ * @param strict Whether the strict engines are sure to finish too
+ */
+static void _check_engines(const char *src, const char *nf, int strict) {
+    expr_t *out;
+    for (unsigned int i = 0; i < NENGINES; i++) {
+        if (_engines[i].strict && !strict)
+            continue;
+
+        expr_t *expr = test_parse(src);
+        if (_engines[i].normalize(expr, &out) < 0 ||
+                strcmp(test_format(out), nf) != 0) {
+            fprintf(stderr, "\n%s: %s\n", _engines[i].name, src);
+            assert(0);
+        }
+
+        free_expr(out);
+        ast_release_all();
+    }
+}
+
+int test_engines_easy() {
+    int nterms = sizeof(_terms) / sizeof(_terms[0]);
+    for (int i = 0; i < nterms; i++) {
+        char *nf = _reference(_terms[i], STRATEGY_NORMAL);
+        assert(nf != NULL);
+        _check_engines(_terms[i], nf, 1);
+        free(nf);
+    }
+
+#if defined(__x86_64__) && defined(__linux__)
+    /* Nests deeper with every call, which the JIT hands back rather than
+     * overflow the stack */
+    expr_t *out;
+    assert(jit_normalize(test_parse("((\\x. ((x x) x)) (\\x. ((x x) x)))"),
+                &out) == ERR_UNSUPPORTED);
+    ast_release_all();
+#endif
+
+    return 0;
+}
+
+/* State of the term generator */
+static unsigned long _seed = 1;
+
+/**
+ * @brief Next number of a fixed pseudorandom sequence below `bound`
+ */
+static unsigned int _random(unsigned int bound) {
+    _seed = _seed * 6364136223846793005ul + 1442695040888963407ul;
+    return (unsigned int)(_seed >> 33) % bound;
+}
+
+#define GEN_NAMES "xyz"
+#define GEN_LEN (0x2000)
+
+/**
+ * @brief Append a random closed term at most `depth` deep to `buf`, whose
+ *        binders so far are named `scope`
+ */
+static void _generate(char *buf, unsigned int depth, const char *scope) {
+    char inner[16];
+    size_t nscope = strlen(scope);
+    unsigned int k = _random(10);
+    if (nscope > 0 && (depth == 0 || k < 3)) {
+        sprintf(buf + strlen(buf), "%c", scope[_random(nscope)]);
+    } else if (depth == 0 || k < 6 || nscope == 0) {
+        char name = GEN_NAMES[_random(sizeof(GEN_NAMES) - 1)];
+        sprintf(buf + strlen(buf), "(\\%c. ", name);
+        sprintf(inner, "%s%c", scope, name);
+        _generate(buf, depth - (depth > 0), inner);
+        strcat(buf, ")");
+    } else {
+        strcat(buf, "(");
+        _generate(buf, depth - 1, scope);
+        strcat(buf, " ");
+        _generate(buf, depth - 1, scope);
+        strcat(buf, ")");
+    }
+}
+
+/* Type variables of `_typable`, unified by pointing at each other, &
+ * arrows between two of them */
+typedef struct _type {
+    unsigned int parent;
+    unsigned int from;
+    unsigned int to;
+    int arrow;
+} type_t;
+
+#define TYPES_MAX (0x4000)
+static type_t _types[TYPES_MAX];
+static unsigned int _ntypes = 0;
+
+static unsigned int _type(int arrow, unsigned int from, unsigned int to) {
+    assert(_ntypes < TYPES_MAX);
+    _types[_ntypes] = (type_t){ _ntypes, from, to, arrow };
+    return _ntypes++;
+}
+
+static unsigned int _find(unsigned int t) {
+    while (_types[t].parent != t)
+        t = _types[t].parent;
+
+    return t;
+}
+
+static int _occurs(unsigned int v, unsigned int t) {
+    t = _find(t);
+    return t == v || (_types[t].arrow &&
+            (_occurs(v, _types[t].from) || _occurs(v, _types[t].to)));
+}
+
+static int _unify(unsigned int a, unsigned int b) {
+    a = _find(a);
+    b = _find(b);
+    if (a == b)
+        return 1;
+
+    if (!_types[a].arrow && _occurs(a, b))
+        return 0;
+    else if (!_types[a].arrow)
+        _types[a].parent = b;
+    else if (!_types[b].arrow)
+        return _unify(b, a);
+    else
+        return _unify(_types[a].from, _types[b].from) &&
+            _unify(_types[a].to, _types[b].to);
+
+    return 1;
+}
+
+/**
+ * @brief Infer a simple type of `expr` into `out`
+ *
+ * @param env Type of each enclosing binder, outermost first
+ *
+ * @return 1 if there is one, 0 otherwise
+ */
+static int _infer(expr_t *expr, unsigned int *env, unsigned int depth,
+        unsigned int *out) {
+    unsigned int a, b;
+    switch (expr->type) {
+        case (VAR):
+            *out = env[depth - 1 - expr->var.index];
+            return 1;
+        case (LAMBDA):
+            env[depth] = a = _type(0, 0, 0);
+            if (!_infer(expr->lam.body, env, depth + 1, &b))
+                return 0;
+
+            *out = _type(1, a, b);
+            return 1;
+        default:
+            if (!_infer(expr->appl.f, env, depth, &a) ||
+                    !_infer(expr->appl.x, env, depth, &b))
+                return 0;
+
+            *out = _type(0, 0, 0);
+            return _unify(a, _type(1, b, *out));
+    }
+}
+
+/**
+ * @brief Whether `src` is simply typable, & so normalizes under any order
+ */
+static int _typable(const char *src) {
+    unsigned int env[GEN_LEN], t;
+    _ntypes = 0;
+    return _infer(test_parse(src), env, 0, &t);
+}
+
+#define HARD_TERMS (0x800)
+
+int test_engines_hard() {
+    char src[GEN_LEN];
+    for (int i = 0; i < HARD_TERMS; i++) {
+        src[0] = '\0';
+        _generate(src, 2 + _random(7), "");
+        assert(strlen(src) < GEN_LEN);
+
+        char *nf = _reference(src, STRATEGY_NORMAL);
+        if (nf != NULL)
+            _check_engines(src, nf, _typable(src));
+
+        free(nf);
+        ast_release_all();
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+/**
+ * @file test_engines.h
+ *
+ * @brief Unit test declarations for the evaluation engines go here
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_ENGINES_H_
+#define _TEST_ENGINES_H_
+
+int test_engines_easy();
+int test_engines_hard();
+
+#endif /* _TEST_ENGINES_H_ */
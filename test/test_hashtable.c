@@ -30,7 +30,7 @@ int test_hashtable_easy() {
     return 0;
 }
 
-#define HARD_ITERS 0x1000
+#define HARD_ITERS 0x100000
 
 int test_hashtable_hard() {
     htable_t *ht = htable_new();
@@ -92,6 +92,23 @@ int test_hashtable_hard() {
         assert(v == i * 2);
     }
 
+    /* Churn through keys never seen before, one in one out */
+    for (int i = 0; i < HARD_ITERS; i++) {
+        sprintf(key, "%d", i);
+        assert(htable_delete(ht, key, NULL) >= 0);
+        sprintf(key, "x%d", i);
+        assert(htable_insert(ht, key, i) >= 0);
+    }
+
+    for (int i = 0; i < HARD_ITERS; i++) {
+        sprintf(key, "%d", i);
+        assert(htable_lookup(ht, key, NULL) < 0);
+        sprintf(key, "x%d", i);
+        int v;
+        assert(htable_lookup(ht, key, &v) >= 0);
+        assert(v == i);
+    }
+
     htable_free(ht, NULL);
     return 0;
 }
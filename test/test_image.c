@@ -0,0 +1,264 @@
+/**
+ * @file test_image.c
+ *
+ * @brief Unit tests for term images
+ *
+ * @author Lars Wander
+ */
+
+/* fmemopen & strdup */
+#define _POSIX_C_SOURCE 200809L
+
+#include "test_image.h"
+#include "test_term.h"
+#include "../src/image.h"
+#include <err.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Write the image of `src`
+ *
+ * @param len Size of the image
+ *
+ * @return The image, to be freed by the caller
+ */
+static unsigned char *_image(const char *src, size_t *len) {
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    assert(img_write(test_parse(src), fp) == 0);
+
+    long end = ftell(fp);
+    assert(end > 0);
+    rewind(fp);
+
+    unsigned char *img = malloc(end);
+    assert(img != NULL);
+    assert(fread(img, 1, end, fp) == (size_t)end);
+    fclose(fp);
+
+    *len = end;
+    return img;
+}
+
+/**
+ * @brief Load the `len` bytes of `img` both from a file, which is mapped, &
+ *        from memory, which is read as a stream. Both must agree
+ *
+ * @return What loading returned, the term is printed into `nf` on success
+ */
+static int _load(const unsigned char *img, size_t len, char **nf) {
+    expr_t *mapped = NULL, *read = NULL;
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    assert(fwrite(img, 1, len, fp) == len);
+    rewind(fp);
+    int res = img_load(fp, &mapped);
+    fclose(fp);
+
+    /* fmemopen can't open an empty buffer */
+    int streamed = res;
+    if (len > 0) {
+        assert((fp = fmemopen((void *)img, len, "r")) != NULL);
+        streamed = img_load(fp, &read);
+        fclose(fp);
+    }
+
+    assert(res == streamed);
+    *nf = NULL;
+    if (res == 0) {
+        assert((*nf = strdup(test_format(mapped))) != NULL);
+        assert(strcmp(*nf, test_format(read)) == 0);
+    }
+
+    ast_release_all();
+    return res;
+}
+
+/**
+ * @brief Check that the image of `src` loads back as the same term, names
+ *        included
+ */
+static void _round_trip(const char *src) {
+    char *want = strdup(test_format(test_parse(src)));
+    assert(want != NULL);
+
+    size_t len;
+    char *nf;
+    unsigned char *img = _image(src, &len);
+    assert(_load(img, len, &nf) == 0);
+    assert(strcmp(nf, want) == 0);
+
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    assert(fwrite(img, 1, len, fp) == len);
+    rewind(fp);
+    assert(img_is_image(fp));
+    assert(ftell(fp) == 0);
+    fclose(fp);
+
+    free(nf);
+    free(img);
+    free(want);
+    ast_release_all();
+}
+
+/**
+ * @brief Overwrite word `i` of a copy of `img` with `word`
+ *
+ * @return What loading the copy returned
+ */
+static int _load_patched(const unsigned char *img, size_t len, size_t i,
+        unsigned int word) {
+    char *nf;
+    unsigned char *copy = malloc(len);
+    assert(copy != NULL);
+    memcpy(copy, img, len);
+    memcpy(copy + i * sizeof(word), &word, sizeof(word));
+
+    int res = _load(copy, len, &nf);
+    free(copy);
+    free(nf);
+    return res;
+}
+
+static void _test_corrupt() {
+    size_t len, i;
+    char *nf;
+    const char *src = "(\\f. (\\x. (f (f x))))";
+    unsigned char *img = _image(src, &len);
+
+    /* Every truncation is caught */
+    for (i = 0; i < len; i++)
+        assert(_load(img, i, &nf) == ERR_CORRUPT);
+
+    /* As is anything past the end */
+    unsigned char *longer = calloc(len + 1, 1);
+    assert(longer != NULL);
+    memcpy(longer, img, len);
+    assert(_load(longer, len + 1, &nf) == ERR_CORRUPT);
+    free(longer);
+
+    /* The header & one more name offset than there are symbols come
+     * before the nodes, which are f, f, x, f x, f (f x), \x & \f */
+    unsigned int nsyms;
+    memcpy(&nsyms, img + 2 * sizeof(nsyms), sizeof(nsyms));
+    size_t nodes = IMG_HEADER_WORDS + nsyms + 1, words = 3;
+    assert(_load_patched(img, len, 0, 0x4d54434d) == ERR_CORRUPT);
+    assert(_load_patched(img, len, 1, IMG_VERSION + 1) == ERR_CORRUPT);
+    assert(_load_patched(img, len, 2, nsyms + 1) == ERR_CORRUPT);
+    assert(_load_patched(img, len, 3, 8) == ERR_CORRUPT);
+
+    /* An unknown node type */
+    assert(_load_patched(img, len, nodes, 7) == ERR_CORRUPT);
+
+    /* A variable bound by no lambda */
+    assert(_load_patched(img, len, nodes + 1, 2) == ERR_CORRUPT);
+
+    /* A reference from f x to itself, & one before the first node */
+    assert(_load_patched(img, len, nodes + 3 * words + 1, 0) ==
+            ERR_CORRUPT);
+    assert(_load_patched(img, len, nodes + 3 * words + 1, 4) ==
+            ERR_CORRUPT);
+
+    /* Two parents for x */
+    assert(_load_patched(img, len, nodes + 4 * words + 2, 2) ==
+            ERR_CORRUPT);
+
+    /* Flipping any byte never crashes the loader */
+    for (i = 0; i < len; i++) {
+        img[i] ^= 0xff;
+        int res = _load(img, len, &nf);
+        assert(res == 0 || res == ERR_CORRUPT);
+        free(nf);
+        img[i] ^= 0xff;
+    }
+
+    free(img);
+}
+
+int test_image_easy() {
+    _round_trip("(\\x. x)");
+    _round_trip("(\\f. (\\x. (f (f x))))");
+    _round_trip("((\\x. (x x)) (\\y. (y y)))");
+
+    /* Shadowed & reused names come back as written */
+    _round_trip("(\\x. (\\x. (\\y. (x (\\x. (y x))))))");
+    _round_trip("(\\longname. (\\x1. (longname x1)))");
+
+    /* Source files are never taken for images */
+    FILE *fp = fmemopen("(\\x. x)", 7, "r");
+    assert(fp != NULL);
+    assert(!img_is_image(fp));
+    fclose(fp);
+
+    _test_corrupt();
+    return 0;
+}
+
+/**
+ * @brief Run the executable with `args`
+ *
+ * @return What it printed, to be freed by the caller
+ */
+static char *_run_lcc(const char *args) {
+    char cmd[256], *out;
+    snprintf(cmd, sizeof(cmd), "./lcc %s 2>&1", args);
+
+    FILE *fp = popen(cmd, "r");
+    assert(fp != NULL);
+    out = malloc(0x10000);
+    assert(out != NULL);
+    out[fread(out, 1, 0x10000 - 1, fp)] = '\0';
+    assert(pclose(fp) == 0);
+    return out;
+}
+
+/**
+ * @brief An image written by --emit-bin runs as its source does
+ */
+static void _test_emit_bin() {
+    static const char *files[] = {
+        "test/code/add.lc", "test/code/t1.lc", "test/code/t2.lc"
+    };
+
+    for (int i = 0; i < 3; i++) {
+        char args[128];
+        snprintf(args, sizeof(args), "--emit-bin=obj/test.img %s", files[i]);
+        free(_run_lcc(args));
+
+        char *want = _run_lcc(files[i]);
+        char *got = _run_lcc("obj/test.img");
+        assert(strcmp(want, got) == 0);
+        free(want);
+        free(got);
+    }
+
+    remove("obj/test.img");
+}
+
+#define HARD_DEPTH (0x10000)
+
+int test_image_hard() {
+    /* Deep enough that neither writing nor loading may recurse */
+    char *src = malloc(8 * HARD_DEPTH + 32);
+    assert(src != NULL);
+    strcpy(src, "(\\f. (\\x. ");
+    char *at = src + strlen(src);
+    for (int i = 0; i < HARD_DEPTH; i++) {
+        memcpy(at, "(f ", 3);
+        at += 3;
+    }
+
+    *at++ = 'x';
+    memset(at, ')', HARD_DEPTH + 2);
+    strcpy(at + HARD_DEPTH + 2, "");
+    _round_trip(src);
+    free(src);
+
+    _test_emit_bin();
+    return 0;
+}
@@ -0,0 +1,15 @@
+/**
+ * @file test_image.h
+ *
+ * @brief Unit test declarations for term images go here
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_IMAGE_H_
+#define _TEST_IMAGE_H_
+
+int test_image_easy();
+int test_image_hard();
+
+#endif /* _TEST_IMAGE_H_ */
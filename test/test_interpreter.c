@@ -0,0 +1,330 @@
+/**
+ * @file test_interpreter.c
+ *
+ * @brief Unit tests for the interpreter's evaluation options
+ *
+ * @author Lars Wander
+ */
+
+/* WEXITSTATUS */
+#define _POSIX_C_SOURCE 200809L
+
+#include "test_interpreter.h"
+#include "test_term.h"
+#include "../src/interpreter.h"
+#include <err.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+/* Reduces to itself forever */
+#define OMEGA "((\\x. (x x)) (\\x. (x x)))"
+
+/* Grows by a copy of itself with every step */
+#define GROW "((\\x. ((x x) x)) (\\x. ((x x) x)))"
+
+/* Whose net grows without end */
+#define RUNAWAY "((\\a. a) ((\\f. (f (f f))) (\\g. (g (\\a. g)))))"
+
+/* 2 + 2 on Church numerals, seven terms long under normal order */
+#define ADD "(((\\m. (\\n. (\\f. (\\x. ((m f) ((n f) x)))))) " \
+    "(\\f. (\\x. (f (f x))))) (\\f. (\\x. (f (f x)))))"
+
+/* 2 ^ 3 on Church numerals */
+#define POW "((\\f. (\\x. (f (f (f x))))) (\\f. (\\x. (f (f x)))))"
+
+/* Exit status of the executable when a --max-* limit stops it */
+#define EXIT_BUDGET (3)
+
+/**
+ * @brief A term & what each strategy makes of it, in the order of
+ *        `_strategy_e`
+ */
+typedef struct _strategy_case {
+    const char *src;
+    struct {
+        unsigned long steps;
+        const char *nf;
+    } by[6];
+} strategy_case_t;
+
+/* Any strategy that doesn't stop within this many steps diverges */
+#define STRATEGY_STEPS (100)
+
+static const strategy_case_t _strategy_cases[] = {
+    /* Only the strict strategies reduce the argument first, the weak ones
+     * stop at the outer lambda */
+    { "((\\x. (\\y. x)) ((\\z. z) (\\w. w)))", {
+        { 2, "(λy. (λw. w))" },
+        { 2, "(λy. (λw. w))" },
+        { 2, "(λy. (λw. w))" },
+        { 1, "(λy. ((λz. z) (λw. w)))" },
+        { 1, "(λy. ((λz. z) (λw. w)))" },
+        { 2, "(λy. (λw. w))" } } },
+
+    /* Already weak normal, the others go under the lambdas */
+    { "(\\a. ((\\x. x) (\\y. ((\\z. z) y))))", {
+        { 2, "(λa. (λy. y))" },
+        { 2, "(λa. (λy. y))" },
+        { 0, "(λa. ((λx. x) (λy. ((λz. z) y))))" },
+        { 0, "(λa. ((λx. x) (λy. ((λz. z) y))))" },
+        { 0, "(λa. ((λx. x) (λy. ((λz. z) y))))" },
+        { 2, "(λa. (λy. y))" } } },
+
+    /* A discarded argument that diverges */
+    { "((\\x. (\\y. y)) ((\\x. (x x)) (\\x. (x x))))", {
+        { 1, "(λy. y)" },
+        { STRATEGY_STEPS, NULL },
+        { STRATEGY_STEPS, NULL },
+        { 1, "(λy. y)" },
+        { 1, "(λy. y)" },
+        { 1, "(λy. y)" } } },
+
+    /* A redex in the argument of a variable is past the head */
+    { "(\\f. (f ((\\x. x) f)))", {
+        { 1, "(λf. (f f))" },
+        { 1, "(λf. (f f))" },
+        { 0, "(λf. (f ((λx. x) f)))" },
+        { 0, "(λf. (f ((λx. x) f)))" },
+        { 0, "(λf. (f ((λx. x) f)))" },
+        { 0, "(λf. (f ((λx. x) f)))" } } }
+};
+
+static void _test_strategies() {
+    static const char *names[] = {
+        "normal", "applicative", "cbv", "cbn", "whnf", "hnf"
+    };
+
+    strategy_e strategy;
+    budget_t budget = { .steps = STRATEGY_STEPS };
+    int ncases = sizeof(_strategy_cases) / sizeof(_strategy_cases[0]);
+    for (int i = 0; i < ncases; i++) {
+        const strategy_case_t *c = &_strategy_cases[i];
+        for (int s = 0; s < 6; s++) {
+            assert(strategy_from_name(names[s], &strategy) == 0);
+            assert(strategy == (strategy_e)s);
+
+            expr_t *expr = test_parse(c->src);
+            int res = normalize(expr, strategy, &budget, NULL);
+            assert(normalize_steps() == c->by[s].steps);
+            if (c->by[s].nf == NULL) {
+                assert(res == ERR_BUDGET);
+                continue;
+            }
+
+            assert(res == 0);
+            assert(strcmp(test_format(expr), c->by[s].nf) == 0);
+        }
+    }
+
+    assert(strategy_from_name("lazy", &strategy) == ERR_INP);
+}
+
+/**
+ * @brief Evaluate `src` on `engine`, printing the terms `trace` & `n` pick
+ *
+ * @return What was printed, to be freed by the caller
+ */
+static char *_trace(const char *src, engine_e engine, trace_e trace,
+        unsigned long n) {
+    eval_opts_t opts = { .engine = engine, .trace = trace, .trace_n = n };
+    expr_t *ast = test_parse(src);
+    test_capture();
+    assert(eval_ast(ast, &opts) == 0);
+
+    char *res = strdup(test_captured());
+    assert(res != NULL);
+    return res;
+}
+
+/**
+ * @brief Number of lines in `text`
+ */
+static unsigned long _count_lines(const char *text) {
+    unsigned long res = 0;
+    for (; *text != '\0'; text++)
+        res += *text == '\n';
+
+    return res;
+}
+
+/**
+ * @brief Line `i` of `text` & its length, up to & including its \n
+ */
+static const char *_line(const char *text, unsigned long i, size_t *len) {
+    for (; i > 0; i--)
+        text = strchr(text, '\n') + 1;
+
+    *len = strchr(text, '\n') + 1 - text;
+    return text;
+}
+
+/**
+ * @brief Check every trace mode on `src` against the full trace
+ *
+ * @param max Largest `n` tried with TRACE_EVERY & TRACE_LAST
+ */
+static void _test_trace_of(const char *src, engine_e engine,
+        unsigned long max) {
+    char *full = _trace(src, engine, TRACE_ALL, 0);
+    unsigned long nlines = _count_lines(full);
+    assert(nlines > 1);
+
+    size_t len;
+    const char *line;
+    for (unsigned long n = 1; n <= max; n++) {
+        /* The final `n` lines of the full trace, or all of it */
+        char *last = _trace(src, engine, TRACE_LAST, n);
+        line = n < nlines ? _line(full, nlines - n, &len) : full;
+        assert(strcmp(last, line) == 0);
+        free(last);
+
+        /* The first term, every `n`th after it & the final term */
+        char *every = _trace(src, engine, TRACE_EVERY, n);
+        char *at = every;
+        for (unsigned long i = 0; i < nlines; i++) {
+            if (i % n != 0 && i != nlines - 1)
+                continue;
+
+            line = _line(full, i, &len);
+            assert(strncmp(at, line, len) == 0);
+            at += len;
+        }
+
+        assert(*at == '\0');
+        free(every);
+    }
+
+    char *quiet = _trace(src, engine, TRACE_QUIET, 0);
+    line = _line(full, nlines - 1, &len);
+    assert(strcmp(quiet, line) == 0);
+    free(quiet);
+
+    free(full);
+}
+
+static void _test_trace() {
+    _test_trace_of(ADD, ENGINE_STEP, 8);
+    _test_trace_of(ADD, ENGINE_HCONS, 8);
+
+    /* A term that is already normal is its own trace */
+    char *nf = _trace("(\\x. x)", ENGINE_STEP, TRACE_LAST, 3);
+    assert(_count_lines(nf) == 1);
+    free(nf);
+}
+
+/**
+ * @brief Evaluate `src` with `opts`, checking what it returns & that a
+ *        stopped run prints its partial result
+ */
+static void _eval_budget(const char *src, const eval_opts_t *opts, int res) {
+    expr_t *ast = test_parse(src);
+    test_capture();
+    int got = eval_ast(ast, opts);
+    const char *out = test_captured();
+
+    assert(got == res);
+    assert((strstr(out, "partial result") != NULL) == (res == ERR_BUDGET));
+}
+
+static void _test_budgets() {
+    budget_t budget = { 0 };
+
+    /* Each limit stops a reduction that would go on forever */
+    budget.steps = 10;
+    assert(normalize(test_parse(OMEGA), STRATEGY_NORMAL, &budget, NULL) ==
+            ERR_BUDGET);
+    assert(normalize_steps() == 10);
+
+    budget = (budget_t){ .nodes = 1000 };
+    assert(normalize(test_parse(GROW), STRATEGY_NORMAL, &budget, NULL) ==
+            ERR_BUDGET);
+
+    budget = (budget_t){ .millis = 20 };
+    assert(normalize(test_parse(OMEGA), STRATEGY_NORMAL, &budget, NULL) ==
+            ERR_BUDGET);
+
+    /* A term that is normal after the last allowed step is within budget */
+    budget = (budget_t){ .steps = 2 };
+    expr_t *expr = test_parse("((\\x. (x x)) (\\y. y))");
+    assert(normalize(expr, STRATEGY_NORMAL, &budget, NULL) == 0);
+    assert(normalize_steps() == 2);
+    assert(strcmp(test_format(expr), "(λy. y)") == 0);
+
+    /* The hash-consed DAG stays small while the cursor's path grows, which
+     * the node budget has to charge too */
+    eval_opts_t opts = { .engine = ENGINE_HCONS, .trace = TRACE_QUIET };
+    opts.budget = (budget_t){ .nodes = 1000 };
+    _eval_budget(GROW, &opts, ERR_BUDGET);
+
+    opts.budget = (budget_t){ .steps = 10 };
+    _eval_budget(OMEGA, &opts, ERR_BUDGET);
+    _eval_budget("((\\x. x) (\\y. y))", &opts, 0);
+
+    opts.engine = ENGINE_STEP;
+    opts.budget = (budget_t){ .millis = 20 };
+    _eval_budget(OMEGA, &opts, ERR_BUDGET);
+
+    /* Stopped nets can't be read back, so there's no partial result */
+    opts.engine = ENGINE_INET;
+    opts.budget = (budget_t){ .steps = 100 };
+    test_capture();
+    assert(eval_ast(test_parse(RUNAWAY), &opts) == ERR_BUDGET);
+    assert(strstr(test_captured(), "step budget exhausted") != NULL);
+}
+
+/**
+ * @brief Run the executable on `file` with `flags`
+ *
+ * @return Its exit status
+ */
+static int _run_lcc(const char *flags, const char *file) {
+    char cmd[256];
+    snprintf(cmd, sizeof(cmd), "./lcc %s %s > /dev/null 2>&1", flags, file);
+
+    int status = system(cmd);
+    assert(status != -1 && WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+static void _test_inet_cap() {
+    /* Without a node budget the net is still held to INET_MAX_NODES */
+    eval_opts_t opts = { .engine = ENGINE_INET };
+    test_capture();
+    assert(eval_ast(test_parse(RUNAWAY), &opts) == ERR_BUDGET);
+    assert(strstr(test_captured(), "node budget exhausted") != NULL);
+}
+
+static void _test_exit_status() {
+    assert(_run_lcc("--quiet --max-steps=100", "test/code/grow.lc") ==
+            EXIT_BUDGET);
+    assert(_run_lcc("--quiet --max-nodes=1000", "test/code/grow.lc") ==
+            EXIT_BUDGET);
+    assert(_run_lcc("--quiet --max-time=20", "test/code/grow.lc") ==
+            EXIT_BUDGET);
+    assert(_run_lcc("-H --quiet --max-nodes=1000", "test/code/grow.lc") ==
+            EXIT_BUDGET);
+    assert(_run_lcc("--engine=inet --max-steps=100", "test/code/grow.lc") ==
+            EXIT_BUDGET);
+
+    /* Terms that finish in time exit normally */
+    assert(_run_lcc("--quiet --max-steps=100", "test/code/t1.lc") == 0);
+}
+
+int test_interpreter_easy() {
+    _test_strategies();
+    _test_budgets();
+    _test_trace();
+    return 0;
+}
+
+int test_interpreter_hard() {
+    _test_inet_cap();
+    _test_trace_of(POW, ENGINE_STEP, 40);
+    _test_trace_of(POW, ENGINE_HCONS, 40);
+    _test_exit_status();
+    return 0;
+}
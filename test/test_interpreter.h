@@ -0,0 +1,15 @@
+/**
+ * @file test_interpreter.h
+ *
+ * @brief Unit test declarations for the interpreter go here
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_INTERPRETER_H_
+#define _TEST_INTERPRETER_H_
+
+int test_interpreter_easy();
+int test_interpreter_hard();
+
+#endif /* _TEST_INTERPRETER_H_ */
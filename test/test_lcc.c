@@ -7,6 +7,11 @@
  */
 
 #include "test_hashtable.h"
+#include "test_arena.h"
+#include "test_sink.h"
+#include "test_interpreter.h"
+#include "test_engines.h"
+#include "test_image.h"
 
 #include <stdio.h>
 
@@ -19,5 +24,48 @@ int main() {
     fflush(stdout);
     test_hashtable_hard();
     printf("PASSED >\n");
+    printf("< ARENA TEST >\n");
+    printf("< EASY MODE... ");
+    test_arena_easy();
+    printf("PASSED >\n");
+    printf("< HARD MODE... ");
+    fflush(stdout);
+    test_arena_hard();
+    printf("PASSED >\n");
+    printf("< SINK TEST >\n");
+    printf("< EASY MODE... ");
+    test_sink_easy();
+    printf("PASSED >\n");
+    printf("< HARD MODE... ");
+    fflush(stdout);
+    test_sink_hard();
+    printf("PASSED >\n");
+    printf("< INTERPRETER TEST >\n");
+    printf("< EASY MODE... ");
+    fflush(stdout);
+    test_interpreter_easy();
+    printf("PASSED >\n");
+    printf("< HARD MODE... ");
+    fflush(stdout);
+    test_interpreter_hard();
+    printf("PASSED >\n");
+    printf("< ENGINES TEST >\n");
+    printf("< EASY MODE... ");
+    fflush(stdout);
+    test_engines_easy();
+    printf("PASSED >\n");
+    printf("< HARD MODE... ");
+    fflush(stdout);
+    test_engines_hard();
+    printf("PASSED >\n");
+    printf("< IMAGE TEST >\n");
+    printf("< EASY MODE... ");
+    fflush(stdout);
+    test_image_easy();
+    printf("PASSED >\n");
+    printf("< HARD MODE... ");
+    fflush(stdout);
+    test_image_hard();
+    printf("PASSED >\n");
     return 0;
 }
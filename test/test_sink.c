@@ -0,0 +1,72 @@
+/**
+ * @file test_sink.c
+ *
+ * @brief Unit tests for the byte sink
+ *
+ * @author Lars Wander
+ */
+
+#include "test_sink.h"
+#include <lib/sink.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+int test_sink_easy() {
+    sink_t sink;
+    sink_init(&sink, NULL);
+
+    assert(sink_puts(&sink, "(\\x. ") == 0);
+    assert(sink_putc(&sink, 'x') == 0);
+    assert(sink_putc(&sink, '_') == 0);
+    assert(sink_putu(&sink, 0) == 0);
+    assert(sink_putu(&sink, 4294967295ul) == 0);
+    assert(sink_write(&sink, ")", 1) == 0);
+    assert(strcmp(sink_str(&sink), "(\\x. x_04294967295)") == 0);
+
+    /* The terminator doesn't get in the way of further writes */
+    assert(sink_putc(&sink, '!') == 0);
+    assert(strcmp(sink_str(&sink), "(\\x. x_04294967295)!") == 0);
+    assert(sink.len == strlen(sink.buf));
+
+    /* Without a file there is nothing to flush to */
+    assert(sink_flush(&sink) == 0);
+    assert(sink.len > 0);
+
+    sink_free(&sink);
+    return 0;
+}
+
+#define HARD_ITERS 0x40000
+
+int test_sink_hard() {
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+
+    /* Enough to drain to the file several times */
+    sink_t sink;
+    sink_init(&sink, fp);
+    for (int i = 0; i < HARD_ITERS; i++) {
+        assert(sink_putu(&sink, i % 10) == 0);
+        assert(sink_puts(&sink, "abcdefghi") == 0);
+    }
+
+    assert(sink.cap <= 2 * SINK_FILE_CHUNK);
+    assert(sink_flush(&sink) == 0);
+    assert(sink.len == 0);
+    assert(ftell(fp) == 10L * HARD_ITERS);
+
+    /* Everything arrived in order */
+    rewind(fp);
+    char chunk[10];
+    for (int i = 0; i < HARD_ITERS; i++) {
+        assert(fread(chunk, 1, sizeof(chunk), fp) == sizeof(chunk));
+        assert(chunk[0] == '0' + i % 10);
+        assert(memcmp(chunk + 1, "abcdefghi", 9) == 0);
+    }
+
+    sink_free(&sink);
+    fclose(fp);
+    return 0;
+}
@@ -0,0 +1,15 @@
+/**
+ * @file test_sink.h
+ *
+ * @brief Unit test declarations for the byte sink go here
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_SINK_H_
+#define _TEST_SINK_H_
+
+int test_sink_easy();
+int test_sink_hard();
+
+#endif /* _TEST_SINK_H_ */
@@ -0,0 +1,107 @@
+/**
+ * @file test_term.c
+ *
+ * @brief Helpers for the tests that parse, evaluate & print terms
+ *
+ * @author Lars Wander
+ */
+
+/* fmemopen, dup & fileno */
+#define _POSIX_C_SOURCE 200809L
+
+#include "test_term.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include <lib/sink.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Last term printed by `test_format` */
+static sink_t _formatted;
+static int _formatted_ready = 0;
+
+/* What stdout & stderr pointed at before `test_capture` */
+static int _saved_out = -1;
+static int _saved_err = -1;
+static FILE *_capture = NULL;
+static char *_captured = NULL;
+
+/**
+ * @brief Parse `src` as a program, the term lives in the AST arena
+ */
+expr_t *test_parse(const char *src) {
+    FILE *fp = fmemopen((void *)src, strlen(src), "r");
+    assert(fp != NULL);
+
+    lexer_t lx;
+    expr_t *ast = NULL;
+    assert(lexer_init(&lx, fp, EOF) == 0);
+    assert(parse(&lx, &ast) == 0);
+    assert(ast != NULL);
+
+    lexer_free(&lx);
+    fclose(fp);
+    return ast;
+}
+
+/**
+ * @brief Print `expr` the way the interpreter does, valid until the next call
+ */
+const char *test_format(expr_t *expr) {
+    if (!_formatted_ready) {
+        sink_init(&_formatted, NULL);
+        _formatted_ready = 1;
+    }
+
+    _formatted.len = 0;
+    assert(format_expr(&_formatted, expr) == 0);
+    return sink_str(&_formatted);
+}
+
+/**
+ * @brief Send whatever is printed to stdout & stderr to a scratch file until
+ *        `test_captured` is called
+ */
+void test_capture() {
+    fflush(stdout);
+    fflush(stderr);
+
+    assert((_capture = tmpfile()) != NULL);
+    assert((_saved_out = dup(STDOUT_FILENO)) >= 0);
+    assert((_saved_err = dup(STDERR_FILENO)) >= 0);
+    assert(dup2(fileno(_capture), STDOUT_FILENO) >= 0);
+    assert(dup2(fileno(_capture), STDERR_FILENO) >= 0);
+}
+
+/**
+ * @brief Restore stdout & stderr
+ *
+ * @return Everything printed since `test_capture`, valid until the next call
+ */
+const char *test_captured() {
+    fflush(stdout);
+    fflush(stderr);
+
+    assert(dup2(_saved_out, STDOUT_FILENO) >= 0);
+    assert(dup2(_saved_err, STDERR_FILENO) >= 0);
+    close(_saved_out);
+    close(_saved_err);
+
+    /* Written through the descriptors, so the stream has to seek to see it */
+    assert(fseek(_capture, 0, SEEK_END) == 0);
+    long len = ftell(_capture);
+    assert(len >= 0);
+    rewind(_capture);
+
+    free(_captured);
+    assert((_captured = malloc(len + 1)) != NULL);
+    assert(fread(_captured, 1, len, _capture) == (size_t)len);
+    _captured[len] = '\0';
+
+    fclose(_capture);
+    return _captured;
+}
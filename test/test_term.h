@@ -0,0 +1,19 @@
+/**
+ * @file test_term.h
+ *
+ * @brief Helpers for the tests that parse, evaluate & print terms
+ *
+ * @author Lars Wander
+ */
+
+#ifndef _TEST_TERM_H_
+#define _TEST_TERM_H_
+
+#include "../src/ast.h"
+
+expr_t *test_parse(const char *src);
+const char *test_format(expr_t *expr);
+void test_capture();
+const char *test_captured();
+
+#endif /* _TEST_TERM_H_ */